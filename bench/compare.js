@@ -0,0 +1,54 @@
+// Compare two result files written by `bench/throughput.js` and print the relative change of each
+// benchmark. Positive percentages are improvements.
+//
+// Usage: node bench/compare.js baseline.json candidate.json
+
+const { readFileSync } = require("fs")
+
+function keyOf(result) {
+  return result.shape ? `${result.benchmark}/${result.shape}` : result.benchmark
+}
+
+function formatChange(before, after, lowerIsBetter) {
+  if (before == undefined || after == undefined || before === 0) return "n/a".padStart(9)
+  const ratio = lowerIsBetter ? before / after : after / before
+  const percent = (ratio - 1) * 100
+  return `${percent >= 0 ? "+" : ""}${percent.toFixed(1)}%`.padStart(9)
+}
+
+function main() {
+  const [baselinePath, candidatePath] = process.argv.slice(2)
+  if (!baselinePath || !candidatePath) {
+    console.error("Usage: node bench/compare.js baseline.json candidate.json")
+    process.exit(1)
+  }
+
+  const baseline = JSON.parse(readFileSync(baselinePath, "utf8"))
+  const candidate = JSON.parse(readFileSync(candidatePath, "utf8"))
+  const baselineResults = new Map(baseline.results.map((r) => [keyOf(r), r]))
+
+  console.log(`baseline  ${baseline.commit || baselinePath} (${baseline.node})`)
+  console.log(`candidate ${candidate.commit || candidatePath} (${candidate.node})`)
+  console.log()
+  console.log(
+    `${"benchmark".padEnd(32)} ${"ns/op".padStart(12)} ${"speed".padStart(9)} ${"alloc".padStart(9)}`,
+  )
+  for (const result of candidate.results) {
+    const key = keyOf(result)
+    const before = baselineResults.get(key)
+    console.log(
+      `${key.padEnd(32)} ${result.nsPerOp.toFixed(0).padStart(12)} ` +
+        `${formatChange(before?.nsPerOp, result.nsPerOp, true)} ` +
+        `${formatChange(before?.bytesPerOp, result.bytesPerOp, true)}`,
+    )
+  }
+
+  if (baseline.startup && candidate.startup) {
+    console.log(
+      `${"startup".padEnd(32)} ${(candidate.startup.loadMs * 1e6).toFixed(0).padStart(12)} ` +
+        `${formatChange(baseline.startup.loadMs, candidate.startup.loadMs, true)}`,
+    )
+  }
+}
+
+main()
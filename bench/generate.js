@@ -0,0 +1,451 @@
+// Deterministic generator for synthetic `.cbuf` schemas and `.cb` logs. The same seed and options
+// always produce the same bytes, so benchmarks and stress tests can regenerate large inputs instead
+// of checking them in.
+//
+// Usage: node bench/generate.js --seed 1 --schema-out synth.cbuf --out synth.cb --size 2GB
+//   Schema shape:
+//     --namespaces N        Number of namespaces (default 4)
+//     --structs N           Structs per namespace (default 16)
+//     --fields MIN-MAX      Fields per struct (default 4-16)
+//     --depth N             Maximum struct nesting depth (default 3)
+//     --enums N             Enums per namespace (default 2)
+//     --arrays P            Probability that a field is an array (default 0.25)
+//     --strings P           Probability that a scalar field is a string (default 0.15)
+//     --naked P             Probability that a struct is @naked (default 0.2)
+//   Log contents:
+//     --size BYTES          Approximate log size, accepts KB/MB/GB suffixes (default 64MB)
+//     --count N             Number of messages, instead of --size
+//     --mix uniform|zipf|name=weight,...
+//                           Message type frequencies (default zipf)
+//     --timestamps monotonic|jitter|bursty|out-of-order
+//                           Timestamp pattern (default monotonic)
+//     --disorder P          Fraction of late messages for out-of-order (default 0.05)
+//     --max-delay SECONDS   Maximum lateness for out-of-order (default 1)
+//     --rate N              Mean messages per second (default 1000)
+//     --max-array N         Maximum dynamic array length (default 64)
+//     --pool N              Distinct payloads generated per type and reused (default 32, 0 for
+//                           a fresh payload per message)
+
+const { createWriteStream, writeFileSync } = require("fs")
+const path = require("path")
+
+const PACKAGE_DIR = path.join(__dirname, "..")
+
+const SCALAR_TYPES = ["u8", "s8", "u16", "s16", "u32", "s32", "u64", "s64", "f32", "f64", "bool"]
+const NUMERIC_TYPES = SCALAR_TYPES.filter((type) => type !== "bool")
+
+const DEFAULT_OPTIONS = {
+  seed: 1,
+  namespaces: 4,
+  structs: 16,
+  fields: [4, 16],
+  depth: 3,
+  enums: 2,
+  arrays: 0.25,
+  strings: 0.15,
+  naked: 0.2,
+  size: 64 * 1024 * 1024,
+  count: undefined,
+  mix: "zipf",
+  timestamps: "monotonic",
+  disorder: 0.05,
+  maxDelay: 1,
+  rate: 1000,
+  maxArray: 64,
+  pool: 32,
+  startTime: 1700000000,
+}
+
+/**
+ * Create a seeded pseudo-random number generator (mulberry32) with a few helpers.
+ *
+ * @param {number} seed
+ */
+function createRandom(seed) {
+  let state = seed >>> 0
+  const next = () => {
+    state = (state + 0x6d2b79f5) >>> 0
+    let t = state
+    t = Math.imul(t ^ (t >>> 15), t | 1)
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61)
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296
+  }
+  return {
+    next,
+    /** Integer in [min, max] */
+    int: (min, max) => min + Math.floor(next() * (max - min + 1)),
+    chance: (probability) => next() < probability,
+    pick: (items) => items[Math.floor(next() * items.length)],
+  }
+}
+
+/**
+ * Generate `.cbuf` schema text. Structs only reference structs declared before them in the same
+ * namespace, which keeps the schema valid and bounds nesting at `options.depth`.
+ *
+ * @param {typeof DEFAULT_OPTIONS} options
+ * @returns {string}
+ */
+function generateSchema(options) {
+  const rng = createRandom(options.seed)
+  let text = `// Generated by bench/generate.js --seed ${options.seed}\n`
+
+  for (let ns = 0; ns < options.namespaces; ns++) {
+    text += `namespace synth${ns} {\n`
+
+    const enums = []
+    for (let e = 0; e < options.enums; e++) {
+      const name = `Enum${e}`
+      const count = rng.int(2, 8)
+      const items = Array.from({ length: count }, (_, i) => `E${e}_V${i}`)
+      text += `  enum ${name} { ${items.join(", ")} }\n`
+      enums.push(name)
+    }
+
+    // Nesting depth of each struct declared so far
+    const structs = []
+    for (let s = 0; s < options.structs; s++) {
+      const name = `Struct${s}`
+      const naked = s > 0 && rng.chance(options.naked)
+      const fieldCount = rng.int(options.fields[0], options.fields[1])
+      let depth = 1
+      let body = ""
+
+      for (let f = 0; f < fieldCount; f++) {
+        const fieldName = `field${f}`
+        const nestable = structs.filter((st) => st.depth < options.depth)
+        const roll = rng.next()
+        let type
+        if (nestable.length > 0 && roll < 0.15) {
+          const nested = rng.pick(nestable)
+          type = nested.name
+          depth = Math.max(depth, nested.depth + 1)
+        } else if (enums.length > 0 && roll < 0.2) {
+          type = rng.pick(enums)
+        } else if (rng.chance(options.strings)) {
+          type = rng.chance(0.3) ? "short_string" : "string"
+        } else {
+          type = rng.pick(SCALAR_TYPES)
+        }
+
+        let suffix = ""
+        if (rng.chance(options.arrays)) {
+          const kind = rng.next()
+          const length = rng.int(1, 16)
+          if (kind < 0.4) {
+            suffix = `[${length}]`
+          } else if (kind < 0.7 || !NUMERIC_TYPES.includes(type)) {
+            suffix = "[]"
+          } else {
+            suffix = `[${length}] @compact`
+          }
+        }
+        body += `    ${type} ${fieldName}${suffix};\n`
+      }
+
+      text += `  struct ${name}${naked ? " @naked" : ""} {\n${body}  }\n`
+      structs.push({ name, depth })
+    }
+
+    text += "}\n"
+  }
+  return text
+}
+
+/**
+ * Generate a random message payload matching a message definition.
+ *
+ * @param {ReturnType<typeof createRandom>} rng
+ * @param {Map<string, import("../").CbufMessageDefinition>} schemaMap
+ * @param {import("../").CbufMessageDefinition} msgdef
+ * @param {typeof DEFAULT_OPTIONS} options
+ */
+function generateMessage(rng, schemaMap, msgdef, options) {
+  const message = {}
+  for (const field of msgdef.definitions) {
+    if (field.isArray) {
+      const length =
+        field.arrayLength ?? rng.int(0, field.arrayUpperBound ?? Math.max(options.maxArray, 0))
+      const values = new Array(length)
+      for (let i = 0; i < length; i++) {
+        values[i] = generateValue(rng, schemaMap, field, options)
+      }
+      message[field.name] = values
+    } else {
+      message[field.name] = generateValue(rng, schemaMap, field, options)
+    }
+  }
+  return message
+}
+
+function generateValue(rng, schemaMap, field, options) {
+  if (field.isComplex) {
+    return generateMessage(rng, schemaMap, schemaMap.get(field.type), options)
+  }
+  switch (field.type) {
+    case "bool":
+      return rng.chance(0.5)
+    case "int8":
+      return rng.int(-128, 127)
+    case "uint8":
+      return rng.int(0, 255)
+    case "int16":
+      return rng.int(-32768, 32767)
+    case "uint16":
+      return rng.int(0, 65535)
+    case "int32":
+      return rng.int(-0x80000000, 0x7fffffff)
+    case "uint32":
+      return rng.int(0, 0xffffffff)
+    case "int64":
+      return BigInt(rng.int(-0x80000000, 0x7fffffff)) * BigInt(rng.int(0, 0xffffffff))
+    case "uint64":
+      return BigInt(rng.int(0, 0xffffffff)) * BigInt(rng.int(0, 0xffffffff))
+    case "float32":
+      return Math.fround((rng.next() - 0.5) * 1e6)
+    case "float64":
+      return (rng.next() - 0.5) * 1e12
+    case "string": {
+      const maxLength = field.upperBound != undefined ? field.upperBound - 1 : 48
+      const length = rng.int(0, maxLength)
+      let str = ""
+      for (let i = 0; i < length; i++) {
+        str += String.fromCharCode(rng.int(0x61, 0x7a))
+      }
+      return str
+    }
+    default:
+      throw new Error(`Unsupported type ${field.type}`)
+  }
+}
+
+/**
+ * Return a function that picks message definitions according to `options.mix`.
+ *
+ * @param {ReturnType<typeof createRandom>} rng
+ * @param {import("../").CbufMessageDefinition[]} msgdefs
+ * @param {typeof DEFAULT_OPTIONS} options
+ */
+function messageMix(rng, msgdefs, options) {
+  let weights
+  if (options.mix === "uniform") {
+    weights = msgdefs.map(() => 1)
+  } else if (options.mix === "zipf") {
+    // A few high-rate types and a long tail of rare ones, like a typical robot log
+    weights = msgdefs.map((_, i) => 1 / (i + 1))
+  } else {
+    const explicit = new Map(
+      options.mix.split(",").map((entry) => {
+        const [name, weight] = entry.split("=")
+        return [name, Number(weight)]
+      }),
+    )
+    weights = msgdefs.map((msgdef) => explicit.get(msgdef.name) ?? 0)
+  }
+
+  const total = weights.reduce((a, b) => a + b, 0)
+  if (!(total > 0)) {
+    throw new Error(`Message mix "${options.mix}" does not select any message types`)
+  }
+  const cumulative = []
+  let sum = 0
+  for (const weight of weights) {
+    sum += weight / total
+    cumulative.push(sum)
+  }
+
+  return () => {
+    const x = rng.next()
+    let lo = 0
+    let hi = cumulative.length - 1
+    while (lo < hi) {
+      const mid = (lo + hi) >> 1
+      if (cumulative[mid] > x) hi = mid
+      else lo = mid + 1
+    }
+    return msgdefs[lo]
+  }
+}
+
+/**
+ * Return a function producing the next timestamp according to `options.timestamps`.
+ *
+ * @param {ReturnType<typeof createRandom>} rng
+ * @param {typeof DEFAULT_OPTIONS} options
+ */
+function timestampPattern(rng, options) {
+  const period = 1 / options.rate
+  let time = options.startTime
+  switch (options.timestamps) {
+    case "monotonic":
+      return () => (time += period)
+    case "jitter":
+      return () => (time += period * (0.5 + rng.next()))
+    case "bursty":
+      // Bursts of 10-100 messages 10us apart, with idle gaps that keep the mean rate
+      return (() => {
+        let remaining = 0
+        return () => {
+          if (remaining === 0) {
+            remaining = rng.int(10, 100)
+            time += period * remaining
+          }
+          remaining--
+          return (time += 1e-5)
+        }
+      })()
+    case "out-of-order":
+      // Mostly monotonic, but a fraction of messages arrive late carrying an older timestamp
+      return () => {
+        time += period
+        return rng.chance(options.disorder) ? time - rng.next() * options.maxDelay : time
+      }
+    default:
+      throw new Error(`Unknown timestamp pattern ${options.timestamps}`)
+  }
+}
+
+/**
+ * Write a `.cb` log of generated messages to a sink accepted by `CbufWriter`. Metadata messages
+ * carrying the schema text precede the first message of each type.
+ *
+ * @param {typeof import("../")} Cbuf The loaded wasm-cbuf module
+ * @param {string} schemaText
+ * @param {unknown} sink
+ * @param {typeof DEFAULT_OPTIONS} options
+ * @returns {Promise<{ messages: number; bytes: number }>}
+ */
+async function generateLog(Cbuf, schemaText, sink, options) {
+  const parsed = Cbuf.parseCBufSchema(schemaText)
+  if (parsed.error) throw new Error(parsed.error)
+  const schemaMap = parsed.schema
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  // Naked structs have no header so they can only appear nested inside other messages
+  const msgdefs = [...schemaMap.values()].filter((msgdef) => !msgdef.naked)
+  const rng = createRandom(options.seed ^ 0x9e3779b9)
+  const nextType = messageMix(rng, msgdefs, options)
+  const nextTimestamp = timestampPattern(rng, options)
+
+  const pools = new Map()
+  const payloadFor = (msgdef) => {
+    if (options.pool <= 0) return generateMessage(rng, schemaMap, msgdef, options)
+    let pool = pools.get(msgdef)
+    if (pool == undefined) {
+      pool = Array.from({ length: options.pool }, () =>
+        generateMessage(rng, schemaMap, msgdef, options),
+      )
+      pools.set(msgdef, pool)
+    }
+    return rng.pick(pool)
+  }
+
+  const writer = new Cbuf.CbufWriter({ schemaMap, hashMap, sink, schemaText })
+  const done = () =>
+    options.count != undefined
+      ? writer.messagesWritten >= options.count
+      : writer.bytesWritten >= options.size
+  while (!done()) {
+    const msgdef = nextType()
+    await writer.write({
+      typeName: msgdef.name,
+      hashValue: msgdef.hashValue,
+      timestamp: nextTimestamp(),
+      variant: rng.chance(0.1) ? rng.int(1, 3) : 0,
+      message: payloadFor(msgdef),
+    })
+  }
+  await writer.close()
+  return { messages: writer.messagesWritten, bytes: writer.bytesWritten }
+}
+
+function parseSize(value) {
+  const match = /^(\d+(?:\.\d+)?)\s*(B|KB|MB|GB)?$/i.exec(value)
+  if (!match) throw new Error(`Invalid size ${value}`)
+  const units = { B: 1, KB: 1024, MB: 1024 ** 2, GB: 1024 ** 3 }
+  return Math.round(Number(match[1]) * units[(match[2] || "B").toUpperCase()])
+}
+
+function parseArgs(argv) {
+  const options = { ...DEFAULT_OPTIONS }
+  const outputs = { schemaOut: undefined, out: undefined }
+  for (let i = 2; i < argv.length; i++) {
+    const value = argv[i + 1]
+    switch (argv[i]) {
+      case "--schema-out":
+        outputs.schemaOut = value
+        break
+      case "--out":
+        outputs.out = value
+        break
+      case "--fields":
+        options.fields = value.split("-").map(Number)
+        if (options.fields.length === 1) options.fields.push(options.fields[0])
+        break
+      case "--size":
+        options.size = parseSize(value)
+        break
+      case "--mix":
+      case "--timestamps":
+        options[argv[i].slice(2)] = value
+        break
+      case "--max-delay":
+        options.maxDelay = Number(value)
+        break
+      case "--max-array":
+        options.maxArray = Number(value)
+        break
+      default: {
+        const key = argv[i].slice(2)
+        if (!argv[i].startsWith("--") || !(key in DEFAULT_OPTIONS)) {
+          throw new Error(`Unknown argument ${argv[i]}`)
+        }
+        options[key] = Number(value)
+      }
+    }
+    i++
+  }
+  return { options, outputs }
+}
+
+async function main() {
+  const { options, outputs } = parseArgs(process.argv)
+  const schemaText = generateSchema(options)
+  if (outputs.schemaOut) {
+    writeFileSync(outputs.schemaOut, schemaText)
+  }
+  if (!outputs.out) {
+    if (!outputs.schemaOut) process.stdout.write(schemaText)
+    return
+  }
+
+  const Cbuf = require(PACKAGE_DIR)
+  await Cbuf.isLoaded
+  const start = Date.now()
+  const { messages, bytes } = await generateLog(
+    Cbuf,
+    schemaText,
+    createWriteStream(outputs.out),
+    options,
+  )
+  const seconds = (Date.now() - start) / 1000
+  console.error(
+    `Wrote ${messages} messages (${(bytes / 1024 ** 2).toFixed(1)} MB) to ${outputs.out} ` +
+      `in ${seconds.toFixed(1)}s`,
+  )
+}
+
+module.exports = {
+  DEFAULT_OPTIONS,
+  createRandom,
+  generateSchema,
+  generateMessage,
+  generateLog,
+}
+
+if (require.main === module) {
+  main().catch((err) => {
+    console.error(err)
+    process.exit(1)
+  })
+}
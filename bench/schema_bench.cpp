@@ -0,0 +1,335 @@
+// Native micro-benchmark for the schema pipeline. Each stage of parsing a `.cbuf` schema is timed
+// separately over synthetic schemas of increasing size, and the results are written to stdout as
+// one JSON object per line so they can be compared between commits.
+//
+// Usage: schema_bench [--sizes 10,100,1000,10000] [--min-time SECONDS] [--max-iterations N]
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Interp.h"
+#include "ParseStats.h"
+#include "Parser.h"
+#include "SchemaParser.h"
+#include "SymbolTable.h"
+#include "ast.h"
+#include "cbuf_preamble.h"
+
+// Defined in CBufParser.cpp
+bool compute_sizes(ast_struct* st, SymbolTable* symtable, Interp* interp);
+bool compute_simple(ast_struct* st, SymbolTable* symtable, Interp* interp);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Structs per namespace in the synthetic schema
+constexpr int kStructsPerNamespace = 50;
+
+enum Stage {
+  STAGE_LEX = 0,
+  STAGE_PARSE,
+  STAGE_SYMTABLE,
+  STAGE_SIZES,
+  STAGE_SIMPLE,
+  STAGE_HASHES,
+  STAGE_SKIP,
+  STAGE_PRINT,
+  NUM_STAGES
+};
+
+// clang-format off
+const char* StageNames[NUM_STAGES] = {
+  "Lexer::parseFile",
+  "Parser::ParseInternal",
+  "SymbolTable::initialize",
+  "compute_sizes",
+  "compute_simple",
+  "SchemaParser::computeHashes",
+  "SkipStructInternal",
+  "PrintInternal",
+};
+// clang-format on
+
+struct StageTimes {
+  double ns[NUM_STAGES] = {};
+};
+
+double ElapsedNs(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+/**
+ * Generate a schema with `num_structs` structs spread across namespaces. Every struct mixes
+ * scalars, a string, fixed and dynamic arrays, an enum and, for three out of four structs, a nested
+ * reference to the previous struct in its namespace.
+ */
+std::string GenerateSchema(int num_structs, int& num_fields) {
+  std::string out;
+  num_fields = 0;
+  for (int i = 0; i < num_structs; i++) {
+    int index_in_ns = i % kStructsPerNamespace;
+    if (index_in_ns == 0) {
+      if (i > 0) out += "}\n";
+      out += "namespace ns" + std::to_string(i / kStructsPerNamespace) + " {\n";
+      out += "enum Mode { IDLE, RUN = 4, STOP }\n";
+    }
+    out += "struct Msg" + std::to_string(i) + " {\n";
+    out += "  u32 id;\n  f64 stamp = 1.5;\n  string name;\n  short_string tag;\n";
+    out += "  f32 values[4];\n  u16 samples[];\n  u8 flags[8] @compact;\n  Mode mode;\n";
+    out += "  bool ok = true;\n";
+    num_fields += 9;
+    if (index_in_ns % 4 != 0) {
+      out += "  Msg" + std::to_string(i - 1) + " prev;\n";
+      num_fields++;
+    }
+    out += "}\n";
+  }
+  if (num_structs > 0) out += "}\n";
+  return out;
+}
+
+void AppendZeros(std::string& out, size_t count) {
+  out.append(count, '\0');
+}
+
+void AppendU32(std::string& out, uint32_t value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+size_t ElementTypeSize(ElementType type) {
+  switch (type) {
+    case TYPE_U8:
+    case TYPE_S8:
+    case TYPE_BOOL:
+      return 1;
+    case TYPE_U16:
+    case TYPE_S16:
+      return 2;
+    case TYPE_U32:
+    case TYPE_S32:
+    case TYPE_F32:
+      return 4;
+    case TYPE_U64:
+    case TYPE_S64:
+    case TYPE_F64:
+      return 8;
+    case TYPE_SHORT_STRING:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Encode a message for `st` with zeroed scalars, two element dynamic arrays and short strings, in
+ * the layout SkipStructInternal and PrintInternal expect.
+ */
+void EncodeStruct(const ast_struct* st, const SymbolTable* sym, std::string& out) {
+  if (!st->naked) {
+    cbuf_preamble preamble;
+    preamble.magic = CBUF_MAGIC;
+    preamble.hash = st->hash_value;
+    preamble.packet_timest = 0.0;
+    out.append(reinterpret_cast<const char*>(&preamble), sizeof(preamble));
+  }
+
+  for (const ast_element* elem : st->elements) {
+    uint32_t count = 1;
+    if (elem->array_suffix) {
+      if (elem->is_dynamic_array || elem->is_compact_array) {
+        count = elem->is_compact_array && elem->array_suffix->size < 2 ? 0 : 2;
+        AppendU32(out, count);
+      } else {
+        count = uint32_t(elem->array_suffix->size);
+      }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      if (elem->type == TYPE_STRING) {
+        AppendU32(out, 3);
+        out += "abc";
+      } else if (elem->type == TYPE_CUSTOM) {
+        if (sym->find_enum(elem) != nullptr) {
+          AppendZeros(out, 4);
+        } else {
+          EncodeStruct(sym->find_struct(elem), sym, out);
+        }
+      } else {
+        AppendZeros(out, ElementTypeSize(elem->type));
+      }
+    }
+  }
+}
+
+template <typename T>
+bool ForEachStruct(ast_global* ast, T func) {
+  for (auto* st : ast->global_space.structs) {
+    if (!func(st)) return false;
+  }
+  for (auto* sp : ast->spaces) {
+    for (auto* st : sp->structs) {
+      if (!func(st)) return false;
+    }
+  }
+  return true;
+}
+
+// Runs the same steps as CBufParser::ParseMetadata and SchemaParser::computeHashes with a timer
+// around each one, then skips and prints one encoded message per struct.
+class BenchParser : public SchemaParser {
+public:
+  bool Run(const std::string& schema, StageTimes& times) {
+    Interp interp;
+    // ParseMetadata does not hand the trailing newline to the parser
+    const u64 length = schema.size() - 1;
+
+    // The parser lexes internally; the library's stage timers split one pass into its lex and
+    // parse stages
+    CBUF_STATS_RESET();
+    Parser parser;
+    parser.interp = &interp;
+    ast = parser.ParseBuffer(schema.c_str(), length, pool, nullptr);
+    times.ns[STAGE_LEX] += g_parse_stats.stage_ms[PARSE_STAGE_LEX] * 1e6;
+    times.ns[STAGE_PARSE] += g_parse_stats.stage_ms[PARSE_STAGE_PARSE] * 1e6;
+    if (ast == nullptr || !parser.success) {
+      fprintf(stderr, "Parsing failed:\n%s\n", interp.getErrorString());
+      return false;
+    }
+
+    auto start = Clock::now();
+    sym = new SymbolTable;
+    sym->initialize(ast);
+    times.ns[STAGE_SYMTABLE] += ElapsedNs(start);
+
+    start = Clock::now();
+    bool ok = ForEachStruct(ast, [&](ast_struct* st) { return compute_sizes(st, sym, &interp); });
+    times.ns[STAGE_SIZES] += ElapsedNs(start);
+
+    start = Clock::now();
+    ok = ok && ForEachStruct(ast, [&](ast_struct* st) { return compute_simple(st, sym, &interp); });
+    times.ns[STAGE_SIMPLE] += ElapsedNs(start);
+
+    start = Clock::now();
+    ok = ok && computeHashes(ast, sym);
+    times.ns[STAGE_HASHES] += ElapsedNs(start);
+    if (!ok) {
+      fprintf(stderr, "Schema processing failed:\n%s\n%s\n", interp.getErrorString(),
+              lastError().c_str());
+      return false;
+    }
+
+    std::vector<std::pair<const ast_struct*, std::string>> messages;
+    ForEachStruct(ast, [&](ast_struct* st) {
+      messages.emplace_back(st, std::string{});
+      EncodeStruct(st, sym, messages.back().second);
+      return true;
+    });
+
+    start = Clock::now();
+    for (auto& [st, data] : messages) {
+      buffer = reinterpret_cast<unsigned char*>(data.data());
+      buf_size = data.size();
+      success = true;
+      if (!SkipStructInternal(st) || buf_size != 0) {
+        fprintf(stderr, "Failed to skip a message of %s\n", st->name);
+        return false;
+      }
+    }
+    times.ns[STAGE_SKIP] += ElapsedNs(start);
+
+    // PrintInternal writes to stdout, which carries the results, so silence it while timing
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    start = Clock::now();
+    for (auto& [st, data] : messages) {
+      buffer = reinterpret_cast<unsigned char*>(data.data());
+      buf_size = data.size();
+      success = true;
+      ok = ok && PrintInternal(st, std::string(st->name) + ".");
+    }
+    fflush(stdout);
+    times.ns[STAGE_PRINT] += ElapsedNs(start);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(devnull);
+    close(saved_stdout);
+
+    buffer = nullptr;
+    buf_size = 0;
+    return ok;
+  }
+};
+
+std::vector<int> ParseSizes(const char* arg) {
+  std::vector<int> sizes;
+  for (const char* p = arg; *p;) {
+    sizes.push_back(atoi(p));
+    p = strchr(p, ',');
+    if (p == nullptr) break;
+    p++;
+  }
+  return sizes;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<int> sizes = {10, 100, 1000, 10000};
+  double min_time = 1.0;
+  int max_iterations = 1000;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+      sizes = ParseSizes(argv[++i]);
+    } else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+      min_time = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--max-iterations") && i + 1 < argc) {
+      max_iterations = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--sizes 10,100,1000,10000] [--min-time SECONDS] "
+              "[--max-iterations N]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  for (int num_structs : sizes) {
+    int num_fields = 0;
+    std::string schema = GenerateSchema(num_structs, num_fields);
+
+    // One untimed warm-up run, then run until min_time has passed
+    StageTimes warmup;
+    if (!BenchParser().Run(schema, warmup)) return 1;
+
+    StageTimes times;
+    int iterations = 0;
+    auto start = Clock::now();
+    do {
+      if (!BenchParser().Run(schema, times)) return 1;
+      iterations++;
+    } while (iterations < max_iterations && ElapsedNs(start) < min_time * 1e9);
+
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+      double mean_ns = times.ns[stage] / iterations;
+      printf(
+        "{\"benchmark\":\"schema_pipeline\",\"stage\":\"%s\",\"structs\":%d,\"fields\":%d,"
+        "\"schema_bytes\":%zu,\"iterations\":%d,\"mean_ns\":%.1f,\"ns_per_struct\":%.2f}\n",
+        StageNames[stage], num_structs, num_fields, schema.size(), iterations, mean_ns,
+        num_structs > 0 ? mean_ns / num_structs : 0.0);
+    }
+    fflush(stdout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,325 @@
+// End-to-end throughput benchmark for wasm-cbuf. Measures schema load time, encode and decode
+// throughput, per-operation allocation and module startup time across several message shapes and
+// writes the results as JSON so runs can be compared between commits with `bench/compare.js`.
+//
+// Usage: node --expose-gc bench/throughput.js [--out results.json] [--min-time 1] [--shape name]
+
+const { execFileSync } = require("child_process")
+const { writeFileSync } = require("fs")
+const path = require("path")
+const { performance } = require("perf_hooks")
+
+const PACKAGE_DIR = path.join(__dirname, "..")
+
+const SHAPES_SCHEMA = `
+namespace bench {
+  enum Level { LOW, MID = 4, HIGH }
+
+  struct scalars {
+    u8 a; s8 b; u16 c; s16 d; u32 e; s32 f; u64 g; s64 h; f32 i; f64 j; bool k; Level level;
+  }
+
+  struct numeric_arrays {
+    f32 points[];
+    f64 ranges[1024];
+    u8 image[];
+    s16 samples[];
+  }
+
+  struct strings {
+    string name;
+    short_string tag;
+    string description;
+    string labels[8];
+  }
+
+  struct vec3 @naked { f64 x; f64 y; f64 z; }
+  struct pose { vec3 position; vec3 orientation; u32 frame; }
+  struct link { pose pose; string name; }
+  struct chain { link base; link mid; link tip; }
+  struct deep_nesting { chain arm; chain leg; pose root; }
+
+  struct struct_arrays {
+    vec3 points[];
+    pose poses[16];
+  }
+}
+`
+
+/** Message factories for each shape, keyed by the struct name inside `bench::` */
+const SHAPES = {
+  scalars: () => ({
+    a: 1,
+    b: -2,
+    c: 300,
+    d: -400,
+    e: 70000,
+    f: -80000,
+    g: 9000000000n,
+    h: -9000000000n,
+    i: 1.5,
+    j: Math.PI,
+    k: true,
+    level: 4,
+  }),
+  numeric_arrays: () => ({
+    points: Float32Array.from({ length: 4096 }, (_, i) => i * 0.5),
+    ranges: Float64Array.from({ length: 1024 }, (_, i) => i / 3),
+    image: Uint8Array.from({ length: 65536 }, (_, i) => i & 0xff),
+    samples: Int16Array.from({ length: 2048 }, (_, i) => i - 1024),
+  }),
+  strings: () => ({
+    name: "front_left_camera_driver",
+    tag: "sensor",
+    description: "Décodage de chaînes UTF-8 — ".repeat(8),
+    labels: ["alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel"],
+  }),
+  deep_nesting: () => {
+    const vec3 = (v) => ({ x: v, y: v + 1, z: v + 2 })
+    const pose = (v) => ({ position: vec3(v), orientation: vec3(-v), frame: v })
+    const link = (v) => ({ pose: pose(v), name: `link_${v}` })
+    const chain = (v) => ({ base: link(v), mid: link(v + 1), tip: link(v + 2) })
+    return { arm: chain(1), leg: chain(10), root: pose(100) }
+  },
+  struct_arrays: () => ({
+    points: Array.from({ length: 1000 }, (_, i) => ({ x: i, y: i * 2, z: i * 3 })),
+    poses: Array.from({ length: 16 }, (_, i) => ({
+      position: { x: i, y: 0, z: 0 },
+      orientation: { x: 0, y: 0, z: i },
+      frame: i,
+    })),
+  }),
+}
+
+function parseArgs(argv) {
+  const args = { out: undefined, minTime: 1, shapes: Object.keys(SHAPES), startupRuns: 5 }
+  for (let i = 2; i < argv.length; i++) {
+    switch (argv[i]) {
+      case "--out":
+        args.out = argv[++i]
+        break
+      case "--min-time":
+        args.minTime = Number(argv[++i])
+        break
+      case "--shape":
+        args.shapes = argv[++i].split(",")
+        break
+      case "--startup-runs":
+        args.startupRuns = Number(argv[++i])
+        break
+      default:
+        throw new Error(`Unknown argument ${argv[i]}`)
+    }
+  }
+  return args
+}
+
+/**
+ * Call `fn` repeatedly until at least `minTime` seconds have passed, doubling the batch size so
+ * the timer overhead stays negligible. Returns the mean time per call in nanoseconds.
+ */
+function timeIt(fn, minTime) {
+  // Warm up so the JIT has settled before timing
+  for (let i = 0; i < 10; i++) fn()
+
+  let batch = 1
+  let iterations = 0
+  let elapsedMs = 0
+  const minMs = minTime * 1000
+  do {
+    const start = performance.now()
+    for (let i = 0; i < batch; i++) fn()
+    elapsedMs += performance.now() - start
+    iterations += batch
+    batch *= 2
+  } while (elapsedMs < minMs)
+  return { iterations, nsPerOp: (elapsedMs * 1e6) / iterations }
+}
+
+/**
+ * Estimate the bytes allocated per call of `fn` from heap growth between forced collections. Runs
+ * small batches so a scavenge is unlikely to fire mid-batch, and takes the median of several
+ * samples. Returns undefined when the process was not started with `--expose-gc`.
+ */
+function bytesPerOp(fn) {
+  if (typeof global.gc !== "function") return undefined
+
+  const samples = []
+  for (let sample = 0; sample < 7; sample++) {
+    const batch = 100
+    global.gc()
+    const before = process.memoryUsage().heapUsed
+    for (let i = 0; i < batch; i++) fn()
+    const after = process.memoryUsage().heapUsed
+    // A collection during the batch makes the sample meaningless
+    if (after >= before) samples.push((after - before) / batch)
+  }
+  if (samples.length === 0) return undefined
+  samples.sort((a, b) => a - b)
+  return Math.round(samples[samples.length >> 1])
+}
+
+/**
+ * Measure the time to `require()` the package and await `isLoaded` in fresh processes, which
+ * includes compiling and instantiating the wasm module, and the warm start of a worker that
+ * instantiates the module compiled by its parent.
+ */
+function measureStartup(runs) {
+  const script = `
+const { Worker } = require("worker_threads")
+const start = process.hrtime.bigint()
+const Cbuf = require(${JSON.stringify(PACKAGE_DIR)})
+const required = process.hrtime.bigint()
+Cbuf.isLoaded.then(() => {
+  const loaded = process.hrtime.bigint()
+  const ms = (end) => Number(end - start) / 1e6
+  const worker = new Worker(
+    \`const { parentPort, workerData } = require("worker_threads")
+    const Cbuf = require(\${JSON.stringify(${JSON.stringify(PACKAGE_DIR)})})
+    Cbuf.init({ wasmModule: workerData }).then(() => parentPort.postMessage(Cbuf.getStartupTimings()))\`,
+    { eval: true, workerData: Cbuf.getWasmModule() },
+  )
+  worker.once("message", (warm) => {
+    const cold = Cbuf.getStartupTimings()
+    console.log(JSON.stringify({
+      requireMs: ms(required),
+      loadMs: ms(loaded),
+      compileMs: cold.compileMs,
+      instantiateMs: cold.instantiateMs,
+      warmLoadMs: warm.totalMs,
+    }))
+    worker.terminate()
+  })
+})
+`
+  const results = []
+  for (let i = 0; i < runs; i++) {
+    results.push(JSON.parse(execFileSync(process.execPath, ["-e", script], { encoding: "utf8" })))
+  }
+  const median = (values) => values.sort((a, b) => a - b)[values.length >> 1]
+  const startup = { runs }
+  for (const key of Object.keys(results[0])) {
+    startup[key] = median(results.map((r) => r[key]))
+  }
+  return startup
+}
+
+function gitCommit() {
+  try {
+    return execFileSync("git", ["rev-parse", "HEAD"], { cwd: PACKAGE_DIR, encoding: "utf8" }).trim()
+  } catch {
+    return undefined
+  }
+}
+
+async function main() {
+  const args = parseArgs(process.argv)
+  const Cbuf = require(PACKAGE_DIR)
+  await Cbuf.isLoaded
+
+  const results = []
+  const record = (result) => {
+    results.push(result)
+    console.error(
+      `${result.benchmark.padEnd(12)} ${(result.shape || "").padEnd(16)} ` +
+        `${result.nsPerOp.toFixed(0).padStart(10)} ns/op` +
+        (result.mbPerSec != undefined ? ` ${result.mbPerSec.toFixed(1).padStart(9)} MB/s` : "") +
+        (result.bytesPerOp != undefined ? ` ${String(result.bytesPerOp).padStart(9)} B/op` : ""),
+    )
+  }
+
+  // Schema load
+  let parsed
+  const schemaTiming = timeIt(() => {
+    parsed = Cbuf.parseCBufSchema(SHAPES_SCHEMA)
+  }, args.minTime)
+  if (parsed.error) throw new Error(parsed.error)
+  record({
+    benchmark: "parseSchema",
+    schemaBytes: SHAPES_SCHEMA.length,
+    structs: parsed.schema.size,
+    ...schemaTiming,
+    bytesPerOp: bytesPerOp(() => Cbuf.parseCBufSchema(SHAPES_SCHEMA)),
+  })
+
+  const schemaMap = parsed.schema
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  for (const shape of args.shapes) {
+    const factory = SHAPES[shape]
+    if (!factory) throw new Error(`Unknown shape ${shape}`)
+    const typeName = `bench::${shape}`
+    const msgdef = schemaMap.get(typeName)
+    const message = {
+      typeName,
+      hashValue: msgdef.hashValue,
+      timestamp: 1700000000.5,
+      variant: 0,
+      message: factory(),
+    }
+
+    const encoded = new Uint8Array(Cbuf.serializeMessage(schemaMap, hashMap, message))
+    const size = encoded.byteLength
+    const throughput = ({ iterations, nsPerOp }) => ({
+      iterations,
+      nsPerOp,
+      messagesPerSec: 1e9 / nsPerOp,
+      mbPerSec: (size * 1e3) / nsPerOp,
+    })
+
+    const encode = () => Cbuf.serializeMessage(schemaMap, hashMap, message)
+    record({
+      benchmark: "serialize",
+      shape,
+      messageBytes: size,
+      ...throughput(timeIt(encode, args.minTime)),
+      bytesPerOp: bytesPerOp(encode),
+    })
+
+    const scratch = new Uint8Array(size)
+    const encodeInto = () => Cbuf.serializeMessageInto(schemaMap, hashMap, message, scratch, 0)
+    record({
+      benchmark: "serializeInto",
+      shape,
+      messageBytes: size,
+      ...throughput(timeIt(encodeInto, args.minTime)),
+      bytesPerOp: bytesPerOp(encodeInto),
+    })
+
+    const decode = () => Cbuf.deserializeMessage(schemaMap, hashMap, encoded, 0)
+    record({
+      benchmark: "deserialize",
+      shape,
+      messageBytes: size,
+      ...throughput(timeIt(decode, args.minTime)),
+      bytesPerOp: bytesPerOp(decode),
+    })
+  }
+
+  const startup = measureStartup(args.startupRuns)
+  console.error(
+    `startup      require ${startup.requireMs.toFixed(1)} ms, loaded ${startup.loadMs.toFixed(1)} ms ` +
+      `(compile ${startup.compileMs.toFixed(1)} ms), worker warm start ${startup.warmLoadMs.toFixed(1)} ms`,
+  )
+
+  const output = {
+    date: new Date().toISOString(),
+    commit: gitCommit(),
+    node: process.version,
+    platform: `${process.platform}-${process.arch}`,
+    exposeGc: typeof global.gc === "function",
+    startup,
+    results,
+  }
+  const json = JSON.stringify(output, undefined, 2)
+  if (args.out) {
+    writeFileSync(args.out, json + "\n")
+  } else {
+    console.log(json)
+  }
+}
+
+main().catch((err) => {
+  console.error(err)
+  process.exit(1)
+})
@@ -0,0 +1,73 @@
+#!/usr/bin/env node
+// Generate specialized decoders for the message types of `.cbuf` schemas ahead of time, for
+// applications that can't compile them at runtime with `compileDecoders()` (for example under a
+// content security policy without 'unsafe-eval'). The output is a CommonJS module exporting
+// `register(Cbuf)`, which registers every decoder with `Cbuf.registerDecoder()`.
+//
+// Usage: cbuf-codegen [--type name[,name...]] --out decoders.js schema.cbuf [schema.cbuf ...]
+//
+// Inputs are concatenated in order and must have their #include statements expanded.
+
+const { readFileSync, writeFileSync } = require("fs")
+const path = require("path")
+
+function parseArgs(argv) {
+  const args = { out: undefined, types: undefined, inputs: [] }
+  for (let i = 2; i < argv.length; i++) {
+    switch (argv[i]) {
+      case "--out":
+        args.out = argv[++i]
+        break
+      case "--type":
+        args.types = argv[++i].split(",")
+        break
+      default:
+        if (argv[i].startsWith("--")) {
+          throw new Error(`Unknown argument ${argv[i]}`)
+        }
+        args.inputs.push(argv[i])
+    }
+  }
+  return args
+}
+
+async function main() {
+  const args = parseArgs(process.argv)
+  if (args.out == undefined || args.inputs.length === 0) {
+    console.error(
+      "Usage: cbuf-codegen [--type name[,name...]] --out decoders.js schema.cbuf [schema.cbuf ...]",
+    )
+    process.exit(1)
+  }
+
+  const Cbuf = require(path.join(__dirname, ".."))
+  await Cbuf.isLoaded
+
+  const text = args.inputs.map((input) => readFileSync(input, "utf8")).join("\n")
+  const { schema, error } = Cbuf.parseCBufSchema(text)
+  if (error != undefined) {
+    throw new Error(error)
+  }
+
+  const typeNames =
+    args.types ?? [...schema.values()].filter((def) => def.naked !== true).map((def) => def.name)
+  const lines = [
+    "// Generated by cbuf-codegen. Do not edit.",
+    "",
+    "module.exports.register = function register(Cbuf) {",
+  ]
+  for (const typeName of typeNames) {
+    const source = Cbuf.generateDecoderSource(schema, typeName)
+    const body = source.split("\n").map((line) => `    ${line}`)
+    lines.push(`  Cbuf.registerDecoder(${schema.get(typeName).hashValue}n, function (rt) {`)
+    lines.push(...body, "  })")
+  }
+  lines.push("}", "")
+  writeFileSync(args.out, lines.join("\n"))
+  console.error(`Wrote ${typeNames.length} decoders to ${args.out}`)
+}
+
+main().catch((err) => {
+  console.error(err.message)
+  process.exit(1)
+})
@@ -4,11 +4,31 @@ set -e
 
 mkdir -p dist
 
+# Set CBUF_ENABLE_STATS=ON to build with schema parsing instrumentation. libcbuf_parse must be built
+# with the same setting
+EXTRA_FLAGS=""
+if [ "${CBUF_ENABLE_STATS}" = "ON" ]; then
+  EXTRA_FLAGS="${EXTRA_FLAGS} -DCBUF_ENABLE_STATS"
+fi
+# Set CBUF_ALLOC_TAGGING=ON to attribute malloc bytes to parser subsystems in getMemoryStats()
+if [ "${CBUF_ALLOC_TAGGING}" = "ON" ]; then
+  EXTRA_FLAGS="${EXTRA_FLAGS} -DCBUF_ALLOC_TAGGING"
+fi
+
+# The plain C ABI in src/cbuf-c-api.h is always exported. Set CBUF_NO_EMBIND=ON to leave out the
+# embind bindings, which shrinks the module; index.js then parses schemas through the C ABI
+SOURCES="src/SchemaParser.cpp src/cbuf-c-api.cpp"
+if [ "${CBUF_NO_EMBIND}" != "ON" ]; then
+  SOURCES="${SOURCES} src/wasm-cbuf.cpp"
+  EXTRA_FLAGS="${EXTRA_FLAGS} --bind"
+fi
+C_API="_cbuf_alloc,_cbuf_free,_cbuf_registry_parse,_cbuf_registry_free,_cbuf_registry_json"
+C_API="${C_API},_cbuf_registry_count,_cbuf_registry_find,_cbuf_last_error,_cbuf_scan"
+
 emcc \
-  /cbuf/build/libcbuf_parse.a -o dist/wasm-cbuf.js src/SchemaParser.cpp src/wasm-cbuf.cpp \
+  /cbuf/build/libcbuf_parse.a -o dist/wasm-cbuf.js ${SOURCES} \
   -O3 `# compile with all optimizations enabled` \
   -msimd128 `# enable SIMD support` \
-  --bind `# enable emscripten function binding` \
   -I /cbuf/include `# add the cbuf include directory` \
   -I /cbuf/src `# add the cbuf src as an include directory as well for access to ast.h` \
   -s WASM=1 `# compile to .wasm instead of asm.js` \
@@ -18,9 +38,12 @@ emcc \
   -s NO_EXIT_RUNTIME=1 `# keep the process around after main exits` \
   -s TOTAL_STACK=1048576 `# use a 1MB stack size instead of the default 5MB` \
   -s INITIAL_MEMORY=1114112 `# start with a ~1MB allocation instead of 16MB, we will dynamically grow` \
+  -s IMPORTED_MEMORY=1 `# create the heap in JS so init() can override its initial size` \
   -s ALLOW_MEMORY_GROWTH=1  `# need this because we don't know how large decompressed blocks will be` \
   -s NODEJS_CATCH_EXIT=0 `# we don't use exit() and catching exit will catch all exceptions` \
   -s NODEJS_CATCH_REJECTION=0 `# prevent emscripten from adding an unhandledRejection handler` \
-  -s "EXPORTED_FUNCTIONS=[]"
+  -s "EXPORTED_FUNCTIONS=[${C_API}]" `# the C ABI from src/cbuf-c-api.h` \
+  -s "EXPORTED_RUNTIME_METHODS=[HEAPU8,HEAPU32]" `# heap views for C ABI pointer/length pairs` \
+  ${EXTRA_FLAGS}
 
-cp src/index.* dist/
+cp src/index.* src/runtime.* src/codegen.js src/log.js src/source.js src/changes.js dist/
@@ -5,7 +5,13 @@ set -e
 SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null 2>&1 && pwd )"
 cd $SCRIPT_DIR
 
-docker build . -t wasm-cbuf
+# Pass CBUF_ENABLE_STATS=ON to build with schema parsing instrumentation, and CBUF_ALLOC_TAGGING=ON
+# to attribute malloc bytes to parser subsystems. CBUF_NO_EMBIND=ON builds the module with only the
+# plain C ABI
+docker build . -t wasm-cbuf \
+  --build-arg CBUF_ENABLE_STATS="${CBUF_ENABLE_STATS:-OFF}" \
+  --build-arg CBUF_ALLOC_TAGGING="${CBUF_ALLOC_TAGGING:-OFF}" \
+  --build-arg CBUF_NO_EMBIND="${CBUF_NO_EMBIND:-OFF}"
 
 mkdir -p dist
 
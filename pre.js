@@ -27,3 +27,91 @@ Module.locateFile = function (input) {
     return input;
   }
 };
+
+// Compile and instantiate the wasm here instead of in the emscripten glue so a precompiled
+// WebAssembly.Module (for example one posted to a worker) can be reused, browsers compile while
+// the response is still downloading, and the time spent in each step is recorded for
+// getStartupTimings()
+Module["instantiateWasm"] = function (imports, receiveInstance) {
+  watchHeapGrowth();
+
+  var source;
+  var compileStart = performance.now();
+  var compiled;
+  if (Module["compiledModule"]) {
+    source = "module";
+    compiled = Promise.resolve(Module["compiledModule"]);
+  } else if (Module["wasmBinary"]) {
+    source = "binary";
+    compiled = WebAssembly.compile(Module["wasmBinary"]);
+  } else if (ENVIRONMENT_IS_NODE) {
+    source = "file";
+    compiled = require("fs")
+      .promises.readFile(Module.locateFile("wasm-cbuf.wasm"))
+      .then(function (binary) {
+        return WebAssembly.compile(binary);
+      });
+  } else {
+    var url = Module.locateFile("wasm-cbuf.wasm");
+    var compileBuffer = function () {
+      source = "fetch";
+      return fetch(url, { credentials: "same-origin" })
+        .then(function (response) {
+          return response.arrayBuffer();
+        })
+        .then(function (binary) {
+          return WebAssembly.compile(binary);
+        });
+    };
+    if (typeof WebAssembly.compileStreaming === "function") {
+      source = "streaming";
+      // compileStreaming rejects responses that are not served as application/wasm, so fall back
+      // to compiling the downloaded bytes
+      compiled = WebAssembly.compileStreaming(fetch(url, { credentials: "same-origin" })).catch(
+        compileBuffer,
+      );
+    } else {
+      compiled = compileBuffer();
+    }
+  }
+
+  compiled
+    .then(function (wasmModule) {
+      var instantiateStart = performance.now();
+      return WebAssembly.instantiate(wasmModule, imports).then(function (instance) {
+        Module["compiledModule"] = wasmModule;
+        Module["startupTimings"] = {
+          source: source,
+          compileMs: instantiateStart - compileStart,
+          instantiateMs: performance.now() - instantiateStart,
+        };
+        receiveInstance(instance, wasmModule);
+      });
+    })
+    .catch(function (err) {
+      abort(err);
+    });
+  return {};
+};
+
+// The heap memory is created by the emscripten glue (built with IMPORTED_MEMORY) from
+// Module.INITIAL_MEMORY. Count its growths, and when Module.memoryGrowthPages is set grow it by at
+// least that many pages at a time so a large batch grows the heap once instead of in many steps
+function watchHeapGrowth() {
+  var memory = wasmMemory;
+  var grow = memory.grow.bind(memory);
+  var step = Module["memoryGrowthPages"] || 0;
+  Module["heapGrowths"] = 0;
+  memory.grow = function (pages) {
+    var result;
+    try {
+      result = grow(Math.max(pages, step));
+    } catch (err) {
+      // Near the maximum size the step may not fit when the requested growth still does
+      if (pages >= step) throw err;
+      result = grow(pages);
+    }
+    Module["heapGrowths"]++;
+    return result;
+  };
+}
@@ -1,8 +1,11 @@
 #include "SchemaParser.h"
 
 #include <cstdint>
+#include <cstring>
 
+#include "AllocTags.h"
 #include "Interp.h"
+#include "ParseStats.h"
 #include "StdStringBuffer.h"
 #include "SymbolTable.h"
 
@@ -83,6 +86,8 @@ const std::string& SchemaParser::lastError() const {
 }
 
 bool SchemaParser::computeHashes(ast_global* ast, SymbolTable* symtable) {
+  CBUF_STATS_TIME_STAGE(PARSE_STAGE_COMPUTE_HASHES);
+  CBUF_ALLOC_TAG(ALLOC_TAG_HASHES);
   Interp interp;
 
   for (auto* st : ast->global_space.structs) {
@@ -159,3 +164,59 @@ bool SchemaParser::IsComplex(const ast_element* elem, const SymbolTable* symtabl
   }
   return false;
 }
+
+SchemaDefaultValue SchemaParser::DefaultValue(ElementType type, const ast_value* value) {
+  SchemaDefaultValue out;
+  // Integer literals wrap to the width of the field's element type
+  switch (type) {
+    case TYPE_U8:
+      out.kind = SchemaDefaultValue::UINT32;
+      out.u32 = uint8_t(value->int_val);
+      break;
+    case TYPE_U16:
+      out.kind = SchemaDefaultValue::UINT32;
+      out.u32 = uint16_t(value->int_val);
+      break;
+    case TYPE_U32:
+      out.kind = SchemaDefaultValue::UINT32;
+      out.u32 = uint32_t(value->int_val);
+      break;
+    case TYPE_S8:
+      out.kind = SchemaDefaultValue::INT32;
+      out.i32 = int8_t(value->int_val);
+      break;
+    case TYPE_S16:
+      out.kind = SchemaDefaultValue::INT32;
+      out.i32 = int16_t(value->int_val);
+      break;
+    case TYPE_S32:
+      out.kind = SchemaDefaultValue::INT32;
+      out.i32 = int32_t(value->int_val);
+      break;
+    case TYPE_U64:
+    case TYPE_S64:
+      out.kind = SchemaDefaultValue::INT64;
+      out.i64 = value->int_val;
+      break;
+    case TYPE_F32:
+    case TYPE_F64:
+      out.kind = SchemaDefaultValue::FLOAT;
+      // Integer literals are promoted to float fields without setting float_val
+      out.f64 = value->valtype == VALTYPE_INTEGER ? double(value->int_val) : value->float_val;
+      break;
+    case TYPE_STRING:
+    case TYPE_SHORT_STRING:
+      out.kind = SchemaDefaultValue::STRING;
+      out.str = value->str_val != nullptr ? value->str_val : "";
+      break;
+    case TYPE_BOOL:
+      out.kind = SchemaDefaultValue::BOOL;
+      // Legacy schemas initialize bools with 0 or 1
+      out.b = value->valtype == VALTYPE_INTEGER ? value->int_val != 0 : value->bool_val;
+      break;
+    case TYPE_CUSTOM:
+      // Custom type default values are not supported
+      break;
+  }
+  return out;
+}
@@ -1,8 +1,23 @@
 #pragma once
 
+#include <cstdint>
+
 #include "CBufParser.h"
 #include "ast.h"
 
+// A field default value converted to the type of its field, shared by the embind and C ABI schema
+// converters. Array literals are converted one element at a time
+struct SchemaDefaultValue {
+  enum Kind { NONE = 0, UINT32, INT32, INT64, FLOAT, STRING, BOOL };
+  Kind kind = NONE;
+  uint32_t u32 = 0;
+  int32_t i32 = 0;
+  int64_t i64 = 0;
+  double f64 = 0;
+  const char* str = nullptr;
+  bool b = false;
+};
+
 class SchemaParser : public CBufParser {
 public:
   SymbolTable* symbolTable() const;
@@ -12,4 +27,7 @@ public:
 
   static std::string TypeName(const ast_element* elem, const SymbolTable* symtable);
   static bool IsComplex(const ast_element* elem, const SymbolTable* symtable);
+  // Convert a literal default value, or one element of an array literal, to `type`. Integers wrap
+  // to the width of `type`. Custom types have no default values and convert to NONE
+  static SchemaDefaultValue DefaultValue(ElementType type, const ast_value* value);
 };
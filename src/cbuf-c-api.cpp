@@ -0,0 +1,356 @@
+#include "cbuf-c-api.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AllocTags.h"
+#include "ParseStats.h"
+#include "SchemaParser.h"
+#include "SymbolTable.h"
+#include "ast.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#define CBUF_EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define CBUF_EXPORT
+#endif
+
+// A parsed schema. Only the converted JSON and a hash index are kept, so the parser and its pools
+// are released as soon as parsing finishes
+struct Registry {
+  std::string json;
+  // Structs in JSON order. Counted separately from hash_index, which keeps only the first of
+  // structs sharing a hash
+  int32_t count = 0;
+  std::unordered_map<uint64_t, int32_t> hash_index;
+};
+
+// Handle N refers to registries[N - 1]. Freed slots are reused
+static std::vector<std::unique_ptr<Registry>> registries;
+static std::vector<uint32_t> free_handles;
+static std::string last_error;
+
+static Registry* FindRegistry(uint32_t handle) {
+  if (handle == 0 || handle > registries.size()) return nullptr;
+  return registries[handle - 1].get();
+}
+
+static void AppendJsonString(std::string& out, const char* str) {
+  out += '"';
+  for (const char* c = str; *c != '\0'; c++) {
+    switch (*c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (u8(*c) < 0x20) {
+          char escape[8];
+          snprintf(escape, sizeof(escape), "\\u%04x", *c);
+          out += escape;
+        } else {
+          out += *c;
+        }
+    }
+  }
+  out += '"';
+}
+
+template <typename... Args>
+static void AppendFormat(std::string& out, const char* format, Args... args) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), format, args...);
+  out += buf;
+}
+
+// Writes a default value as JSON. 64-bit integers are written as strings to keep their precision,
+// and non-finite floats, which JSON cannot represent, as "Infinity", "-Infinity" or "NaN"; the
+// JavaScript side converts both back
+static void AppendDefaultValue(std::string& out, ElementType type, const ast_value* value) {
+  SchemaDefaultValue converted = SchemaParser::DefaultValue(type, value);
+  switch (converted.kind) {
+    case SchemaDefaultValue::UINT32:
+      AppendFormat(out, "%" PRIu32, converted.u32);
+      break;
+    case SchemaDefaultValue::INT32:
+      AppendFormat(out, "%" PRId32, converted.i32);
+      break;
+    case SchemaDefaultValue::INT64:
+      AppendFormat(out, "\"%" PRId64 "\"", converted.i64);
+      break;
+    case SchemaDefaultValue::FLOAT:
+      if (std::isnan(converted.f64)) {
+        out += "\"NaN\"";
+      } else if (std::isinf(converted.f64)) {
+        out += converted.f64 > 0 ? "\"Infinity\"" : "\"-Infinity\"";
+      } else {
+        AppendFormat(out, "%.17g", converted.f64);
+      }
+      break;
+    case SchemaDefaultValue::STRING:
+      AppendJsonString(out, converted.str);
+      break;
+    case SchemaDefaultValue::BOOL:
+      out += converted.b ? "true" : "false";
+      break;
+    case SchemaDefaultValue::NONE:
+      out += "null";
+      break;
+  }
+}
+
+// Mirrors ParseNamespace() in wasm-cbuf.cpp, writing JSON instead of embind values
+static void AppendNamespace(std::string& out, const ast_namespace* ns, const SymbolTable* symtable,
+                            Registry* registry) {
+  std::string nsName = ns->name != nullptr ? std::string{ns->name} : "";
+  if (nsName == GLOBAL_NAMESPACE) {
+    nsName = "";
+  }
+
+  for (const ast_struct* st : ns->structs) {
+    CBUF_STATS_ADD(structs, 1);
+    CBUF_STATS_ADD(fields, st->elements.size());
+    std::string name = nsName.empty() ? std::string{st->name} : nsName + "::" + st->name;
+    registry->hash_index.emplace(st->hash_value, registry->count++);
+
+    if (out.back() != '[') out += ',';
+    out += "{\"name\":";
+    AppendJsonString(out, name.c_str());
+    AppendFormat(out, ",\"hashValue\":\"%" PRIu64 "\"", st->hash_value);
+    AppendFormat(out, ",\"line\":%u,\"column\":%u", st->loc.line, st->loc.col);
+    out += st->naked ? ",\"naked\":true" : ",\"naked\":false";
+
+    out += ",\"definitions\":[";
+    bool first = true;
+    for (const ast_element* elem : st->elements) {
+      if (!first) out += ',';
+      first = false;
+      out += "{\"name\":";
+      AppendJsonString(out, elem->name != nullptr ? elem->name : "");
+      out += ",\"type\":";
+      AppendJsonString(out, SchemaParser::TypeName(elem, symtable).c_str());
+
+      if (SchemaParser::IsComplex(elem, symtable)) {
+        out += ",\"isComplex\":true";
+      }
+
+      if (elem->init_value) {
+        if (elem->init_value->exptype == EXPTYPE_ARRAY_LITERAL) {
+          out += ",\"defaultValue\":[";
+          if (elem->type != TYPE_CUSTOM) {
+            bool firstValue = true;
+            for (const ast_value* value : static_cast<ast_array_value*>(elem->init_value)->values) {
+              if (!firstValue) out += ',';
+              firstValue = false;
+              AppendDefaultValue(out, elem->type, value);
+            }
+          }
+          out += ']';
+        } else if (elem->type != TYPE_CUSTOM) {
+          out += ",\"defaultValue\":";
+          AppendDefaultValue(out, elem->type, elem->init_value);
+        }
+      }
+
+      if (elem->type == TYPE_SHORT_STRING) {
+        AppendFormat(out, ",\"upperBound\":%u", elem->csize);
+      }
+
+      if (elem->array_suffix) {
+        out += ",\"isArray\":true";
+        if (!elem->is_dynamic_array) {
+          const char* format =
+            elem->is_compact_array ? ",\"arrayUpperBound\":%d" : ",\"arrayLength\":%d";
+          AppendFormat(out, format, int(elem->array_suffix->size));
+        }
+      }
+      out += '}';
+    }
+    out += "]}";
+  }
+}
+
+#ifdef CBUF_ENABLE_STATS
+static void AppendStats(std::string& out) {
+  const auto& stats = g_parse_stats;
+  AppendFormat(out, ",\"stats\":{\"timings\":{\"lex\":%.17g", stats.stage_ms[PARSE_STAGE_LEX]);
+  AppendFormat(out, ",\"parse\":%.17g", stats.stage_ms[PARSE_STAGE_PARSE]);
+  AppendFormat(out, ",\"symbolTable\":%.17g", stats.stage_ms[PARSE_STAGE_SYMBOL_TABLE]);
+  AppendFormat(out, ",\"computeSizes\":%.17g", stats.stage_ms[PARSE_STAGE_COMPUTE_SIZES]);
+  AppendFormat(out, ",\"computeHashes\":%.17g", stats.stage_ms[PARSE_STAGE_COMPUTE_HASHES]);
+  AppendFormat(out, ",\"convert\":%.17g}", stats.stage_ms[PARSE_STAGE_CONVERT]);
+  AppendFormat(out, ",\"tokens\":%" PRIu64, stats.tokens);
+  AppendFormat(out, ",\"structs\":%" PRIu64, stats.structs);
+  AppendFormat(out, ",\"fields\":%" PRIu64, stats.fields);
+  AppendFormat(out, ",\"symbolLookups\":%" PRIu64, stats.symbol_lookups);
+  AppendFormat(out, ",\"internHits\":%" PRIu64, stats.intern_hits);
+  AppendFormat(out, ",\"internMisses\":%" PRIu64, stats.intern_misses);
+  AppendFormat(out, ",\"poolBytes\":%" PRIu64 "}", stats.pool_bytes);
+}
+#endif
+
+static uint32_t Fail(const std::string& error, const char* fallback) {
+  last_error = error.empty() ? fallback : error;
+  return 0;
+}
+
+extern "C" {
+
+CBUF_EXPORT void* cbuf_alloc(uint32_t size) {
+  return malloc(size);
+}
+
+CBUF_EXPORT void cbuf_free(void* ptr) {
+  free(ptr);
+}
+
+CBUF_EXPORT uint32_t cbuf_registry_parse(const char* text, uint32_t len, int32_t collect_stats) {
+  CBUF_STATS_RESET();
+
+  std::string schemaStr{text, len};
+  // Ensure schemaStr ends with a newline. The parser will fail otherwise
+  if (schemaStr.empty() || schemaStr.back() != '\n') {
+    schemaStr += '\n';
+  }
+
+  SchemaParser parser;
+  if (!parser.ParseMetadata(schemaStr, "")) {
+    return Fail(parser.lastError(), "Schema parsing failed");
+  }
+
+  ast_global* ast = parser.parsedAst();
+  if (ast == nullptr) {
+    return Fail(parser.lastError(), "No AST after schema parsing");
+  }
+
+  SymbolTable* symtable = parser.symbolTable();
+  if (!parser.computeHashes(ast, symtable)) {
+    return Fail(parser.lastError(), "Failed to compute hashes");
+  }
+
+  auto registry = std::make_unique<Registry>();
+  std::string& json = registry->json;
+  json = "{\"schema\":[";
+  {
+    CBUF_STATS_TIME_STAGE(PARSE_STAGE_CONVERT);
+    CBUF_ALLOC_TAG(ALLOC_TAG_CONVERT);
+    AppendNamespace(json, &ast->global_space, symtable, registry.get());
+    for (const ast_namespace* ns : ast->spaces) {
+      AppendNamespace(json, ns, symtable, registry.get());
+    }
+  }
+  json += ']';
+#ifdef CBUF_ENABLE_STATS
+  if (collect_stats) {
+    AppendStats(json);
+  }
+#else
+  (void)collect_stats;
+#endif
+  json += '}';
+
+  if (!free_handles.empty()) {
+    uint32_t handle = free_handles.back();
+    free_handles.pop_back();
+    registries[handle - 1] = std::move(registry);
+    return handle;
+  }
+  registries.push_back(std::move(registry));
+  return uint32_t(registries.size());
+}
+
+CBUF_EXPORT void cbuf_registry_free(uint32_t handle) {
+  if (FindRegistry(handle) == nullptr) return;
+  registries[handle - 1].reset();
+  free_handles.push_back(handle);
+}
+
+CBUF_EXPORT const char* cbuf_registry_json(uint32_t handle, uint32_t* len) {
+  Registry* registry = FindRegistry(handle);
+  if (registry == nullptr) {
+    *len = 0;
+    return nullptr;
+  }
+  *len = uint32_t(registry->json.size());
+  return registry->json.c_str();
+}
+
+CBUF_EXPORT uint32_t cbuf_registry_count(uint32_t handle) {
+  Registry* registry = FindRegistry(handle);
+  return registry != nullptr ? uint32_t(registry->count) : 0;
+}
+
+CBUF_EXPORT int32_t cbuf_registry_find(uint32_t handle, uint64_t hash) {
+  Registry* registry = FindRegistry(handle);
+  if (registry == nullptr) return -1;
+  auto it = registry->hash_index.find(hash);
+  return it != registry->hash_index.end() ? it->second : -1;
+}
+
+CBUF_EXPORT const char* cbuf_last_error(uint32_t* len) {
+  *len = uint32_t(last_error.size());
+  return last_error.c_str();
+}
+
+CBUF_EXPORT int32_t cbuf_scan(const uint8_t* data, uint32_t len, CbufScanEntry* entries,
+                              uint32_t max_entries, uint32_t* consumed) {
+  // Header layout, all little endian:
+  //   CBUF_MAGIC (4 bytes) 0x56444e54
+  //   size uint32_t (4 bytes), with the variant in bits 27-30 when bit 31 is set
+  //   hashValue uint64_t (8 bytes)
+  //   timestamp double (8 bytes)
+  const uint32_t header_size = 24;
+  uint32_t offset = 0;
+  uint32_t count = 0;
+  while (count < max_entries && len - offset >= header_size) {
+    const uint8_t* header = data + offset;
+    uint32_t magic, size_and_variant;
+    memcpy(&magic, header, 4);
+    memcpy(&size_and_variant, header + 4, 4);
+    if (magic != 0x56444e54) {
+      *consumed = offset;
+      return CBUF_SCAN_BAD_MAGIC;
+    }
+
+    bool has_variant = (size_and_variant & 0x80000000) != 0;
+    uint32_t size = has_variant ? size_and_variant & 0x07ffffff : size_and_variant & 0x7fffffff;
+    if (size < header_size) {
+      *consumed = offset;
+      return CBUF_SCAN_BAD_SIZE;
+    }
+    // Partial trailing message
+    if (size > len - offset) break;
+
+    CbufScanEntry& entry = entries[count++];
+    memcpy(&entry.hash, header + 8, 8);
+    memcpy(&entry.timestamp, header + 16, 8);
+    entry.offset = offset;
+    entry.size = size;
+    entry.variant = has_variant ? (size_and_variant >> 27) & 0x0f : 0;
+    entry.reserved = 0;
+    offset += size;
+  }
+  *consumed = offset;
+  return int32_t(count);
+}
+
+}  // extern "C"
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// Plain C ABI exported alongside the embind bindings, and on its own in builds made with
+// CBUF_NO_EMBIND=ON. Everything crosses the boundary as integers: registries are referred to by
+// handles, and strings and scan results are pointer/length pairs in the wasm heap.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One framed message found by cbuf_scan()
+typedef struct CbufScanEntry {
+  uint64_t hash;
+  double timestamp;
+  // Offset of the message header from the start of the scanned data
+  uint32_t offset;
+  // Message size including the 24 byte header
+  uint32_t size;
+  uint32_t variant;
+  uint32_t reserved;
+} CbufScanEntry;
+
+// Error codes returned by cbuf_scan()
+#define CBUF_SCAN_BAD_MAGIC -1
+#define CBUF_SCAN_BAD_SIZE -2
+
+// Heap allocation for passing inputs in and freeing outputs
+void* cbuf_alloc(uint32_t size);
+void cbuf_free(void* ptr);
+
+// Parses `len` bytes of `.cbuf` schema text with all #include statements expanded. Returns a
+// registry handle, or 0 on failure with the reason available from cbuf_last_error(). When
+// `collect_stats` is nonzero and the module was built with CBUF_ENABLE_STATS, the registry JSON
+// includes stage timings and counters.
+uint32_t cbuf_registry_parse(const char* text, uint32_t len, int32_t collect_stats);
+// Releases a registry handle
+void cbuf_registry_free(uint32_t handle);
+// The registry as UTF-8 JSON, `{"schema": [...], "stats": {...}}`, in the same shape as the
+// embind parseCBufSchema() result except that hash values and 64-bit integer defaults are decimal
+// strings, and non-finite float defaults are the strings "Infinity", "-Infinity" and "NaN". The
+// pointer stays valid until the handle is freed.
+const char* cbuf_registry_json(uint32_t handle, uint32_t* len);
+// Number of structs in the registry
+uint32_t cbuf_registry_count(uint32_t handle);
+// Index of the first struct with the given hash in registry JSON order, or -1
+int32_t cbuf_registry_find(uint32_t handle, uint64_t hash);
+// The error from the last failed cbuf_registry_parse(), valid until the next parse
+const char* cbuf_last_error(uint32_t* len);
+
+// Frames the messages in a buffer of concatenated cbuf messages, writing up to `max_entries`
+// entries. Returns the number of entries written, or a negative CBUF_SCAN_* error code.
+// `*consumed` is set to the offset just past the last complete message found, so a caller can
+// resume after a partial trailing message or a full entries array.
+int32_t cbuf_scan(const uint8_t* data, uint32_t len, CbufScanEntry* entries,
+                  uint32_t max_entries, uint32_t* consumed);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,422 @@
+// Change detection between consecutive messages of a type, compared in their serialized form. A
+// layout plan flattens a definition into runs of fixed-size fields, which are compared a word at a
+// time before looking at individual fields, and variable-size fields, which are compared one at a
+// time. Neither message is decoded.
+
+const CBUF_MAGIC = 0x56444e54
+const HEADER_SIZE = 24
+
+// `metadata.cbuf`, bootstrapped as in the runtime so metadata messages in a log can be compared
+// without being in the hash map
+const METADATA_DEFINITION = {
+  name: "cbufmsg::metadata",
+  hashValue: 0xbe6738d544ab72c6n,
+  definitions: [
+    { name: "msg_hash", type: "uint64" },
+    { name: "msg_name", type: "string" },
+    { name: "msg_meta", type: "string" },
+  ],
+}
+
+// The serialized size of each primitive type. Strings are handled separately
+const ELEMENT_SIZES = {
+  bool: 1,
+  int8: 1,
+  uint8: 1,
+  int16: 2,
+  uint16: 2,
+  int32: 4,
+  uint32: 4,
+  float32: 4,
+  int64: 8,
+  uint64: 8,
+  float64: 8,
+}
+
+/**
+ * @typedef {import("./runtime").CbufMessageDefinition} CbufMessageDefinition
+ * @typedef {{ path: string; start: number; end: number }} FixedField
+ * @typedef {(
+ *   | { kind: "fixed"; size: number; fields: FixedField[] }
+ *   | { kind: "string"; path: string }
+ *   | { kind: "array"; path: string; elementSize: number }
+ *   | { kind: "elements"; path: string; length: number | undefined; element: LayoutStep[] }
+ * )} LayoutStep
+ * @typedef {{ steps: LayoutStep[]; paths: string[] }} LayoutPlan
+ */
+
+/** @type {WeakMap<CbufMessageDefinition, LayoutPlan>} */
+const layoutPlans = new WeakMap()
+
+/**
+ * Get the layout plan of a message definition, building it on first use.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {CbufMessageDefinition} msgdef
+ * @returns {LayoutPlan}
+ */
+function layoutPlan(schemaMap, msgdef) {
+  let plan = layoutPlans.get(msgdef)
+  if (plan == undefined) {
+    plan = { steps: [], paths: [] }
+    addLayoutSteps(schemaMap, msgdef, "", plan.steps, plan.paths)
+    layoutPlans.set(msgdef, plan)
+  }
+  return plan
+}
+
+/**
+ * Append the steps of a struct body to `steps`. Nested structs are inlined, naked or not, since
+ * their bytes follow the parent's in order; the header of a non-naked struct becomes unnamed fixed
+ * bytes. Adjacent fixed-size fields are merged into one "fixed" step.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {CbufMessageDefinition} msgdef
+ * @param {string} prefix The dotted path of the struct, including a trailing `.`
+ * @param {LayoutStep[]} steps
+ * @param {string[] | undefined} paths Receives the path of every reported field
+ */
+function addLayoutSteps(schemaMap, msgdef, prefix, steps, paths) {
+  for (const field of msgdef.definitions) {
+    const path = prefix + field.name
+
+    if (field.isArray === true) {
+      // Arrays are reported as a whole
+      paths?.push(path)
+      const element = elementSteps(schemaMap, field)
+      if (element.length === 1 && element[0].kind === "fixed") {
+        if (field.arrayLength != undefined) {
+          addFixed(steps, path, field.arrayLength * element[0].size)
+        } else {
+          steps.push({ kind: "array", path, elementSize: element[0].size })
+        }
+      } else {
+        steps.push({ kind: "elements", path, length: field.arrayLength, element })
+      }
+    } else if (field.isComplex === true) {
+      const nestedMsgdef = nestedDefinition(schemaMap, field)
+      if (nestedMsgdef.naked !== true) {
+        addFixed(steps, undefined, HEADER_SIZE)
+      }
+      addLayoutSteps(schemaMap, nestedMsgdef, path + ".", steps, paths)
+    } else {
+      paths?.push(path)
+      if (field.type === "string" && field.upperBound == undefined) {
+        steps.push({ kind: "string", path })
+      } else {
+        addFixed(steps, path, fieldSize(field))
+      }
+    }
+  }
+}
+
+/**
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {import("./runtime").MessageDefinitionField} field An array field
+ * @returns {LayoutStep[]} The steps of one array element
+ */
+function elementSteps(schemaMap, field) {
+  const steps = []
+  if (field.isComplex === true) {
+    const nestedMsgdef = nestedDefinition(schemaMap, field)
+    if (nestedMsgdef.naked !== true) {
+      addFixed(steps, undefined, HEADER_SIZE)
+    }
+    addLayoutSteps(schemaMap, nestedMsgdef, "", steps, undefined)
+  } else if (field.type === "string" && field.upperBound == undefined) {
+    steps.push({ kind: "string", path: field.name })
+  } else {
+    addFixed(steps, undefined, fieldSize(field))
+  }
+  return steps
+}
+
+/**
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {import("./runtime").MessageDefinitionField} field
+ * @returns {CbufMessageDefinition}
+ */
+function nestedDefinition(schemaMap, field) {
+  const nestedMsgdef = schemaMap.get(field.type)
+  if (!nestedMsgdef) {
+    throw new Error(`Nested message type ${field.type} not found in schema map`)
+  }
+  return nestedMsgdef
+}
+
+/**
+ * @param {import("./runtime").MessageDefinitionField} field A fixed-size non-struct field
+ * @returns {number} The serialized size of one value of the field
+ */
+function fieldSize(field) {
+  if (field.type === "string") {
+    return field.upperBound
+  }
+  const size = ELEMENT_SIZES[field.type]
+  if (size == undefined) {
+    throw new Error(`Unsupported type ${field.type}`)
+  }
+  return size
+}
+
+/**
+ * Append `size` fixed bytes to `steps`, extending the last step when it is also fixed.
+ *
+ * @param {LayoutStep[]} steps
+ * @param {string | undefined} path The field the bytes belong to, if reported
+ * @param {number} size
+ */
+function addFixed(steps, path, size) {
+  let step = steps[steps.length - 1]
+  if (step?.kind !== "fixed") {
+    step = { kind: "fixed", size: 0, fields: [] }
+    steps.push(step)
+  }
+  if (path != undefined && size > 0) {
+    step.fields.push({ path, start: step.size, end: step.size + size })
+  }
+  step.size += size
+}
+
+/**
+ * @param {DataView} a
+ * @param {number} aOffset
+ * @param {DataView} b
+ * @param {number} bOffset
+ * @param {number} length
+ * @returns {boolean} True if both ranges hold the same bytes
+ */
+function rangesEqual(a, aOffset, b, bOffset, length) {
+  // Compare four bytes at a time, then the remainder
+  let i = 0
+  for (; i + 4 <= length; i += 4) {
+    if (a.getUint32(aOffset + i) !== b.getUint32(bOffset + i)) return false
+  }
+  for (; i < length; i++) {
+    if (a.getUint8(aOffset + i) !== b.getUint8(bOffset + i)) return false
+  }
+  return true
+}
+
+/**
+ * @param {LayoutStep[]} steps
+ * @param {DataView} view
+ * @param {number} offset
+ * @returns {number} The number of bytes `steps` cover at `offset`
+ */
+function stepsSize(steps, view, offset) {
+  let size = 0
+  for (const step of steps) {
+    switch (step.kind) {
+      case "fixed":
+        size += step.size
+        break
+      case "string":
+        size += 4 + view.getUint32(offset + size, true)
+        break
+      case "array":
+        size += 4 + view.getUint32(offset + size, true) * step.elementSize
+        break
+      case "elements": {
+        let length = step.length
+        if (length == undefined) {
+          length = view.getUint32(offset + size, true)
+          size += 4
+        }
+        for (let i = 0; i < length; i++) {
+          size += stepsSize(step.element, view, offset + size)
+        }
+        break
+      }
+    }
+  }
+  return size
+}
+
+/**
+ * Compare two message bodies laid out by `plan`, adding the path of every field that differs to
+ * `changed`. The bodies may have different sizes once a variable-size field differs in length.
+ *
+ * @param {LayoutPlan} plan
+ * @param {DataView} a
+ * @param {number} aOffset
+ * @param {DataView} b
+ * @param {number} bOffset
+ * @param {Set<string>} changed
+ */
+function compareBodies(plan, a, aOffset, b, bOffset, changed) {
+  for (const step of plan.steps) {
+    switch (step.kind) {
+      case "fixed": {
+        if (!rangesEqual(a, aOffset, b, bOffset, step.size)) {
+          for (const field of step.fields) {
+            const length = field.end - field.start
+            if (!rangesEqual(a, aOffset + field.start, b, bOffset + field.start, length)) {
+              changed.add(field.path)
+            }
+          }
+        }
+        aOffset += step.size
+        bOffset += step.size
+        break
+      }
+      case "string":
+      case "array": {
+        const elementSize = step.kind === "array" ? step.elementSize : 1
+        const aSize = a.getUint32(aOffset, true) * elementSize
+        const bSize = b.getUint32(bOffset, true) * elementSize
+        if (aSize !== bSize || !rangesEqual(a, aOffset + 4, b, bOffset + 4, aSize)) {
+          changed.add(step.path)
+        }
+        aOffset += 4 + aSize
+        bOffset += 4 + bSize
+        break
+      }
+      case "elements": {
+        const aSize = stepsSize([step], a, aOffset)
+        const bSize = stepsSize([step], b, bOffset)
+        if (aSize !== bSize || !rangesEqual(a, aOffset, b, bOffset, aSize)) {
+          changed.add(step.path)
+        }
+        aOffset += aSize
+        bOffset += bSize
+        break
+      }
+    }
+  }
+}
+
+/**
+ * Read a message header and return its hash value and size.
+ *
+ * @param {DataView} view
+ * @param {number} offset
+ * @returns {{ hashValue: bigint; size: number }}
+ */
+function readHeader(view, offset) {
+  if (view.byteLength - offset < HEADER_SIZE) {
+    throw new Error(`Buffer too small to contain cbuf header: ${view.byteLength - offset} bytes`)
+  }
+  const magic = view.getUint32(offset, true)
+  if (magic !== CBUF_MAGIC) {
+    throw new Error(`Invalid cbuf magic 0x${magic.toString(16)}`)
+  }
+  const sizeAndVariant = view.getUint32(offset + 4, true)
+  const size =
+    sizeAndVariant & 0x80000000 ? sizeAndVariant & 0x07ffffff : sizeAndVariant & 0x7fffffff
+  return { hashValue: view.getBigUint64(offset + 8, true), size }
+}
+
+/**
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {bigint} hashValue
+ * @returns {CbufMessageDefinition}
+ */
+function definitionFor(hashMap, hashValue) {
+  const msgdef =
+    hashValue === METADATA_DEFINITION.hashValue ? METADATA_DEFINITION : hashMap.get(hashValue)
+  if (!msgdef) {
+    throw new Error(`cbuf hash value ${hashValue} not found in the hash map`)
+  }
+  return msgdef
+}
+
+/**
+ * @param {ArrayBufferView} data
+ * @returns {DataView}
+ */
+function dataView(data) {
+  return new DataView(data.buffer, data.byteOffset, data.byteLength)
+}
+
+/**
+ * Compare two serialized messages of the same type without decoding them.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {ArrayBufferView} previous A buffer starting with the earlier message
+ * @param {ArrayBufferView} next A buffer starting with the later message
+ * @returns {Set<string>} The dotted paths of the fields that differ. Arrays are reported as a
+ *   whole, and the header timestamp is not compared
+ */
+function diffMessages(schemaMap, hashMap, previous, next) {
+  const a = dataView(previous)
+  const b = dataView(next)
+  const aHeader = readHeader(a, 0)
+  const bHeader = readHeader(b, 0)
+  if (aHeader.hashValue !== bHeader.hashValue) {
+    throw new Error(`Cannot compare cbuf hash values ${aHeader.hashValue} and ${bHeader.hashValue}`)
+  }
+  const plan = layoutPlan(schemaMap, definitionFor(hashMap, bHeader.hashValue))
+  const changed = new Set()
+  compareBodies(plan, a, HEADER_SIZE, b, HEADER_SIZE, changed)
+  return changed
+}
+
+/**
+ * Tracks the last message of each type and reports which fields each new message changes, so
+ * consumers can skip updates that leave the fields they show untouched. The previous message of
+ * each type is kept as a copy, so the caller may reuse its buffers.
+ */
+class CbufChangeDetector {
+  /**
+   * @param {Map<string, CbufMessageDefinition>} schemaMap
+   * @param {Map<bigint, CbufMessageDefinition>} hashMap
+   */
+  constructor(schemaMap, hashMap) {
+    this.schemaMap = schemaMap
+    this.hashMap = hashMap
+    /** @type {Map<bigint, Uint8Array>} The last message of each hash value */
+    this._previous = new Map()
+  }
+
+  /**
+   * Compare a message with the previous message of the same type and remember it for the next
+   * call.
+   *
+   * @param {ArrayBufferView} data
+   * @param {number | undefined} offset The offset of the message in `data`
+   * @returns {Set<string>} The dotted paths of the fields that changed. Every field is reported for
+   *   the first message of a type
+   */
+  update(data, offset) {
+    offset = offset ?? 0
+    const view = dataView(data)
+    const { hashValue, size } = readHeader(view, offset)
+    const plan = layoutPlan(this.schemaMap, definitionFor(this.hashMap, hashValue))
+    const bytes = new Uint8Array(data.buffer, data.byteOffset + offset, size)
+
+    const previous = this._previous.get(hashValue)
+    let changed
+    if (previous == undefined) {
+      changed = new Set(plan.paths)
+    } else {
+      changed = new Set()
+      compareBodies(plan, dataView(previous), HEADER_SIZE, view, offset + HEADER_SIZE, changed)
+    }
+
+    if (previous?.length === size) {
+      previous.set(bytes)
+    } else {
+      this._previous.set(hashValue, bytes.slice())
+    }
+    return changed
+  }
+
+  /**
+   * Forget the previous message of one type, or of every type, so the next message of it reports
+   * every field as changed.
+   *
+   * @param {bigint | undefined} hashValue
+   */
+  reset(hashValue) {
+    if (hashValue == undefined) {
+      this._previous.clear()
+    } else {
+      this._previous.delete(hashValue)
+    }
+  }
+}
+
+module.exports.diffMessages = diffMessages
+module.exports.CbufChangeDetector = CbufChangeDetector
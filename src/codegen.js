@@ -0,0 +1,226 @@
+// Generates JavaScript decoders specialized to a single message definition. A generated decoder
+// reads every field with a constant offset from the last variable-length field, builds the message
+// as one object literal, and inlines nested structs, so it avoids the per-field type dispatch and
+// schema lookups of the generic decoder. The output is the source of a factory function taking the
+// runtime helpers `rt`, either compiled in-process by `compileDecoders()` or written to a module by
+// `bin/cbuf-codegen.js` and passed to `registerDecoder()`.
+
+/**
+ * @typedef {import("./index").CbufMessageDefinition} CbufMessageDefinition
+ * @typedef {import("@foxglove/message-definition").MessageDefinitionField} MessageDefinitionField
+ */
+
+// Size, DataView read expression and typed array type for each scalar cbuf type
+const SCALARS = {
+  bool: { size: 1, read: (pos) => `view.getUint8(${pos}) !== 0`, array: "Uint8Array" },
+  int8: { size: 1, read: (pos) => `view.getInt8(${pos})`, array: "Int8Array" },
+  uint8: { size: 1, read: (pos) => `view.getUint8(${pos})`, array: "Uint8Array" },
+  int16: { size: 2, read: (pos) => `view.getInt16(${pos}, true)`, array: "Int16Array" },
+  uint16: { size: 2, read: (pos) => `view.getUint16(${pos}, true)`, array: "Uint16Array" },
+  int32: { size: 4, read: (pos) => `view.getInt32(${pos}, true)`, array: "Int32Array" },
+  uint32: { size: 4, read: (pos) => `view.getUint32(${pos}, true)`, array: "Uint32Array" },
+  int64: { size: 8, read: (pos) => `view.getBigInt64(${pos}, true)`, array: "BigInt64Array" },
+  uint64: { size: 8, read: (pos) => `view.getBigUint64(${pos}, true)`, array: "BigUint64Array" },
+  float32: { size: 4, read: (pos) => `view.getFloat32(${pos}, true)`, array: "Float32Array" },
+  float64: { size: 8, read: (pos) => `view.getFloat64(${pos}, true)`, array: "Float64Array" },
+}
+
+/**
+ * Accumulates the statements of one decoder. The read position is `p + k`, where `p` is a runtime
+ * variable only advanced past variable-length data and `k` is a constant folded into each read.
+ */
+class DecoderWriter {
+  /**
+   * @param {Map<string, CbufMessageDefinition>} schemaMap
+   */
+  constructor(schemaMap) {
+    this.schemaMap = schemaMap
+    this.lines = []
+    this.indent = "  "
+    this.k = 0
+    this.temps = 0
+  }
+
+  emit(line) {
+    this.lines.push(this.indent + line)
+  }
+
+  temp(prefix) {
+    return `${prefix}${this.temps++}`
+  }
+
+  pos() {
+    return this.k === 0 ? "p" : `p + ${this.k}`
+  }
+
+  flush() {
+    if (this.k !== 0) {
+      this.emit(`p += ${this.k}`)
+      this.k = 0
+    }
+  }
+
+  /**
+   * Emit reads for every field of a struct body and return an object literal expression of them.
+   *
+   * @param {CbufMessageDefinition} msgdef
+   * @returns {string}
+   */
+  struct(msgdef) {
+    const entries = msgdef.definitions.map(
+      (field) => `${JSON.stringify(field.name)}: ${this.field(field)}`,
+    )
+    return `{ ${entries.join(", ")} }`
+  }
+
+  /**
+   * @param {MessageDefinitionField} field
+   * @returns {string} An expression holding the decoded field value
+   */
+  field(field) {
+    return field.isArray === true ? this.array(field) : this.value(field)
+  }
+
+  /**
+   * @param {MessageDefinitionField} field
+   * @returns {string}
+   */
+  value(field) {
+    if (field.isComplex === true) {
+      return this.complex(field)
+    }
+    if (field.type === "string") {
+      return this.string(field)
+    }
+    const scalar = SCALARS[field.type]
+    if (scalar == undefined) {
+      throw new Error(`Unsupported type ${field.type}`)
+    }
+    const value = this.temp("v")
+    this.emit(`const ${value} = ${scalar.read(this.pos())}`)
+    this.k += scalar.size
+    return value
+  }
+
+  /**
+   * @param {MessageDefinitionField} field
+   * @returns {string}
+   */
+  string(field) {
+    const value = this.temp("v")
+    if (field.upperBound != undefined) {
+      this.emit(`const ${value} = rt.readString(view, ${this.pos()}, ${field.upperBound}, options)`)
+      this.k += field.upperBound
+      return value
+    }
+    const length = this.temp("n")
+    this.emit(`const ${length} = view.getUint32(${this.pos()}, true)`)
+    this.k += 4
+    this.flush()
+    this.emit(`const ${value} = rt.readString(view, p, ${length}, options)`)
+    this.emit(`p += ${length}`)
+    return value
+  }
+
+  /**
+   * @param {MessageDefinitionField} field
+   * @returns {string}
+   */
+  complex(field) {
+    const nested = this.schemaMap.get(field.type)
+    if (nested == undefined) {
+      throw new Error(`Nested message type ${field.type} not found in schema map`)
+    }
+    if (nested.naked === true) {
+      return this.struct(nested)
+    }
+
+    // A nested non-naked struct has its own header, and its size is checked like a message's
+    const start = this.temp("s")
+    const size = this.temp("n")
+    this.emit(`const ${start} = ${this.pos()}`)
+    this.emit(`const ${size} = rt.nestedSize(view, ${start}, ${nested.hashValue}n)`)
+    this.k += 24
+    const literal = this.struct(nested)
+    this.emit(`rt.checkSize(${size}, ${this.pos()} - ${start})`)
+    return literal
+  }
+
+  /**
+   * @param {MessageDefinitionField} field
+   * @returns {string}
+   */
+  array(field) {
+    let length = field.arrayLength
+    if (length == undefined) {
+      length = this.temp("n")
+      this.emit(`const ${length} = view.getUint32(${this.pos()}, true)`)
+      this.k += 4
+    }
+
+    const scalar = field.isComplex === true ? undefined : SCALARS[field.type]
+    if (scalar != undefined) {
+      // Numeric arrays are views of the input when aligned, like the generic decoder
+      const value = this.temp("v")
+      const offset = `view.byteOffset + ${this.pos()}`
+      this.emit(`const ${value} = rt.typedArray(${scalar.array}, view.buffer, ${offset}, ${length})`)
+      if (typeof length === "number") {
+        this.k += length * scalar.size
+      } else {
+        this.flush()
+        this.emit(`p += ${length} * ${scalar.size}`)
+      }
+      return value
+    }
+
+    // Strings and structs are read one element at a time
+    this.flush()
+    const array = this.temp("a")
+    const index = this.temp("i")
+    this.emit(`const ${array} = []`)
+    this.emit(`for (let ${index} = 0; ${index} < ${length}; ${index}++) {`)
+    const indent = this.indent
+    this.indent += "  "
+    const element = this.value({ ...field, isArray: false })
+    this.flush()
+    this.emit(`${array}.push(${element})`)
+    this.indent = indent
+    this.emit(`}`)
+    return array
+  }
+}
+
+/**
+ * Generate the source of a decoder factory for a non-naked message type. The source is the body of
+ * a function taking the runtime helpers `rt` and returning `decode(view, offset, size, options)`,
+ * which reads the message data starting `offset` bytes into `view` (just past the header) and
+ * checks it ends at `size`.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {string} typeName
+ * @returns {string}
+ */
+function generateDecoderSource(schemaMap, typeName) {
+  const msgdef = schemaMap.get(typeName)
+  if (msgdef == undefined) {
+    throw new Error(`Message type ${typeName} not found in schema map`)
+  }
+  if (msgdef.naked === true) {
+    throw new Error(`Naked struct ${typeName} cannot be decoded as a message`)
+  }
+
+  const writer = new DecoderWriter(schemaMap)
+  const literal = writer.struct(msgdef)
+  const name = typeName.replace(/\W/g, "_")
+  return [
+    `// ${typeName}`,
+    `return function decode_${name}(view, offset, size, options) {`,
+    `  let p = offset`,
+    ...writer.lines,
+    `  rt.checkSize(size, ${writer.pos()})`,
+    `  return ${literal}`,
+    `}`,
+  ].join("\n")
+}
+
+module.exports.generateDecoderSource = generateDecoderSource
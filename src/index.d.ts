@@ -49,22 +49,272 @@ export type CbufMessage = {
   message: Record<string, CbufValue>
 }
 
+/** A column of per-row values, or of `count * arrayLength` values for fixed-length arrays */
+export type CbufColumnValues = CbufTypedArray | CbufArray
+/** A column of variable-length rows, where row `i` spans `offsets[i]` to `offsets[i + 1]` */
+export type CbufOffsetColumn =
+  | { values: CbufColumnValues; offsets: ArrayLike<number> }
+  | { bytes: Uint8Array; offsets: ArrayLike<number> }
+export type CbufColumn = CbufColumnValues | CbufOffsetColumn
+
+/** A batch of column-oriented message data for `serializeColumns()` */
+export type CbufColumnBatch = {
+  /** The fully qualified message name */
+  typeName: string
+  /** The number of messages (rows) to serialize */
+  count: number
+  /** Per-row timestamps in seconds since the Unix epoch */
+  timestamps: ArrayLike<number>
+  /** Optional per-row message variants */
+  variants?: ArrayLike<number>
+  /** Columns keyed by field name, with nested struct fields keyed by dotted path */
+  columns: Record<string, CbufColumn>
+}
+
 export type CbufMessageMap = Map<string, CbufMessageDefinition>
 export type CbufHashMap = Map<bigint, CbufMessageDefinition>
 
-/** A promise that completes when the wasm module is loaded and ready */
+/** Options for `parseCBufSchema()` */
+export type CbufParseOptions = {
+  /**
+   * Collect per-stage timings and counters. Only available when the wasm module was built with
+   * `CBUF_ENABLE_STATS=ON`, otherwise `stats` is not returned.
+   */
+  stats?: boolean
+}
+
+/** Timings in milliseconds and counters collected while parsing a schema */
+export type CbufParseStats = {
+  timings: {
+    /** Tokenizing the schema text */
+    lex: number
+    /** Building the AST from tokens */
+    parse: number
+    /** Registering namespaces, structs and enums */
+    symbolTable: number
+    /** Computing struct sizes */
+    computeSizes: number
+    /** Computing struct hash values */
+    computeHashes: number
+    /** Converting the AST into message definitions */
+    convert: number
+    /** The whole `parseCBufSchema()` call, including the wasm boundary */
+    total: number
+  }
+  /** Tokens produced by the lexer */
+  tokens: number
+  /** Structs in the schema */
+  structs: number
+  /** Fields across all structs */
+  fields: number
+  /** Symbol table lookups of custom field types */
+  symbolLookups: number
+  /** Identifiers found in the string intern table */
+  internHits: number
+  /** Identifiers added to the string intern table */
+  internMisses: number
+  /** Bytes allocated from the parser's memory pool */
+  poolBytes: number
+}
+
+/** Memory usage reported by `getMemoryStats()`. All sizes are in bytes */
+export type CbufMemoryStats = {
+  wasm: {
+    /** Current size of the wasm linear memory */
+    heapSize: number
+    /** The size the wasm memory may grow to */
+    heapMax: number
+    /** How many times the wasm memory has grown since loading */
+    heapGrowths: number
+    /** Bytes allocated by malloc and not yet freed */
+    mallocInUse: number
+    /** Bytes free inside the malloc heap */
+    mallocFree: number
+    /** The most `mallocInUse` seen at the end of a schema parse or a `getMemoryStats()` call */
+    peakMallocInUse: number
+    /** Schema parser memory pools that are still alive */
+    livePools: number
+    /** Bytes reserved by live parser memory pools */
+    poolReservedBytes: number
+    /** The most bytes reserved by parser memory pools at once */
+    peakPoolReservedBytes: number
+    /** Identifiers in the string intern table */
+    internEntries: number
+    /** Bytes used by the intern table itself */
+    internBytes: number
+    /** Cumulative allocations per parser subsystem, in builds with `CBUF_ALLOC_TAGGING=ON` */
+    allocTags?: Record<
+      "other" | "pool" | "lexer" | "parser" | "symbolTable" | "hashes" | "convert",
+      { allocations: number; bytes: number }
+    >
+    /** Bytes allocated and not yet freed, in builds with `CBUF_ALLOC_TAGGING=ON` */
+    taggedLiveBytes?: number
+    /** The most bytes allocated at once, in builds with `CBUF_ALLOC_TAGGING=ON` */
+    taggedPeakLiveBytes?: number
+  }
+  js: {
+    /** Live `StringCache` instances, their cached strings and the encoded bytes they hold */
+    stringCaches: { count: number; entries: number; bytes: number }
+    /** Live `CbufWriter` instances and the size of their partially filled chunks */
+    writers: { count: number; bufferedBytes: number }
+    /** Live `CbufOutputRegion` instances, their reserved bytes and the bytes handed out */
+    outputRegions: { count: number; bytes: number; usedBytes: number }
+    /** Live `MessageCache` instances, their cached messages and estimated retained bytes */
+    messageCaches: { count: number; entries: number; bytes: number }
+  }
+}
+
+/** Options for `deserializeMessage()` */
+export type CbufDecodeOptions = {
+  /** Interns repeated string values across messages */
+  stringCache?: StringCache
+  /**
+   * Returns the message decoded before from the same `sourceId` and offset. Cached messages are
+   * shared and must not be modified
+   */
+  messageCache?: MessageCache
+  /** Identifies the log `data` belongs to in `messageCache`. Defaults to `data` itself */
+  sourceId?: unknown
+}
+
+/** Hit rate and size statistics for a `StringCache` */
+export type StringCacheStats = {
+  /** The number of cached strings */
+  entries: number
+  /** Lookups that returned a cached string */
+  hits: number
+  /** Lookups that decoded a new string */
+  misses: number
+  /** Strings evicted to stay within `maxEntries` */
+  evictions: number
+  /** hits / (hits + misses), or 0 before any lookup */
+  hitRate: number
+  /** Encoded bytes that did not need to be decoded */
+  bytesSaved: number
+}
+
+/**
+ * A bounded LRU cache of decoded string values keyed by their encoded bytes. Pass the same cache
+ * to every `deserializeMessage()` call to share string instances across messages.
+ */
+export class StringCache {
+  /**
+   * @param options `maxEntries` is the maximum number of distinct strings kept (default 4096).
+   *   Strings longer than `maxLength` bytes are decoded without caching (default 256).
+   */
+  constructor(options?: { maxEntries?: number; maxLength?: number })
+  /** Decode a cbuf string, returning a cached instance if the same bytes were decoded before */
+  decode(bytes: Uint8Array): string
+  /** Remove all cached strings and reset the statistics */
+  clear(): void
+  stats(): StringCacheStats
+}
+
+/** Hit rate and size statistics for a `MessageCache` */
+export type MessageCacheStats = {
+  /** The number of cached messages */
+  entries: number
+  /** Their estimated retained size in bytes */
+  bytes: number
+  /** Lookups that returned a cached message */
+  hits: number
+  /** Lookups that found nothing */
+  misses: number
+  /** Messages evicted to stay within `maxBytes` */
+  evictions: number
+  /** `hits / (hits + misses)`, or 0 before any lookup */
+  hitRate: number
+}
+
+/**
+ * A bounded LRU cache of decoded messages keyed by source id and file offset, budgeted by the
+ * estimated memory the messages retain. Messages with timestamps in the pinned window are never
+ * evicted. Pass it as `messageCache` to the decode APIs.
+ */
+export class MessageCache {
+  /** @param options `maxBytes` is the estimated retained size to stay within (default 64MB) */
+  constructor(options?: { maxBytes?: number })
+  readonly maxBytes: number
+  get(sourceId: unknown, offset: number): CbufMessage | undefined
+  set(sourceId: unknown, offset: number, message: CbufMessage): void
+  /** Keep messages with timestamps in `[start, end]` cached, replacing any pinned window */
+  pin(start: number, end: number): void
+  unpin(): void
+  /** Remove the messages of one source, or of all sources and reset the statistics */
+  clear(sourceId?: unknown): void
+  stats(): MessageCacheStats
+}
+
+/**
+ * A promise that completes when the wasm module is loaded and ready. Reading it starts loading the
+ * module if `init()` has not been called.
+ */
 export const isLoaded: Promise<void>
+
+export type CbufInitOptions = {
+  /**
+   * A module compiled from `wasm-cbuf.wasm`, such as the result of `getWasmModule()` posted to a
+   * worker. Instantiating it skips compilation.
+   */
+  wasmModule?: WebAssembly.Module
+  /** The contents of `wasm-cbuf.wasm`, compiled instead of loading the file */
+  wasmBinary?: ArrayBuffer | Uint8Array
+  /**
+   * Initial size of the wasm heap in bytes, rounded up to 64KiB pages. Reserving the working set
+   * up front avoids heap growth, which detaches views of the heap. Defaults to 1,114,112 bytes,
+   * which is also the minimum.
+   */
+  initialMemory?: number
+  /** Grow the heap by at least this many bytes at a time, rounded up to 64KiB pages */
+  memoryGrowthStep?: number
+}
+
+/** Where the wasm module came from and how long loading it took */
+export type CbufStartupTimings = {
+  /**
+   * "module" for a precompiled module, "binary" for `wasmBinary`, "file" for a Node file read,
+   * "streaming" for a browser compileStreaming() and "fetch" when a browser fell back to
+   * compiling the downloaded bytes
+   */
+  source: "module" | "binary" | "file" | "streaming" | "fetch"
+  /** Time to read and compile the module, zero for a precompiled module */
+  compileMs: number
+  instantiateMs: number
+  /** Time from init() to the module being ready, including the emscripten runtime startup */
+  totalMs: number
+}
+
+/**
+ * Start loading the wasm module. Only needed to supply a precompiled module, the wasm bytes or heap
+ * sizes, in which case it must be called before `isLoaded` is read. Calling it again without
+ * options returns the same promise, and with options throws.
+ */
+export function init(options?: CbufInitOptions): Promise<void>
+/** The compiled wasm module once loaded, for passing to `init()` in a worker */
+export function getWasmModule(): WebAssembly.Module | undefined
+/** Time spent loading the module once loaded */
+export function getStartupTimings(): CbufStartupTimings | undefined
 /**
  * Parse a CBuf `.cbuf` schema into an object containing an error string or a
  * `Map<string, MessageDefinition>`.
  *
  * @param schemaText The schema text to parse. This is the contents of a `.cbuf` file where
  *   all #include statements have been expanded.
+ * @param options Optional parsing options.
  * @returns An object containing the parsed schema as a Map<string, MessageDefinition> mapping
  *   fully qualified message names to their parsed definition, or an error string if parsing
- *   failed.
+ *   failed. `stats` is set when requested and supported by the build.
+ */
+export function parseCBufSchema(
+  schemaText: string,
+  options?: CbufParseOptions,
+): { error?: string; schema: CbufMessageMap; stats?: CbufParseStats }
+/**
+ * Report where wasm and JS memory is going: the wasm heap size and malloc usage, memory pools of
+ * live schema parsers, the identifier intern table, and buffers held by live `StringCache` and
+ * `CbufWriter` instances.
  */
-export function parseCBufSchema(schemaText: string): { error?: string; schema: CbufMessageMap }
+export function getMemoryStats(): CbufMemoryStats
 /**
  * Takes a parsed schema (`Map<string, MessageDefinition>`) which maps message names to message
  * definitions and returns a new `Map<bigint, MessageDefinition>` mapping hash values to message
@@ -73,6 +323,40 @@ export function parseCBufSchema(schemaText: string): { error?: string; schema: C
  * @returns Mapping from hash values to message definitions.
  */
 export function schemaMapToHashMap(schemaMap: CbufMessageMap): CbufHashMap
+
+/**
+ * Write a parsed schema as a compact binary snapshot (itself a cbuf message), so consumers that
+ * only decode and encode messages can load it with `deserializeSchemaSnapshot()` from
+ * `wasm-cbuf/dist/runtime` without the wasm schema compiler.
+ */
+export function serializeSchemaSnapshot(schemaMap: CbufMessageMap): Uint8Array
+/** Read a schema snapshot written by `serializeSchemaSnapshot()` */
+export function deserializeSchemaSnapshot(data: ArrayBufferView): CbufMessageMap
+
+/** A decoder written by `generateDecoderSource()`, reading message data just past the header */
+export type CbufDecoder = (
+  view: DataView,
+  offset: number,
+  size: number,
+  options?: CbufDecodeOptions,
+) => Record<string, CbufValue>
+/**
+ * Register a specialized decoder for one message hash, which `deserializeMessage()` uses instead
+ * of the generic decoder. `factory` is a decoder factory written by `cbuf-codegen`.
+ */
+export function registerDecoder(hashValue: bigint, factory: (rt: unknown) => CbufDecoder): void
+/**
+ * Generate and register specialized decoders for the given message types, by default every
+ * non-naked struct in the schema. Uses `new Function()`; where a content security policy forbids
+ * that, generate decoders ahead of time with `cbuf-codegen`.
+ *
+ * @returns The number of decoders registered
+ */
+export function compileDecoders(schemaMap: CbufMessageMap, typeNames?: string[]): number
+/** Remove every registered specialized decoder */
+export function clearDecoders(): void
+/** The source of a decoder factory for a non-naked message type, taking runtime helpers `rt` */
+export function generateDecoderSource(schemaMap: CbufMessageMap, typeName: string): string
 /**
  * Given a schema map and hash map, a byte buffer, and optional offset into the buffer,
  * deserialize the buffer into a JavaScript object representing a single non-naked struct
@@ -83,6 +367,7 @@ export function schemaMapToHashMap(schemaMap: CbufMessageMap): CbufHashMap
  * @param hashMap A map of hash values to message definitions obtained `schemaMapToHashMap()`.
  * @param data The byte buffer to deserialize from.
  * @param offset Optional byte offset into the buffer to deserialize from.
+ * @param options Optional decoding options.
  * @returns A JavaScript object representing the deserialized message header fields and message
  *   data.
  */
@@ -91,6 +376,7 @@ export function deserializeMessage(
   hashMap: CbufHashMap,
   data: ArrayBufferView,
   offset?: number,
+  options?: CbufDecodeOptions,
 ): CbufMessage
 /**
  * Given a schema map and hash map, and a `CbufMessage` object, serialize the message into a
@@ -122,3 +408,625 @@ export function serializedMessageSize(
   hashMap: CbufHashMap,
   message: CbufMessage,
 ): number
+/**
+ * Given a schema map and hash map, and a `CbufMessage` object, serialize the message into a
+ * caller-provided buffer at the given offset.
+ *
+ * @param schemaMap A map of fully qualified message names to message definitions obtained from
+ *   `parseCBufSchema()`.
+ * @param hashMap A map of hash values to message definitions obtained `schemaMapToHashMap()`.
+ * @param message
+ * @param data The byte buffer to serialize into.
+ * @param offset Optional byte offset into the buffer to serialize to.
+ * @returns The number of bytes written, including the message header.
+ */
+export function serializeMessageInto(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  message: CbufMessage,
+  data: ArrayBufferView,
+  offset?: number,
+): number
+/**
+ * Given a schema map and hash map, and a list of `CbufMessage` objects, serialize all messages
+ * back to back into a single contiguous byte buffer.
+ *
+ * @param schemaMap A map of fully qualified message names to message definitions obtained from
+ *   `parseCBufSchema()`.
+ * @param hashMap A map of hash values to message definitions obtained `schemaMapToHashMap()`.
+ * @param messages The messages to serialize, in output order.
+ * @returns A byte buffer containing all serialized messages.
+ */
+export function serializeMessages(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  messages: CbufMessage[],
+): ArrayBuffer
+/**
+ * Given a schema map and hash map, and a list of `CbufMessage` objects, serialize all messages
+ * back to back into a rolling set of fixed-size chunks. Messages are never split across chunks.
+ *
+ * @param schemaMap A map of fully qualified message names to message definitions obtained from
+ *   `parseCBufSchema()`.
+ * @param hashMap A map of hash values to message definitions obtained `schemaMapToHashMap()`.
+ * @param messages The messages to serialize, in output order.
+ * @param options `chunkSize` is the size in bytes of each output chunk.
+ * @returns A list of byte arrays covering the filled portion of each chunk.
+ */
+export function serializeMessages(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  messages: CbufMessage[],
+  options: { chunkSize: number },
+): Uint8Array[]
+/**
+ * Given a schema map and hash map, and a list of `CbufMessage` objects, serialize all messages
+ * back to back into memory allocated from an output region.
+ *
+ * @param options `region` is the `CbufOutputRegion` to allocate the output from.
+ * @returns A view of the serialized messages inside the region.
+ */
+export function serializeMessages(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  messages: CbufMessage[],
+  options: { region: CbufOutputRegion },
+): Uint8Array
+/**
+ * Given a schema map and hash map, and a batch of column-oriented message data, serialize
+ * `batch.count` complete messages of a single type back to back into one byte buffer.
+ *
+ * @param schemaMap A map of fully qualified message names to message definitions obtained from
+ *   `parseCBufSchema()`.
+ * @param hashMap A map of hash values to message definitions obtained `schemaMapToHashMap()`.
+ * @param batch The message type, row count, per-row header values, and field columns.
+ * @returns A byte buffer containing all serialized messages.
+ */
+export function serializeColumns(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  batch: CbufColumnBatch,
+): ArrayBuffer
+/**
+ * Like `serializeColumns()`, but writes into memory allocated from an output region.
+ *
+ * @returns A view of the serialized messages inside the region.
+ */
+export function serializeColumns(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  batch: CbufColumnBatch,
+  options: { region: CbufOutputRegion },
+): Uint8Array
+
+/**
+ * A block of memory reserved once and handed out to batch outputs through the `region` option of
+ * `serializeMessages()` and `serializeColumns()`, so a session that knows its working set can
+ * serialize batch after batch without allocating.
+ */
+export class CbufOutputRegion {
+  /** @param capacity The size of the region in bytes */
+  constructor(capacity: number)
+  /** The size of the region in bytes, zero once freed */
+  readonly capacity: number
+  /** Bytes handed out since the last `reset()` */
+  readonly used: number
+  /** The most bytes in use at once since the region was created */
+  readonly peak: number
+  /**
+   * Hand out `size` bytes at an 8-byte aligned offset. Throws if the region does not have room.
+   * The view stays valid until `reset()` or `free()`.
+   */
+  allocate(size: number): Uint8Array
+  /** Make the whole region available again. Views handed out earlier will be overwritten */
+  reset(): void
+  /** Release the region's memory */
+  free(): void
+}
+/** The subset of a Node.js `Writable` used by `CbufWriter` */
+export type CbufNodeWritable = {
+  write(chunk: Uint8Array): boolean
+  end(): unknown
+  once(event: string, listener: (...args: any[]) => void): unknown
+  off(event: string, listener: (...args: any[]) => void): unknown
+}
+/** Options for constructing a `CbufWriter` */
+export type CbufWriterOptions = {
+  /** A map of fully qualified message names to message definitions */
+  schemaMap: CbufMessageMap
+  /** A map of hash values to message definitions */
+  hashMap: CbufHashMap
+  /** A Node.js `Writable`, a `WritableStream`, or a function receiving each output chunk */
+  sink:
+    | CbufNodeWritable
+    | WritableStream<Uint8Array>
+    | ((chunk: Uint8Array) => void | Promise<void>)
+  /**
+   * The `.cbuf` schema text written into metadata messages, either a single string used for
+   * every message type or a map of fully qualified message names to schema text. Metadata
+   * messages are not written if this is omitted.
+   */
+  schemaText?: string | Map<string, string>
+  /** The size in bytes of each output chunk. Defaults to 1MB */
+  chunkSize?: number
+  /** If set, buffered output is flushed at least this often, in milliseconds */
+  flushInterval?: number
+  /** Called after each interval flush and on close, e.g. `() => fileHandle.sync()` */
+  sync?: () => void | Promise<void>
+}
+/**
+ * A streaming writer for self-describing `.cb` logs. Messages are buffered into fixed-size chunks
+ * and a `cbufmsg::metadata` message is written the first time each message type appears.
+ */
+export class CbufWriter {
+  constructor(options: CbufWriterOptions)
+  /** Total bytes serialized, including metadata messages */
+  readonly bytesWritten: number
+  /** Total messages written, not including automatically written metadata messages */
+  readonly messagesWritten: number
+  /**
+   * Serialize a message, preceded by a metadata message if this is the first message of its
+   * type. Resolves once the sink is ready to accept more data.
+   */
+  write(message: CbufMessage): Promise<void>
+  /** Hand any partially filled chunk to the sink */
+  flush(): Promise<void>
+  /** Flush buffered output, call `sync` if set, and end the sink */
+  close(): Promise<void>
+}
+
+/** A span started with `CbufTracer.begin()` */
+export type CbufTraceSpan = {
+  tracer: CbufTracer
+  name: string
+  /** Start time in microseconds */
+  ts: number
+  args?: Record<string, unknown>
+  track?: string
+}
+
+/** A Chrome Trace Event format trace, as written by `JSON.stringify(tracer)` */
+export type CbufTrace = {
+  traceEvents: Record<string, unknown>[]
+  displayTimeUnit: string
+  otherData: { droppedEvents: number }
+}
+
+/**
+ * Records begin/end spans, counters and per-message-type decode batches into a fixed-size ring
+ * buffer and exports them in the Chrome Trace Event format, which loads in Perfetto and
+ * chrome://tracing. Install one with `setTracer()` to trace the library; applications can record
+ * their own spans (framing scans, worker tasks) on the same tracer.
+ */
+export class CbufTracer {
+  /**
+   * @param options `capacity` is the maximum number of events kept before older events are
+   *   overwritten (default 65536). `deserializeMessage()` calls are summarized into one event per
+   *   message type every `decodeBatchSize` messages (default 1000).
+   */
+  constructor(options?: { capacity?: number; decodeBatchSize?: number })
+  readonly capacity: number
+  readonly decodeBatchSize: number
+  /** The number of events overwritten because the ring buffer was full */
+  readonly dropped: number
+  /** The current time in microseconds */
+  now(): number
+  /**
+   * Start a span. Pass the returned object to `end()`.
+   * @param track The name of the track (trace thread) to draw the span on
+   */
+  begin(name: string, args?: Record<string, unknown>, track?: string): CbufTraceSpan
+  /** Finish a span started with `begin()`, merging in additional `args` */
+  end(span: CbufTraceSpan, args?: Record<string, unknown>): void
+  /** Record a span with a known start time and duration, both in microseconds */
+  complete(
+    name: string,
+    ts: number,
+    dur: number,
+    args?: Record<string, unknown>,
+    track?: string,
+  ): void
+  /** Record counter values, drawn as a stacked graph named `name` */
+  counter(name: string, values: Record<string, number>): void
+  /** Record a point in time */
+  instant(name: string, args?: Record<string, unknown>, track?: string): void
+  /** Record partially filled decode batches as events */
+  flush(): void
+  /** The recorded events, oldest first */
+  events(): Record<string, unknown>[]
+  /** The trace in Chrome Trace Event JSON object format */
+  toJSON(): CbufTrace
+  /** Remove all recorded events */
+  clear(): void
+}
+
+/**
+ * Install a tracer that records library activity: schema parsing and its stages, per-type
+ * `deserializeMessage()` batches, `serializeMessages()`/`serializeColumns()` exports and
+ * `CbufWriter` flushes. Pass undefined to stop tracing.
+ *
+ * @returns The previously installed tracer
+ */
+export function setTracer(tracer: CbufTracer | undefined): CbufTracer | undefined
+/** The tracer installed with `setTracer()` */
+export function getTracer(): CbufTracer | undefined
+
+/** How the generic decoder decodes a field */
+export type CbufDecodeStrategy = "scalar" | "zero-copy" | "copy" | "string decode" | "object build"
+
+/** Decode timings of one message type from `CbufDecodeProfiler.report()` */
+export type CbufDecodeProfile = {
+  typeName: string
+  messages: number
+  bytes: number
+  /** Total decode time, including headers and object allocation */
+  ms: number
+  /** Timings per dotted field path, slowest first */
+  fields: {
+    path: string
+    strategy: CbufDecodeStrategy
+    /** Times the field was decoded */
+    count: number
+    bytes: number
+    ms: number
+    /** Fraction of the type's decode time */
+    share: number
+  }[]
+}
+
+/**
+ * Accumulates decode time and bytes per message type and field path while installed with
+ * `setDecodeProfiler()`, tagging each field with its decode strategy: `zero-copy` and `copy`
+ * (unaligned) typed arrays, `string decode`, `object build` for struct arrays, and `scalar`.
+ * Nested structs are attributed to their fields. Profiling slows decoding and bypasses compiled
+ * decoders.
+ */
+export class CbufDecodeProfiler {
+  constructor()
+  /** Per-type timings, slowest type first */
+  report(): CbufDecodeProfile[]
+  /** `report()` as a plain text table, listing up to `maxFields` fields per type (default 10) */
+  format(maxFields?: number): string
+  /** Remove all accumulated timings */
+  clear(): void
+}
+
+/**
+ * Install a profiler that attributes `deserializeMessage()` time to message fields. Pass undefined
+ * to stop profiling.
+ *
+ * @returns The previously installed profiler
+ */
+export function setDecodeProfiler(
+  profiler: CbufDecodeProfiler | undefined,
+): CbufDecodeProfiler | undefined
+
+/** The location and header fields of one message in a `.cb` log */
+export type CbufMessageRef = {
+  /** The position of the message's log in the list given to `mergeLogs()` */
+  log: number
+  /** The file offset of the message header */
+  offset: number
+  /** The size of the message header and message data, in bytes */
+  size: number
+  timestamp: number
+  hashValue: bigint
+  variant: number
+}
+
+/**
+ * A timestamp index of the messages framed in a `.cb` log, held in typed arrays in file order and
+ * extended incrementally by `scan()`.
+ */
+export class CbufIndex {
+  /** Index every complete message in a buffer holding a whole log */
+  static fromBuffer(data: ArrayBufferView): CbufIndex
+  /** Index a log through a source, reading chunks of `chunkSize` bytes (default 1MB) */
+  static fromSource(source: CbufSource, options?: { chunkSize?: number }): Promise<CbufIndex>
+  /** The number of indexed messages */
+  readonly count: number
+  /** The file offset just past the last indexed message, where the next scan resumes */
+  readonly end: number
+  /** True while timestamps are non-decreasing in file order */
+  readonly sorted: boolean
+  readonly offsets: Float64Array
+  readonly sizes: Uint32Array
+  readonly timestamps: Float64Array
+  readonly hashes: BigUint64Array
+  readonly variants: Uint8Array
+  /**
+   * Frame the messages from `end` onwards in `data`, which holds the log's bytes starting at file
+   * offset `dataOffset` (default 0). Stops at a partial trailing message.
+   *
+   * @returns The number of messages added
+   */
+  scan(data: ArrayBufferView, dataOffset?: number): number
+  /**
+   * Frame the messages from `end` to the current end of a source, reading chunks of `chunkSize`
+   * bytes (default 1MB). Resolves to the number of messages added
+   */
+  scanSource(source: CbufSource, options?: { chunkSize?: number }): Promise<number>
+  /** The message number (file order) of the `rank`th message in timestamp order */
+  byTime(rank: number): number
+  /**
+   * The rank in timestamp order of the first message at or after `timestamp`, or strictly after it
+   * when `exclusive` is set
+   */
+  lowerBound(timestamp: number, exclusive?: boolean): number
+  /**
+   * The file offsets of the latest message of each type at or before `timestamp`, by hash value.
+   * Without `hashes`, every type except `cbufmsg::metadata` is included.
+   */
+  snapshotAt(timestamp: number, hashes?: Iterable<bigint>): Map<bigint, number>
+}
+
+/**
+ * Decode the messages at a set of file offsets, such as a `CbufIndex.snapshotAt()` result, in file
+ * order
+ */
+export function deserializeMessagesAt<K>(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  data: ArrayBufferView,
+  offsets: Map<K, number>,
+  options?: CbufDecodeOptions,
+): Map<K, CbufMessage>
+
+/**
+ * A log for `mergeLogs()`, with an optional prebuilt index and the schema to decode it with. A log
+ * read through a source is given by its index alone, and its messages read with `readMessage()`
+ */
+export type CbufLogInput =
+  | ArrayBufferView
+  | {
+      data?: ArrayBufferView
+      /** Identifies the log in a `messageCache`. Defaults to `data` */
+      id?: unknown
+      index?: CbufIndex
+      schemaMap?: CbufMessageMap
+      hashMap?: CbufHashMap
+    }
+
+/**
+ * Merge `.cb` logs into one timestamp-ordered sequence, walking each log through its index and
+ * choosing the next message with a heap. Equal timestamps are yielded in log order, then file
+ * order. With `decode`, each message is decoded into `message` as it is yielded.
+ */
+export function mergeLogs(
+  logs: CbufLogInput[],
+  options?: {
+    start?: number
+    end?: number
+    decode?: boolean
+    schemaMap?: CbufMessageMap
+    hashMap?: CbufHashMap
+    stringCache?: StringCache
+    messageCache?: MessageCache
+  },
+): Generator<CbufMessageRef & { message?: CbufMessage }>
+
+/** Random access to the bytes of a log, such as an open file */
+export type CbufSource = {
+  /** The current size of the log in bytes */
+  size(): number | Promise<number>
+  /** Read `length` bytes starting at `offset`, or fewer at the end of the log */
+  read(offset: number, length: number): Uint8Array | Promise<Uint8Array>
+}
+
+/** A source over a log already in memory */
+export class CbufMemorySource {
+  constructor(data: ArrayBufferView)
+  readonly data: Uint8Array
+  size(): number
+  read(offset: number, length: number): Uint8Array
+}
+
+/** A source over a Node.js `FileHandle`, read with positional reads */
+export class CbufFileSource {
+  constructor(handle: import("fs/promises").FileHandle)
+  readonly handle: import("fs/promises").FileHandle
+  size(): Promise<number>
+  read(offset: number, length: number): Promise<Uint8Array>
+}
+
+/** A source over a browser `Blob` or `File`, read with `Blob.slice()` */
+export class CbufBlobSource {
+  constructor(blob: Blob)
+  readonly blob: Blob
+  size(): number
+  read(offset: number, length: number): Promise<Uint8Array>
+}
+
+/**
+ * Wraps a source with an LRU cache of fixed-size blocks. Missing blocks are fetched with one read
+ * per contiguous run, and sequential reads prefetch following blocks. A `BlockCache` is itself a
+ * source.
+ */
+export class BlockCache {
+  /**
+   * @param options `blockSize` is the bytes per block (default 64KB), `maxBytes` the most block
+   *   bytes kept (default 16MB), and `readahead` the most blocks prefetched (default 16)
+   */
+  constructor(
+    source: CbufSource,
+    options?: { blockSize?: number; maxBytes?: number; readahead?: number },
+  )
+  readonly source: CbufSource
+  size(): number | Promise<number>
+  read(offset: number, length: number): Promise<Uint8Array>
+  /** Drop every cached block and reset the statistics */
+  clear(): void
+  stats(): {
+    blocks: number
+    bytes: number
+    /** Blocks read from the cache */
+    hits: number
+    /** Blocks fetched from the source */
+    misses: number
+    /** Reads issued to the source */
+    reads: number
+    bytesRead: number
+  }
+}
+
+/** Read and decode the message at a file offset of a source. `sourceId` defaults to `source` */
+export function readMessage(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  source: CbufSource,
+  offset: number,
+  options?: CbufDecodeOptions,
+): Promise<CbufMessage>
+/** Read and decode the messages at a set of file offsets of a source, in file order */
+export function readMessagesAt<K>(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  source: CbufSource,
+  offsets: Map<K, number>,
+  options?: CbufDecodeOptions,
+): Promise<Map<K, CbufMessage>>
+
+/** A message found by `CbufFollower` */
+export type CbufLogEntry = Omit<CbufMessageRef, "log"> & {
+  /** The message header and data */
+  data: Uint8Array
+  /** The decoded message, for metadata messages and, with `decode`, messages of known types */
+  message?: CbufMessage
+}
+
+/**
+ * Follows a `.cb` log that is still being written. Each poll reads only the bytes appended since
+ * the last one, indexes the complete messages among them, and hands them to subscribers.
+ * Metadata messages for new types extend `schemaMap` and `hashMap` in place when `parseSchema` is
+ * given.
+ */
+export class CbufFollower {
+  constructor(options: {
+    source: CbufSource
+    schemaMap?: CbufMessageMap
+    hashMap?: CbufHashMap
+    /** Parses the schema text of metadata messages, usually `parseCBufSchema` */
+    parseSchema?: (schemaText: string) => { error?: string; schema: CbufMessageMap }
+    /** Decode each message of a known type into `message` */
+    decode?: boolean
+    stringCache?: StringCache
+    /** The most bytes read at once, 1MB by default. A larger message is read whole */
+    chunkSize?: number
+  })
+  readonly source: CbufSource
+  readonly schemaMap: CbufMessageMap
+  readonly hashMap: CbufHashMap
+  /** The index of every message found so far */
+  readonly index: CbufIndex
+  /** The file offset read up to */
+  readonly readOffset: number
+  /**
+   * Call `listener` with the messages found by each poll, once per chunk read. `onError` is called
+   * if polling started by `start()` fails.
+   *
+   * @returns A function that unsubscribes
+   */
+  subscribe(
+    listener: (messages: CbufLogEntry[]) => void,
+    onError?: (error: Error) => void,
+  ): () => void
+  /** Read and index appended bytes and notify subscribers. Resolves to the new message count */
+  poll(): Promise<number>
+  /** Poll every `interval` milliseconds until `stop()` is called */
+  start(interval: number): void
+  stop(): void
+}
+
+/** Options for `CbufPlayer` */
+export type CbufPlayerOptions = {
+  schemaMap?: CbufMessageMap
+  hashMap?: CbufHashMap
+  stringCache?: StringCache
+  /** Replays messages decoded before when seeking back */
+  messageCache?: MessageCache
+  /** The playback rate, finite and above 0. Defaults to 1 (real time) */
+  rate?: number
+  /** The log time to start from. Defaults to the first message */
+  start?: number
+  /** The most decoded messages held ahead of the playhead. Defaults to 1024 */
+  maxReady?: number
+  /** Milliseconds of playback to keep decoded ahead when decoding is cheap. Defaults to 250 */
+  bufferMs?: number
+  /** The most log time, in seconds, decoded ahead. Defaults to 10 */
+  maxLookahead?: number
+  /** The longest a decode batch runs before yielding the thread, in milliseconds. Defaults to 4 */
+  sliceMs?: number
+  /** The wall clock in milliseconds. Defaults to `performance.now()` */
+  now?: () => number
+}
+
+/**
+ * Plays back `.cb` logs at their timestamps, decoding ahead of the playhead in time-sliced batches
+ * into a bounded ring. The decode-ahead window adapts to the playback rate and the measured decode
+ * cost.
+ */
+export class CbufPlayer {
+  constructor(logs: CbufLogInput[], options?: CbufPlayerOptions)
+  readonly playing: boolean
+  readonly rate: number
+  /** The log time at the playhead */
+  readonly time: number
+  /** The log time in seconds currently decoded ahead of the playhead */
+  readonly lookahead: number
+  /**
+   * Call `listener` with each message at its timestamp. `onEnd` is called when playback reaches the
+   * end of the logs, or with the error that stopped it.
+   *
+   * @returns A function that unsubscribes
+   */
+  subscribe(
+    listener: (message: CbufMessageRef & { message: CbufMessage }) => void,
+    onEnd?: (error?: Error) => void,
+  ): () => void
+  play(): void
+  pause(): void
+  /** Change the playback rate, which must be finite and above 0. Throws otherwise */
+  setRate(rate: number): void
+  /** Move the playhead, discarding messages decoded ahead */
+  seek(timestamp: number): void
+  stats(): {
+    decoded: number
+    emitted: number
+    /** Messages that were already due when they were decoded */
+    late: number
+    /** Decoded messages waiting in the ring */
+    ready: number
+    lookahead: number
+    /** The smoothed decode cost per message */
+    decodeMsPerMessage: number
+  }
+}
+
+/**
+ * Compare two serialized messages of the same type without decoding them. Returns the dotted paths
+ * of the fields that differ, such as `pose.position.x`. Arrays are reported as a whole, and the
+ * header timestamp is not compared
+ */
+export function diffMessages(
+  schemaMap: CbufMessageMap,
+  hashMap: CbufHashMap,
+  previous: ArrayBufferView,
+  next: ArrayBufferView,
+): Set<string>
+
+/**
+ * Tracks the last message of each type and reports which fields each new message changes, without
+ * decoding either message
+ */
+export class CbufChangeDetector {
+  constructor(schemaMap: CbufMessageMap, hashMap: CbufHashMap)
+  readonly schemaMap: CbufMessageMap
+  readonly hashMap: CbufHashMap
+  /**
+   * Compare the message at `offset` with the previous message of the same type and remember it.
+   * Returns the dotted paths of the changed fields, or every field for the first message of a type
+   */
+  update(data: ArrayBufferView, offset?: number): Set<string>
+  /** Forget the previous message of one type, or of every type */
+  reset(hashValue?: bigint): void
+}
@@ -0,0 +1,1066 @@
+// Reading `.cb` logs: a timestamp index of the messages framed in a log, and playback helpers built
+// on it. Like the rest of the runtime, nothing here loads the wasm schema compiler.
+
+const runtime = require("./runtime")
+
+const CBUF_MAGIC = 0x56444e54
+// The hash value of `cbufmsg::metadata`, whose messages describe the other types in a log
+const METADATA_HASH = 0xbe6738d544ab72c6n
+const HEADER_SIZE = 24
+const INITIAL_CAPACITY = 1024
+const DEFAULT_SCAN_CHUNK_SIZE = 1024 * 1024
+
+/**
+ * @typedef {import("./runtime").CbufMessageDefinition} CbufMessageDefinition
+ * @typedef {import("./index").CbufMessage} CbufMessage
+ * @typedef {import("./index").CbufMessageRef} CbufMessageRef
+ * @typedef {import("./index").StringCache} StringCache
+ * @typedef {import("./index").MessageCache} MessageCache
+ * @typedef {import("./index").CbufSource} CbufSource
+ * @typedef {import("./index").CbufLogEntry} CbufLogEntry
+ * @typedef {import("./index").CbufLogInput} CbufLogInput
+ * @typedef {{ numbers: Uint32Array; count: number; sorted: boolean; order?: Uint32Array }} HashList
+ */
+
+/**
+ * @param {DataView} view
+ * @param {number} offset The offset of a message header in `view`
+ * @returns {number} The message size from the header, without the variant bits
+ */
+function messageSize(view, offset) {
+  const sizeAndVariant = view.getUint32(offset + 4, true)
+  return sizeAndVariant & 0x80000000 ? sizeAndVariant & 0x07ffffff : sizeAndVariant & 0x7fffffff
+}
+
+/**
+ * Grow a typed array to hold at least `capacity` elements, keeping its contents.
+ *
+ * @template {Float64Array | Uint32Array | Uint8Array | BigUint64Array} T
+ * @param {T} array
+ * @param {number} capacity
+ * @returns {T}
+ */
+function grow(array, capacity) {
+  if (capacity <= array.length) {
+    return array
+  }
+  const grown = new array.constructor(Math.max(capacity, array.length * 2))
+  grown.set(array)
+  return grown
+}
+
+/**
+ * The offset, size, timestamp, hash value and variant of every message framed in a `.cb` log, in
+ * file order, stored in typed arrays of about 29 bytes per message. An index is built
+ * incrementally by `scan()`, so a log that is still being written can be extended as it grows.
+ */
+class CbufIndex {
+  constructor() {
+    /** The number of indexed messages */
+    this.count = 0
+    /** The file offset just past the last indexed message, where the next scan resumes */
+    this.end = 0
+    /** True while timestamps are non-decreasing in file order */
+    this.sorted = true
+
+    this._offsets = new Float64Array(INITIAL_CAPACITY)
+    this._sizes = new Uint32Array(INITIAL_CAPACITY)
+    this._timestamps = new Float64Array(INITIAL_CAPACITY)
+    this._hashes = new BigUint64Array(INITIAL_CAPACITY)
+    this._variants = new Uint8Array(INITIAL_CAPACITY)
+    /** @type {Uint32Array | undefined} Message numbers in timestamp order, for unsorted logs */
+    this._order = undefined
+    /**
+     * The message numbers of each message type, with a timestamp `order` when not `sorted`
+     * @type {Map<bigint, HashList>}
+     */
+    this._byHash = new Map()
+  }
+
+  /**
+   * Index every complete message in a buffer holding a whole log.
+   *
+   * @param {ArrayBufferView} data
+   * @returns {CbufIndex}
+   */
+  static fromBuffer(data) {
+    const index = new CbufIndex()
+    index.scan(data)
+    return index
+  }
+
+  /**
+   * Index a log through a source, reading it in chunks of `chunkSize` bytes so memory use does not
+   * depend on the log size.
+   *
+   * @param {CbufSource} source
+   * @param {{ chunkSize?: number }} [options]
+   * @returns {Promise<CbufIndex>}
+   */
+  static async fromSource(source, options) {
+    const index = new CbufIndex()
+    await index.scanSource(source, options)
+    return index
+  }
+
+  /**
+   * Frame the messages from `end` to the current end of a source, reading chunks of `chunkSize`
+   * bytes (1MB by default). A message larger than a chunk is read whole.
+   *
+   * @param {CbufSource} source
+   * @param {{ chunkSize?: number }} [options]
+   * @returns {Promise<number>} The number of messages added
+   */
+  async scanSource(source, options) {
+    const chunkSize = options?.chunkSize ?? DEFAULT_SCAN_CHUNK_SIZE
+    const size = await source.size()
+    const first = this.count
+    while (size - this.end >= HEADER_SIZE) {
+      let chunk = await source.read(this.end, Math.min(chunkSize, size - this.end))
+      if (this.scan(chunk, this.end) === 0) {
+        // The next message is larger than a chunk
+        const view = new DataView(chunk.buffer, chunk.byteOffset, chunk.byteLength)
+        const length = messageSize(view, 0)
+        if (length <= chunk.byteLength || length > size - this.end) {
+          break
+        }
+        chunk = await source.read(this.end, length)
+        this.scan(chunk, this.end)
+      }
+    }
+    return this.count - first
+  }
+
+  /**
+   * Frame the messages from `end` onwards in `data`, which holds the log's bytes starting at file
+   * offset `dataOffset`. Scanning stops at a partial trailing message, which is picked up by the
+   * next scan once the rest of it is available. An invalid header throws, leaving the messages
+   * before it indexed.
+   *
+   * @param {ArrayBufferView} data
+   * @param {number} [dataOffset] The file offset of `data[0]`, at most `end`. Defaults to 0
+   * @returns {number} The number of messages added
+   */
+  scan(data, dataOffset = 0) {
+    if (dataOffset > this.end) {
+      throw new Error(`Cannot scan from ${dataOffset}, the index ends at ${this.end}`)
+    }
+    const view = new DataView(data.buffer, data.byteOffset, data.byteLength)
+    const first = this.count
+    let offset = this.end - dataOffset
+    while (view.byteLength - offset >= HEADER_SIZE) {
+      const magic = view.getUint32(offset, true)
+      if (magic !== CBUF_MAGIC) {
+        throw new Error(
+          `Invalid cbuf magic 0x${magic.toString(16)} at offset ${offset + dataOffset}`,
+        )
+      }
+      const sizeAndVariant = view.getUint32(offset + 4, true)
+      const size = messageSize(view, offset)
+      if (size < HEADER_SIZE) {
+        throw new Error(`Invalid cbuf size ${size} at offset ${offset + dataOffset}`)
+      }
+      if (size > view.byteLength - offset) {
+        break
+      }
+      this._append(
+        offset + dataOffset,
+        size,
+        view.getFloat64(offset + 16, true),
+        view.getBigUint64(offset + 8, true),
+        sizeAndVariant & 0x80000000 ? (sizeAndVariant >>> 27) & 0x0f : 0,
+      )
+      offset += size
+      // Keep `end` in step with `count` in case a later header is invalid
+      this.end = offset + dataOffset
+    }
+    return this.count - first
+  }
+
+  /** @returns {Float64Array} The file offset of each message */
+  get offsets() {
+    return this._offsets.subarray(0, this.count)
+  }
+
+  /** @returns {Uint32Array} The size of each message, including its header */
+  get sizes() {
+    return this._sizes.subarray(0, this.count)
+  }
+
+  /** @returns {Float64Array} The timestamp of each message */
+  get timestamps() {
+    return this._timestamps.subarray(0, this.count)
+  }
+
+  /** @returns {BigUint64Array} The hash value of each message */
+  get hashes() {
+    return this._hashes.subarray(0, this.count)
+  }
+
+  /** @returns {Uint8Array} The variant of each message */
+  get variants() {
+    return this._variants.subarray(0, this.count)
+  }
+
+  /**
+   * The message number (file order) of the `rank`th message in timestamp order. Messages with
+   * equal timestamps keep their file order.
+   *
+   * @param {number} rank
+   * @returns {number}
+   */
+  byTime(rank) {
+    return this.sorted ? rank : this._timeOrder()[rank]
+  }
+
+  /**
+   * The rank in timestamp order of the first message with a timestamp at or after `timestamp`, or
+   * after it when `exclusive` is set. Returns `count` if there is none.
+   *
+   * @param {number} timestamp
+   * @param {boolean} [exclusive]
+   * @returns {number}
+   */
+  lowerBound(timestamp, exclusive = false) {
+    const timestamps = this._timestamps
+    const order = this.sorted ? undefined : this._timeOrder()
+    let lo = 0
+    let hi = this.count
+    while (lo < hi) {
+      const mid = (lo + hi) >>> 1
+      const t = timestamps[order != undefined ? order[mid] : mid]
+      if (t < timestamp || (exclusive && t === timestamp)) {
+        lo = mid + 1
+      } else {
+        hi = mid
+      }
+    }
+    return lo
+  }
+
+  /**
+   * The file offsets of the latest message of each type with a timestamp at or before
+   * `timestamp`, found by binary search of each type's messages. Types with no message by then are
+   * left out. Without `hashes`, every type in the log except `cbufmsg::metadata` is included.
+   *
+   * @param {number} timestamp
+   * @param {Iterable<bigint>} [hashes]
+   * @returns {Map<bigint, number>} File offsets by hash value
+   */
+  snapshotAt(timestamp, hashes) {
+    const timestamps = this._timestamps
+    const snapshot = new Map()
+    for (const hashValue of hashes ?? this._byHash.keys()) {
+      const list = this._byHash.get(hashValue)
+      if (list == undefined || (hashes == undefined && hashValue === METADATA_HASH)) {
+        continue
+      }
+      const numbers = list.sorted ? list.numbers : this._hashOrder(list)
+      let lo = 0
+      let hi = list.count
+      while (lo < hi) {
+        const mid = (lo + hi) >>> 1
+        if (timestamps[numbers[mid]] <= timestamp) {
+          lo = mid + 1
+        } else {
+          hi = mid
+        }
+      }
+      if (lo > 0) {
+        snapshot.set(hashValue, this._offsets[numbers[lo - 1]])
+      }
+    }
+    return snapshot
+  }
+
+  /**
+   * @param {number} offset
+   * @param {number} size
+   * @param {number} timestamp
+   * @param {bigint} hashValue
+   * @param {number} variant
+   */
+  _append(offset, size, timestamp, hashValue, variant) {
+    const i = this.count
+    if (i === this._offsets.length) {
+      this._offsets = grow(this._offsets, i + 1)
+      this._sizes = grow(this._sizes, i + 1)
+      this._timestamps = grow(this._timestamps, i + 1)
+      this._hashes = grow(this._hashes, i + 1)
+      this._variants = grow(this._variants, i + 1)
+    }
+    if (i > 0 && timestamp < this._timestamps[i - 1]) {
+      this.sorted = false
+    }
+    this._offsets[i] = offset
+    this._sizes[i] = size
+    this._timestamps[i] = timestamp
+    this._hashes[i] = hashValue
+    this._variants[i] = variant
+    this._order = undefined
+    this.count++
+
+    let list = this._byHash.get(hashValue)
+    if (list == undefined) {
+      list = { numbers: new Uint32Array(16), count: 0, sorted: true, order: undefined }
+      this._byHash.set(hashValue, list)
+    }
+    if (list.count === list.numbers.length) {
+      list.numbers = grow(list.numbers, list.count + 1)
+    }
+    if (list.count > 0 && timestamp < this._timestamps[list.numbers[list.count - 1]]) {
+      list.sorted = false
+    }
+    list.numbers[list.count++] = i
+    list.order = undefined
+  }
+
+  /** @returns {Uint32Array} Message numbers stably sorted by timestamp */
+  _timeOrder() {
+    if (this._order == undefined) {
+      const timestamps = this._timestamps
+      const order = new Uint32Array(this.count)
+      for (let i = 0; i < order.length; i++) order[i] = i
+      this._order = order.sort((a, b) => timestamps[a] - timestamps[b] || a - b)
+    }
+    return this._order
+  }
+
+  /**
+   * @param {HashList} list
+   * @returns {Uint32Array} The list's message numbers stably sorted by timestamp
+   */
+  _hashOrder(list) {
+    if (list.order == undefined) {
+      const timestamps = this._timestamps
+      const order = list.numbers.slice(0, list.count)
+      list.order = order.sort((a, b) => timestamps[a] - timestamps[b] || a - b)
+    }
+    return list.order
+  }
+}
+
+/**
+ * Decode the messages at a set of file offsets, such as a `CbufIndex.snapshotAt()` result, in one
+ * pass in file order.
+ *
+ * @template K
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {ArrayBufferView} data The log
+ * @param {Map<K, number>} offsets File offsets of the messages to decode
+ * @param {{ stringCache?: StringCache; messageCache?: MessageCache; sourceId?: unknown }} [options]
+ *   Decoding options, as for `deserializeMessage()`
+ * @returns {Map<K, CbufMessage>} The decoded messages under the same keys, in file order
+ */
+function deserializeMessagesAt(schemaMap, hashMap, data, offsets, options) {
+  const sorted = [...offsets].sort((a, b) => a[1] - b[1])
+  const messages = new Map()
+  for (const [key, offset] of sorted) {
+    messages.set(key, runtime.deserializeMessage(schemaMap, hashMap, data, offset, options))
+  }
+  return messages
+}
+
+/**
+ * Read and decode the message at a file offset of a source.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufSource} source
+ * @param {number} offset
+ * @param {{ stringCache?: StringCache; messageCache?: MessageCache; sourceId?: unknown }} [options]
+ *   Decoding options, as for `deserializeMessage()`. `sourceId` defaults to `source`
+ * @returns {Promise<CbufMessage>}
+ */
+async function readMessage(schemaMap, hashMap, source, offset, options) {
+  const messageCache = options?.messageCache
+  const sourceId = options?.sourceId ?? source
+  const cached = messageCache?.get(sourceId, offset)
+  if (cached != undefined) {
+    return cached
+  }
+  const header = await source.read(offset, HEADER_SIZE)
+  if (header.byteLength < HEADER_SIZE) {
+    throw new Error(`No cbuf message at offset ${offset}`)
+  }
+  const size = messageSize(new DataView(header.buffer, header.byteOffset, HEADER_SIZE), 0)
+  const data = await source.read(offset, size)
+  const decodeOptions = { stringCache: options?.stringCache }
+  const message = runtime.deserializeMessage(schemaMap, hashMap, data, 0, decodeOptions)
+  messageCache?.set(sourceId, offset, message)
+  return message
+}
+
+/**
+ * Read and decode the messages at a set of file offsets of a source, such as a
+ * `CbufIndex.snapshotAt()` result, in file order so a `BlockCache` serves neighbouring messages
+ * from the same blocks.
+ *
+ * @template K
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufSource} source
+ * @param {Map<K, number>} offsets
+ * @param {{ stringCache?: StringCache; messageCache?: MessageCache; sourceId?: unknown }} [options]
+ * @returns {Promise<Map<K, CbufMessage>>} The decoded messages under the same keys, in file order
+ */
+async function readMessagesAt(schemaMap, hashMap, source, offsets, options) {
+  const sorted = [...offsets].sort((a, b) => a[1] - b[1])
+  const messages = new Map()
+  for (const [key, offset] of sorted) {
+    messages.set(key, await readMessage(schemaMap, hashMap, source, offset, options))
+  }
+  return messages
+}
+
+/**
+ * Merge several `.cb` logs into a single timestamp-ordered sequence. Each log is walked in
+ * timestamp order through its `CbufIndex` and the next message is chosen with a binary heap, so
+ * only one cursor per log is held and nothing is decoded until it is yielded. Messages with equal
+ * timestamps are yielded in the order their logs were given, then in file order.
+ *
+ * @param {Array<ArrayBufferView | {
+ *   data?: ArrayBufferView;
+ *   id?: unknown;
+ *   index?: CbufIndex;
+ *   schemaMap?: Map<string, CbufMessageDefinition>;
+ *   hashMap?: Map<bigint, CbufMessageDefinition>;
+ * }>} logs Log buffers, optionally with a prebuilt index and the schema to decode them with. A
+ *   log read through a source is given by its index alone, without `data` or `decode`, and the
+ *   yielded references read with `readMessage()`
+ * @param {{
+ *   start?: number;
+ *   end?: number;
+ *   decode?: boolean;
+ *   schemaMap?: Map<string, CbufMessageDefinition>;
+ *   hashMap?: Map<bigint, CbufMessageDefinition>;
+ *   stringCache?: StringCache;
+ *   messageCache?: MessageCache;
+ * }} [options]
+ *   - `start`, `end`: Only yield messages with timestamps in `[start, end]`.
+ *   - `decode`: Decode each message into `message`, with the log's schema or else `schemaMap` and
+ *     `hashMap`.
+ *   - `stringCache`: Interns repeated strings while decoding.
+ *   - `messageCache`: Reuses messages decoded before, keyed by each log's `id` (by default its
+ *     `data`) and the message offset.
+ * @returns {Generator<CbufMessageRef & { message?: CbufMessage }>}
+ */
+function* mergeLogs(logs, options = {}) {
+  const cursors = []
+  for (let log = 0; log < logs.length; log++) {
+    const input = ArrayBuffer.isView(logs[log]) ? { data: logs[log] } : logs[log]
+    const index = input.index ?? CbufIndex.fromBuffer(input.data)
+    const rank = options.start != undefined ? index.lowerBound(options.start) : 0
+    const endRank = options.end != undefined ? index.lowerBound(options.end, true) : index.count
+    if (rank < endRank) {
+      const decodeOptions = {
+        stringCache: options.stringCache,
+        messageCache: options.messageCache,
+        sourceId: input.id ?? input.data,
+      }
+      const cursor = { log, input, index, rank, endRank, timestamp: 0, decodeOptions }
+      cursor.timestamp = index._timestamps[index.byTime(rank)]
+      cursors.push(cursor)
+    }
+  }
+
+  // A min-heap of cursors ordered by their next timestamp, then by log
+  const before = (a, b) =>
+    a.timestamp < b.timestamp || (a.timestamp === b.timestamp && a.log < b.log)
+  const heap = cursors
+  for (let i = (heap.length >>> 1) - 1; i >= 0; i--) {
+    siftDown(heap, i, before)
+  }
+
+  while (heap.length > 0) {
+    const cursor = heap[0]
+    const { index, input } = cursor
+    const i = index.byTime(cursor.rank)
+    const ref = {
+      log: cursor.log,
+      offset: index._offsets[i],
+      size: index._sizes[i],
+      timestamp: cursor.timestamp,
+      hashValue: index._hashes[i],
+      variant: index._variants[i],
+    }
+    if (options.decode === true) {
+      ref.message = runtime.deserializeMessage(
+        input.schemaMap ?? options.schemaMap ?? new Map(),
+        input.hashMap ?? options.hashMap ?? new Map(),
+        input.data,
+        ref.offset,
+        cursor.decodeOptions,
+      )
+    }
+
+    if (++cursor.rank < cursor.endRank) {
+      cursor.timestamp = index._timestamps[index.byTime(cursor.rank)]
+    } else {
+      heap[0] = heap[heap.length - 1]
+      heap.pop()
+    }
+    siftDown(heap, 0, before)
+    yield ref
+  }
+}
+
+/**
+ * @template T
+ * @param {T[]} heap
+ * @param {number} i
+ * @param {(a: T, b: T) => boolean} before
+ */
+function siftDown(heap, i, before) {
+  const n = heap.length
+  for (;;) {
+    const left = 2 * i + 1
+    if (left >= n) return
+    const right = left + 1
+    const child = right < n && before(heap[right], heap[left]) ? right : left
+    if (!before(heap[child], heap[i])) return
+    const tmp = heap[i]
+    heap[i] = heap[child]
+    heap[child] = tmp
+    i = child
+  }
+}
+
+/**
+ * Follows a `.cb` log that is still being written. Each `poll()` reads only the bytes appended
+ * since the last one, in bounded chunks, frames the complete messages among them into `index`, and
+ * hands them to subscribers. A partial trailing message is kept until the rest of it arrives.
+ * Metadata messages describing new types extend `schemaMap` and `hashMap` in place when
+ * `parseSchema` is given.
+ */
+class CbufFollower {
+  /**
+   * @param {{
+   *   source: CbufSource;
+   *   schemaMap?: Map<string, CbufMessageDefinition>;
+   *   hashMap?: Map<bigint, CbufMessageDefinition>;
+   *   parseSchema?: (schemaText: string) => {
+   *     error?: string;
+   *     schema: Map<string, CbufMessageDefinition>;
+   *   };
+   *   decode?: boolean;
+   *   stringCache?: StringCache;
+   *   chunkSize?: number;
+   * }} options
+   *   - `source`: Reads the log, e.g. an open file.
+   *   - `schemaMap`, `hashMap`: The schema messages are decoded with. Extended as metadata
+   *     messages for new types appear.
+   *   - `parseSchema`: Parses the schema text of metadata messages, usually
+   *     `Cbuf.parseCBufSchema`. Without it the schema is never extended.
+   *   - `decode`: Decode each message of a known type into `message` before notifying subscribers.
+   *   - `stringCache`: Interns repeated strings while decoding.
+   *   - `chunkSize`: The most bytes read at once, 1MB by default. A message larger than a chunk is
+   *     read whole.
+   */
+  constructor(options) {
+    this.source = options.source
+    this.schemaMap = options.schemaMap ?? new Map()
+    this.hashMap = options.hashMap ?? runtime.schemaMapToHashMap(this.schemaMap)
+    this.parseSchema = options.parseSchema
+    this.decode = options.decode === true
+    this.chunkSize = options.chunkSize ?? DEFAULT_SCAN_CHUNK_SIZE
+    this.index = new CbufIndex()
+    /** The file offset read up to. Bytes from `index.end` to here are a partial message */
+    this.readOffset = 0
+
+    this._decodeOptions = { stringCache: options.stringCache }
+    this._pending = new Uint8Array(0)
+    /** @type {Error | undefined} Set when the log cannot be framed, failing every later poll */
+    this._error = undefined
+    this._listeners = new Set()
+    /** @type {Promise<number> | undefined} */
+    this._polling = undefined
+    this._timer = undefined
+  }
+
+  /**
+   * Call `listener` with the messages found by each poll, in file order, one call per chunk read.
+   *
+   * @param {(messages: CbufLogEntry[]) => void} listener
+   * @param {(error: Error) => void} [onError] Called if polling started by `start()` fails
+   * @returns {() => void} Unsubscribes
+   */
+  subscribe(listener, onError) {
+    const subscription = { listener, onError }
+    this._listeners.add(subscription)
+    return () => this._listeners.delete(subscription)
+  }
+
+  /**
+   * Read and index the bytes appended since the last poll and notify subscribers. Concurrent calls
+   * share one read.
+   *
+   * @returns {Promise<number>} The number of new messages
+   */
+  poll() {
+    if (this._polling == undefined) {
+      this._polling = this._poll().finally(() => (this._polling = undefined))
+    }
+    return this._polling
+  }
+
+  /**
+   * Poll every `interval` milliseconds until `stop()` is called. A failed poll stops polling and is
+   * reported to subscribers' `onError`.
+   *
+   * @param {number} interval
+   */
+  start(interval) {
+    if (this._timer != undefined) {
+      return
+    }
+    this._timer = setInterval(() => {
+      this.poll().catch((err) => {
+        this.stop()
+        for (const { onError } of this._listeners) {
+          onError?.(err)
+        }
+      })
+    }, interval)
+    // Do not keep a Node.js process alive just for the poll timer
+    this._timer.unref?.()
+  }
+
+  stop() {
+    if (this._timer != undefined) {
+      clearInterval(this._timer)
+      this._timer = undefined
+    }
+  }
+
+  /** @returns {Promise<number>} */
+  async _poll() {
+    if (this._error != undefined) {
+      throw this._error
+    }
+    const size = await this.source.size()
+    if (size < this.readOffset) {
+      throw new Error(`Log shrank from ${this.readOffset} to ${size} bytes`)
+    }
+    let count = 0
+    while (this.readOffset < size) {
+      let length = Math.min(this.chunkSize, size - this.readOffset)
+      if (this._pending.length >= HEADER_SIZE) {
+        // Read the rest of a partial message larger than a chunk at once
+        const view = new DataView(this._pending.buffer, this._pending.byteOffset, HEADER_SIZE)
+        const needed = messageSize(view, 0) - this._pending.length
+        length = Math.max(length, Math.min(needed, size - this.readOffset))
+      }
+      const appended = await this.source.read(this.readOffset, length)
+      if (appended.length === 0) {
+        // Truncated or replaced since size() was read
+        break
+      }
+      count += this._readChunk(appended)
+    }
+    return count
+  }
+
+  /**
+   * Index the messages completed by a chunk read at `readOffset`, decode them and notify
+   * subscribers. If a message fails to decode or to extend the schema, every entry of the chunk is
+   * still delivered before the error is rethrown, those after it without `message`, so the next
+   * poll resumes after the chunk without losing any. Bytes that cannot be framed fail the follower
+   * instead, once the messages before them are delivered, as no later offset can be trusted.
+   *
+   * @param {Uint8Array} appended
+   * @returns {number} The number of new messages
+   */
+  _readChunk(appended) {
+    let data = appended
+    if (this._pending.length > 0) {
+      data = new Uint8Array(this._pending.length + appended.length)
+      data.set(this._pending)
+      data.set(appended, this._pending.length)
+    }
+
+    const index = this.index
+    const dataOffset = index.end
+    const first = index.count
+    let scanError
+    try {
+      index.scan(data, dataOffset)
+      this.readOffset += appended.length
+      // Copy the partial message so the rest of this read can be released
+      this._pending = data.slice(index.end - dataOffset)
+    } catch (err) {
+      this._error = err
+      scanError = err
+    }
+
+    const entries = []
+    let error
+    for (let i = first; i < index.count; i++) {
+      const offset = index._offsets[i] - dataOffset
+      const entry = {
+        offset: index._offsets[i],
+        size: index._sizes[i],
+        timestamp: index._timestamps[i],
+        hashValue: index._hashes[i],
+        variant: index._variants[i],
+        data: data.subarray(offset, offset + index._sizes[i]),
+      }
+      entries.push(entry)
+      if (error != undefined) {
+        continue
+      }
+      try {
+        if (entry.hashValue === METADATA_HASH) {
+          entry.message = runtime.deserializeMessage(this.schemaMap, this.hashMap, entry.data, 0)
+          this._describe(entry.message.message)
+        } else if (this.decode && this.hashMap.has(entry.hashValue)) {
+          entry.message = runtime.deserializeMessage(
+            this.schemaMap,
+            this.hashMap,
+            entry.data,
+            0,
+            this._decodeOptions,
+          )
+        }
+      } catch (err) {
+        error = err
+      }
+    }
+
+    if (entries.length > 0) {
+      for (const { listener } of this._listeners) {
+        listener(entries)
+      }
+    }
+    if (error != undefined || scanError != undefined) {
+      throw error ?? scanError
+    }
+    return entries.length
+  }
+
+  /**
+   * Add the types described by a metadata message to the schema, unless already known.
+   *
+   * @param {{ msg_hash: bigint; msg_name: string; msg_meta: string }} metadata
+   */
+  _describe(metadata) {
+    if (this.parseSchema == undefined || this.hashMap.has(metadata.msg_hash)) {
+      return
+    }
+    const { error, schema } = this.parseSchema(metadata.msg_meta)
+    if (error != undefined) {
+      throw new Error(`Failed to parse the schema of ${metadata.msg_name}: ${error}`)
+    }
+    for (const [name, definition] of schema) {
+      this.schemaMap.set(name, definition)
+      this.hashMap.set(definition.hashValue, definition)
+    }
+  }
+}
+
+/**
+ * @param {number} rate
+ * @returns {number} `rate`, if it is finite and above 0
+ */
+function playbackRate(rate) {
+  if (!(rate > 0 && isFinite(rate))) {
+    throw new Error(`Invalid playback rate ${rate}`)
+  }
+  return rate
+}
+
+/**
+ * Plays back `.cb` logs in real time or at a multiple of it, calling subscribers with each decoded
+ * message at its timestamp. Messages are decoded ahead of the playhead in time-sliced batches on
+ * the timer queue, into a bounded ring of ready messages. The decode-ahead window grows with the
+ * playback rate and the measured decode load, so heavy topics are decoded well before they are
+ * due.
+ */
+class CbufPlayer {
+  /**
+   * @param {CbufLogInput[]} logs The logs to play, merged by timestamp as by `mergeLogs()`
+   * @param {{
+   *   schemaMap?: Map<string, CbufMessageDefinition>;
+   *   hashMap?: Map<bigint, CbufMessageDefinition>;
+   *   stringCache?: StringCache;
+   *   messageCache?: MessageCache;
+   *   rate?: number;
+   *   start?: number;
+   *   maxReady?: number;
+   *   bufferMs?: number;
+   *   maxLookahead?: number;
+   *   sliceMs?: number;
+   *   now?: () => number;
+   * }} [options]
+   *   - `schemaMap`, `hashMap`, `stringCache`, `messageCache`: Decoding options, as for
+   *     `mergeLogs()`. With a `messageCache`, seeking back replays cached messages.
+   *   - `rate`: The playback rate, finite and above 0. Defaults to 1 (real time).
+   *   - `start`: The log time to start from. Defaults to the first message.
+   *   - `maxReady`: The most decoded messages held ahead of the playhead. Defaults to 1024.
+   *   - `bufferMs`: The wall-clock time of playback to keep decoded ahead when decoding is cheap.
+   *     Defaults to 250.
+   *   - `maxLookahead`: The most log time, in seconds, decoded ahead. Defaults to 10.
+   *   - `sliceMs`: The longest a decode batch runs before yielding the thread. Defaults to 4.
+   *   - `now`: The wall clock in milliseconds. Defaults to `performance.now()`.
+   */
+  constructor(logs, options = {}) {
+    this.logs = logs.map((input) => {
+      const log = ArrayBuffer.isView(input) ? { data: input } : { ...input }
+      log.index ??= CbufIndex.fromBuffer(log.data)
+      return log
+    })
+    this.rate = playbackRate(options.rate ?? 1)
+    this.maxReady = options.maxReady ?? 1024
+    this.bufferMs = options.bufferMs ?? 250
+    this.maxLookahead = options.maxLookahead ?? 10
+    this.sliceMs = options.sliceMs ?? 4
+    this.playing = false
+
+    this._mergeOptions = {
+      decode: true,
+      schemaMap: options.schemaMap,
+      hashMap: options.hashMap,
+      stringCache: options.stringCache,
+      messageCache: options.messageCache,
+    }
+    this._now = options.now ?? (() => performance.now())
+    this._listeners = new Set()
+    this._ring = new Array(this.maxReady)
+    this._head = 0
+    this._ready = 0
+    this._decodeTimer = undefined
+    this._emitTimer = undefined
+    // Smoothed decode cost, and the message density of the log time decoded since the last seek
+    this._decodeMsPerMessage = 0
+    this._decodedSinceSeek = 0
+    this._stats = { decoded: 0, emitted: 0, late: 0 }
+
+    let first = Infinity
+    for (const { index } of this.logs) {
+      if (index.count > 0) first = Math.min(first, index._timestamps[index.byTime(0)])
+    }
+    this.seek(options.start ?? (first === Infinity ? 0 : first))
+  }
+
+  /**
+   * Call `listener` with each message at its timestamp. `onEnd` is called when playback reaches
+   * the end of the logs, or with the error that stopped it.
+   *
+   * @param {(message: CbufMessageRef & { message: CbufMessage }) => void} listener
+   * @param {(error?: Error) => void} [onEnd]
+   * @returns {() => void} Unsubscribes
+   */
+  subscribe(listener, onEnd) {
+    const subscription = { listener, onEnd }
+    this._listeners.add(subscription)
+    return () => this._listeners.delete(subscription)
+  }
+
+  /** @returns {number} The log time at the playhead */
+  get time() {
+    if (!this.playing) {
+      return this._logStart
+    }
+    return this._logStart + ((this._now() - this._wallStart) / 1000) * this.rate
+  }
+
+  /**
+   * @returns {number} The log time in seconds decoded ahead of the playhead: `bufferMs` of
+   *   playback at the current rate, stretched by the fraction of each second spent decoding
+   */
+  get lookahead() {
+    const elapsed = this._lastDecoded - this._seekTime
+    const density = elapsed > 0 ? this._decodedSinceSeek / elapsed : 0
+    const load = (this.rate * density * this._decodeMsPerMessage) / 1000
+    return Math.min(this.maxLookahead, ((this.rate * this.bufferMs) / 1000) * (1 + load))
+  }
+
+  play() {
+    if (this.playing) {
+      return
+    }
+    this._wallStart = this._now()
+    this.playing = true
+    this._scheduleDecode()
+    this._scheduleEmit()
+  }
+
+  pause() {
+    if (!this.playing) {
+      return
+    }
+    this._logStart = this.time
+    this.playing = false
+    this._cancelTimers()
+  }
+
+  /** @param {number} rate A finite rate above 0. Use `pause()` to stop the playhead */
+  setRate(rate) {
+    rate = playbackRate(rate)
+    this._logStart = this.time
+    this._wallStart = this._now()
+    this.rate = rate
+    if (this.playing) {
+      this._scheduleEmit()
+    }
+  }
+
+  /**
+   * Move the playhead to `timestamp`, discarding messages decoded ahead.
+   *
+   * @param {number} timestamp
+   */
+  seek(timestamp) {
+    this._cancelTimers()
+    this._iterator = mergeLogs(this.logs, { ...this._mergeOptions, start: timestamp })
+    this._done = false
+    this._ring.fill(undefined)
+    this._head = 0
+    this._ready = 0
+    this._seekTime = timestamp
+    this._lastDecoded = timestamp
+    this._decodedSinceSeek = 0
+    this._logStart = timestamp
+    this._wallStart = this._now()
+    if (this.playing) {
+      this._scheduleDecode()
+    }
+  }
+
+  /**
+   * @returns {{
+   *   decoded: number;
+   *   emitted: number;
+   *   late: number;
+   *   ready: number;
+   *   lookahead: number;
+   *   decodeMsPerMessage: number;
+   * }} Counters since construction, where `late` counts messages that were due before they were
+   *   decoded, and the current ring fill, lookahead and smoothed decode cost
+   */
+  stats() {
+    return {
+      ...this._stats,
+      ready: this._ready,
+      lookahead: this.lookahead,
+      decodeMsPerMessage: this._decodeMsPerMessage,
+    }
+  }
+
+  _cancelTimers() {
+    clearTimeout(this._decodeTimer)
+    clearTimeout(this._emitTimer)
+    this._decodeTimer = undefined
+    this._emitTimer = undefined
+  }
+
+  _scheduleDecode() {
+    if (this._decodeTimer == undefined && this.playing && !this._done) {
+      this._decodeTimer = setTimeout(() => this._decodeAhead(), 0)
+    }
+  }
+
+  /** Decode messages into the ring until it is full, the window is covered or the slice ends */
+  _decodeAhead() {
+    this._decodeTimer = undefined
+    const start = this._now()
+    const horizon = this.time + this.lookahead
+    let decoded = 0
+    let elapsed = 0
+    while (this._ready < this.maxReady && this._lastDecoded <= horizon) {
+      let next
+      try {
+        next = this._iterator.next()
+      } catch (err) {
+        this._end(err)
+        return
+      }
+      if (next.done === true) {
+        this._done = true
+        break
+      }
+      const ref = next.value
+      this._ring[(this._head + this._ready++) % this.maxReady] = ref
+      this._lastDecoded = ref.timestamp
+      if (ref.timestamp < this.time) {
+        this._stats.late++
+      }
+      decoded++
+      elapsed = this._now() - start
+      if (elapsed >= this.sliceMs) {
+        break
+      }
+    }
+
+    if (decoded > 0) {
+      const cost = elapsed / decoded
+      this._decodeMsPerMessage =
+        this._decodeMsPerMessage === 0 ? cost : 0.8 * this._decodeMsPerMessage + 0.2 * cost
+      this._decodedSinceSeek += decoded
+      this._stats.decoded += decoded
+    }
+    // Keep going after yielding the thread if the window is not covered yet
+    if (this._ready < this.maxReady && this._lastDecoded <= this.time + this.lookahead) {
+      this._scheduleDecode()
+    }
+    this._scheduleEmit()
+  }
+
+  _scheduleEmit() {
+    clearTimeout(this._emitTimer)
+    this._emitTimer = undefined
+    if (!this.playing) {
+      return
+    }
+    if (this._ready === 0) {
+      if (this._done) {
+        this._end()
+      }
+      // Otherwise decoding schedules emission when it adds messages
+      return
+    }
+    const next = this._ring[this._head]
+    const delay = Math.max(0, ((next.timestamp - this.time) / this.rate) * 1000)
+    this._emitTimer = setTimeout(() => this._emit(), delay)
+  }
+
+  /** Emit every ready message that is due */
+  _emit() {
+    this._emitTimer = undefined
+    const now = this.time
+    while (this._ready > 0 && this.playing) {
+      const ref = this._ring[this._head]
+      if (ref.timestamp > now) {
+        break
+      }
+      this._ring[this._head] = undefined
+      this._head = (this._head + 1) % this.maxReady
+      this._ready--
+      this._stats.emitted++
+      for (const { listener } of this._listeners) {
+        listener(ref)
+      }
+    }
+    this._scheduleDecode()
+    this._scheduleEmit()
+  }
+
+  /** @param {Error} [error] */
+  _end(error) {
+    this._logStart = this.time
+    this.playing = false
+    this._cancelTimers()
+    for (const { onEnd } of this._listeners) {
+      onEnd?.(error)
+    }
+  }
+}
+
+module.exports.CbufIndex = CbufIndex
+module.exports.CbufFollower = CbufFollower
+module.exports.CbufPlayer = CbufPlayer
+module.exports.mergeLogs = mergeLogs
+module.exports.deserializeMessagesAt = deserializeMessagesAt
+module.exports.readMessage = readMessage
+module.exports.readMessagesAt = readMessagesAt
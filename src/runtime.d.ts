@@ -0,0 +1,73 @@
+import type { CbufMemoryStats } from "./index"
+
+// The message codec without the wasm schema compiler. Load schemas with
+// `deserializeSchemaSnapshot()`.
+export type {
+  CbufArray,
+  CbufColumn,
+  CbufColumnBatch,
+  CbufColumnValues,
+  CbufDecoder,
+  CbufDecodeOptions,
+  CbufDecodeProfile,
+  CbufDecodeStrategy,
+  CbufHashMap,
+  CbufLogEntry,
+  CbufLogInput,
+  CbufMemoryStats,
+  CbufMessage,
+  CbufMessageDefinition,
+  CbufMessageMap,
+  CbufMessageRef,
+  CbufNodeWritable,
+  CbufOffsetColumn,
+  CbufPlayerOptions,
+  CbufSource,
+  CbufTrace,
+  CbufTraceSpan,
+  CbufTypedArray,
+  CbufValue,
+  CbufWriterOptions,
+  MessageCacheStats,
+  StringCacheStats,
+} from "./index"
+export {
+  BlockCache,
+  CbufBlobSource,
+  CbufChangeDetector,
+  CbufDecodeProfiler,
+  CbufFileSource,
+  CbufFollower,
+  CbufIndex,
+  CbufMemorySource,
+  CbufOutputRegion,
+  CbufPlayer,
+  CbufTracer,
+  CbufWriter,
+  MessageCache,
+  StringCache,
+  clearDecoders,
+  compileDecoders,
+  deserializeMessage,
+  deserializeMessagesAt,
+  deserializeSchemaSnapshot,
+  diffMessages,
+  generateDecoderSource,
+  getTracer,
+  mergeLogs,
+  readMessage,
+  readMessagesAt,
+  registerDecoder,
+  schemaMapToHashMap,
+  serializeColumns,
+  serializeMessage,
+  serializeMessageInto,
+  serializeMessages,
+  serializeSchemaSnapshot,
+  serializedMessageSize,
+  setDecodeProfiler,
+  setTracer,
+} from "./index"
+
+/** Memory held by live caches, writers and output regions */
+export function getMemoryStats(): Pick<CbufMemoryStats, "js">
@@ -0,0 +1,3022 @@
+// The message codec: everything needed to read and write cbuf messages against an already parsed
+// schema. It does not load the wasm schema compiler, so playback-only consumers that receive a
+// schema snapshot can `require("wasm-cbuf/dist/runtime")` and skip downloading and compiling it.
+
+const { generateDecoderSource } = require("./codegen")
+
+// The `metadata.cbuf` definition is bootstrapped so other definitions can be
+// read from metadata messages in a cbuf `.cb` file
+const METADATA_DEFINITION = {
+  name: "cbufmsg::metadata",
+  hashValue: 0xbe6738d544ab72c6n,
+  definitions: [
+    { name: "msg_hash", type: "uint64" },
+    { name: "msg_name", type: "string" },
+    { name: "msg_meta", type: "string" },
+  ],
+}
+
+// Bootstrapped definitions for schema snapshots, a parsed schema written as a cbuf message by
+// `serializeSchemaSnapshot()`. The hash values are the ones the cbuf compiler assigns to these
+// structs
+const SNAPSHOT_FIELD_DEFINITION = {
+  name: "cbufmsg::snapshot_field",
+  hashValue: 0x4edc7868df66b3c9n,
+  naked: true,
+  definitions: [
+    { name: "name", type: "string" },
+    { name: "type", type: "string" },
+    { name: "isComplex", type: "bool" },
+    { name: "isArray", type: "bool" },
+    { name: "arrayLength", type: "int32" },
+    { name: "arrayUpperBound", type: "int32" },
+    { name: "upperBound", type: "int32" },
+    { name: "defaultValue", type: "string" },
+  ],
+}
+const SNAPSHOT_STRUCT_DEFINITION = {
+  name: "cbufmsg::snapshot_struct",
+  hashValue: 0x1f45d950195b55b3n,
+  naked: true,
+  definitions: [
+    { name: "name", type: "string" },
+    { name: "hashValue", type: "uint64" },
+    { name: "line", type: "uint32" },
+    { name: "column", type: "uint32" },
+    { name: "naked", type: "bool" },
+    { name: "definitions", type: "cbufmsg::snapshot_field", isComplex: true, isArray: true },
+  ],
+}
+const SNAPSHOT_DEFINITION = {
+  name: "cbufmsg::snapshot",
+  hashValue: 0x5fb5c02124f6d869n,
+  naked: false,
+  definitions: [
+    { name: "version", type: "uint32" },
+    { name: "structs", type: "cbufmsg::snapshot_struct", isComplex: true, isArray: true },
+  ],
+}
+const SNAPSHOT_VERSION = 1
+
+const HEADER_SIZE = 4 + 4 + 8 + 8
+
+// Typed array element types for numeric cbuf array fields
+const TYPED_ARRAY_TYPES = {
+  bool: Uint8Array,
+  uint8: Uint8Array,
+  int8: Int8Array,
+  uint16: Uint16Array,
+  int16: Int16Array,
+  uint32: Uint32Array,
+  int32: Int32Array,
+  // eslint-disable-next-line no-undef
+  uint64: BigUint64Array,
+  // eslint-disable-next-line no-undef
+  int64: BigInt64Array,
+  float32: Float32Array,
+  float64: Float64Array,
+}
+
+// Little-endian DataView writers for scalar cbuf types
+const DATAVIEW_SETTERS = {
+  bool: (view, offset, value) => view.setUint8(offset, value ? 1 : 0),
+  uint8: (view, offset, value) => view.setUint8(offset, value),
+  int8: (view, offset, value) => view.setInt8(offset, value),
+  uint16: (view, offset, value) => view.setUint16(offset, value, true),
+  int16: (view, offset, value) => view.setInt16(offset, value, true),
+  uint32: (view, offset, value) => view.setUint32(offset, value, true),
+  int32: (view, offset, value) => view.setInt32(offset, value, true),
+  uint64: (view, offset, value) => view.setBigUint64(offset, value, true),
+  int64: (view, offset, value) => view.setBigInt64(offset, value, true),
+  float32: (view, offset, value) => view.setFloat32(offset, value, true),
+  float64: (view, offset, value) => view.setFloat64(offset, value, true),
+}
+
+// cbuf data is little-endian, so typed arrays can only be copied in bulk on little-endian hosts
+const IS_LITTLE_ENDIAN = new Uint8Array(new Uint16Array([1]).buffer)[0] === 1
+
+// Strings up to this many bytes or characters are decoded and encoded with plain loops
+const SHORT_STRING_LENGTH = 32
+
+const textDecoder = new TextDecoder()
+const textEncoder = new TextEncoder()
+
+// Weak references to live objects holding JS-side buffers, reported by `getMemoryStats()`. Each
+// object implements `_memoryUsage()`
+const memoryTracked = new Set()
+const memoryRegistry = new FinalizationRegistry((ref) => memoryTracked.delete(ref))
+
+/** @type {CbufTracer | undefined} The tracer installed with `setTracer()` */
+let tracer
+
+/** @type {CbufDecodeProfiler | undefined} The profiler installed with `setDecodeProfiler()` */
+let profiler
+
+// Specialized decoders by message hash, preferred by `deserializeMessage()` over the generic
+// decoder. See `registerDecoder()` and `compileDecoders()`
+const compiledDecoders = new Map()
+
+/**
+ * @typedef {import('@foxglove/message-definition').MessageDefinition} MessageDefinition
+ * @typedef {import("@foxglove/message-definition").MessageDefinitionField} MessageDefinitionField
+ * @typedef {MessageDefinition & { hashValue: bigint; line: number; column: number; naked: boolean }} CbufMessageDefinition
+ * @typedef {import("./index").CbufMessage} CbufMessage
+ * @typedef {{
+ *   sourceId: unknown;
+ *   offset: number;
+ *   message: CbufMessage;
+ *   bytes: number;
+ *   prev?: MessageCacheEntry;
+ *   next?: MessageCacheEntry;
+ * }} MessageCacheEntry
+ */
+
+/**
+ * Report buffers held by live `StringCache`, `MessageCache`, `CbufWriter` and `CbufOutputRegion`
+ * instances. The full package adds wasm heap usage to this report.
+ *
+ * @returns {{ js: import("./index").CbufMemoryStats["js"] }}
+ */
+function getMemoryStats() {
+  const js = {
+    stringCaches: { count: 0, entries: 0, bytes: 0 },
+    writers: { count: 0, bufferedBytes: 0 },
+    outputRegions: { count: 0, bytes: 0, usedBytes: 0 },
+    messageCaches: { count: 0, entries: 0, bytes: 0 },
+  }
+  for (const ref of memoryTracked) {
+    const obj = ref.deref()
+    if (obj == undefined) {
+      memoryTracked.delete(ref)
+      continue
+    }
+    const usage = obj._memoryUsage()
+    if (obj instanceof StringCache) {
+      js.stringCaches.count++
+      js.stringCaches.entries += usage.entries
+      js.stringCaches.bytes += usage.bytes
+    } else if (obj instanceof CbufWriter) {
+      js.writers.count++
+      js.writers.bufferedBytes += usage.bytes
+    } else if (obj instanceof CbufOutputRegion) {
+      js.outputRegions.count++
+      js.outputRegions.bytes += usage.bytes
+      js.outputRegions.usedBytes += usage.used
+    } else if (obj instanceof MessageCache) {
+      js.messageCaches.count++
+      js.messageCaches.entries += usage.entries
+      js.messageCaches.bytes += usage.bytes
+    }
+  }
+
+  return { js }
+}
+
+/**
+ * @param {object} obj An object implementing `_memoryUsage()`
+ */
+function trackMemory(obj) {
+  const ref = new WeakRef(obj)
+  memoryTracked.add(ref)
+  memoryRegistry.register(obj, ref)
+}
+
+/**
+ * Takes a parsed schema (`Map<string, CbufMessageDefinition>`) which maps message names to message
+ * definitions and returns a new `Map<bigint, CbufMessageDefinition>` mapping hash values to message
+ * definitions.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @returns {Map<bigint, CbufMessageDefinition>} Mapping from hash values to message definitions.
+ */
+function schemaMapToHashMap(schemaMap) {
+  const hashMap = new Map()
+  for (const definition of schemaMap.values()) {
+    hashMap.set(definition.hashValue, definition)
+  }
+  return hashMap
+}
+
+/**
+ * Given hash maps from message names and hash values to `CbufMessageDefinition`s, a byte buffer,
+ * and optional offset into the buffer, deserialize the buffer into a JavaScript object representing
+ * a single non-naked struct message, which includes a message header and message data.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap A map of fully qualified message names to
+ *   message definitions obtained from `parseCBufSchema()`.
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap A map of hash values to message definitions
+ *   obtained from `schemaMapToHashMap()`.
+ * @param {ArrayBufferView} data The byte buffer to deserialize from.
+ * @param {number | undefined} offset Optional byte offset into the buffer to deserialize from.
+ * @param {{
+ *   stringCache?: StringCache;
+ *   messageCache?: MessageCache;
+ *   sourceId?: unknown;
+ * } | undefined} options Optional decoding options. `stringCache` interns repeated string values
+ *   across messages. `messageCache` returns the message decoded before from the same `sourceId`
+ *   (by default `data`) and offset, so cached messages must not be modified.
+ * @returns {{
+ *   typeName: string; // The fully qualified message name
+ *   size: number; // The size of the message header and message data, in bytes
+ *   variant: number; // The message variant
+ *   hashValue: bigint; // The hash value of the `.cbuf` message definition
+ *   timestamp: number; // A timestamp in seconds since the Unix epoch as a 64-bit float
+ *   message: Record<string, unknown> // The deserialized messge data
+ * }} A JavaScript object representing the deserialized message header fields and message data.
+ */
+function deserializeMessage(schemaMap, hashMap, data, offset, options) {
+  if (options?.messageCache != undefined) {
+    return deserializeCachedMessage(schemaMap, hashMap, data, offset || 0, options)
+  }
+  const traceStart = tracer != undefined ? performance.now() : 0
+  let curOffset = offset || 0
+  if (curOffset < 0 || curOffset >= data.length) {
+    throw new Error(`Invalid offset ${curOffset} for buffer of length ${data.length}`)
+  }
+
+  // CBuf layout for a non-naked struct:
+  //   CBUF_MAGIC (4 bytes) 0x56444e54
+  //   size uint32_t (4 bytes)
+  //   hashValue uint64_t (8 bytes)
+  //   timestamp double (8 bytes)
+  //   message data
+
+  // Create a view into the buffer starting at offset and reset offset to zero
+  const view = new DataView(data.buffer, data.byteOffset + curOffset, data.byteLength - curOffset)
+  curOffset = 0
+  if (view.byteLength < 24) {
+    throw new Error(`Buffer too small to contain cbuf header: ${view.byteLength} bytes`)
+  }
+
+  // CBUF_MAGIC
+  const magic = view.getUint32(curOffset, true)
+  curOffset += 4
+  if (magic !== 0x56444e54) {
+    throw new Error(`Invalid cbuf magic 0x${magic.toString(16)}`)
+  }
+
+  // size and variant
+  const sizeAndVariant = view.getUint32(curOffset, true)
+  const hasVariant = (sizeAndVariant & 0x80000000) >>> 0 == 0x80000000
+  const size = hasVariant ? sizeAndVariant & 0x07ffffff : sizeAndVariant & 0x7fffffff
+  const variant = hasVariant ? (sizeAndVariant >> 27) & 0x0f : 0
+  curOffset += 4
+  if (size > view.byteLength) {
+    throw new Error(`cbuf size ${size} exceeds buffer of length ${view.byteLength}`)
+  }
+
+  // hashValue
+  const hashValue = view.getBigUint64(curOffset, true)
+  curOffset += 8
+
+  // timestamp
+  const timestamp = view.getFloat64(curOffset, true)
+  curOffset += 8
+
+  // Look up the message definition by hash value in the schema hash map with a fallback check for
+  // the built-in metadata definition
+  const msgdef =
+    hashValue === METADATA_DEFINITION.hashValue ? METADATA_DEFINITION : hashMap.get(hashValue)
+  if (!msgdef) {
+    throw new Error(`cbuf hash value ${hashValue} not found in the hash map`)
+  }
+
+  // message data
+  let message
+  const compiled = compiledDecoders.size !== 0 ? compiledDecoders.get(hashValue) : undefined
+  if (profiler != undefined && !profiler._active) {
+    // Profiling attributes time to fields, so it always takes the generic decoder
+    message = {}
+    curOffset += profiler._decode(schemaMap, hashMap, msgdef, view, curOffset, message, options)
+    checkDecodedSize(size, curOffset)
+  } else if (compiled != undefined) {
+    message = compiled(view, curOffset, size, options)
+  } else {
+    message = {}
+    curOffset += deserializeNakedMessage(
+      schemaMap,
+      hashMap,
+      msgdef,
+      view,
+      curOffset,
+      message,
+      options,
+    )
+    checkDecodedSize(size, curOffset)
+  }
+
+  if (traceStart !== 0) {
+    tracer?._decoded(msgdef.name, size, traceStart)
+  }
+  return { typeName: msgdef.name, size, variant, hashValue, timestamp, message }
+}
+
+/**
+ * `deserializeMessage()` through `options.messageCache`.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {ArrayBufferView} data
+ * @param {number} offset
+ * @param {{ stringCache?: StringCache; messageCache: MessageCache; sourceId?: unknown }} options
+ * @returns {CbufMessage}
+ */
+function deserializeCachedMessage(schemaMap, hashMap, data, offset, options) {
+  const { messageCache, sourceId = data, stringCache } = options
+  let message = messageCache.get(sourceId, offset)
+  if (message == undefined) {
+    message = deserializeMessage(schemaMap, hashMap, data, offset, { stringCache })
+    messageCache.set(sourceId, offset, message)
+  }
+  return message
+}
+
+/**
+ * Deserialize a single naked struct message from a DataView into a JavaScript object.
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufMessageDefinition} msgdef
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {Record<string, unknown>} output
+ * @param {{ stringCache?: StringCache } | undefined} options
+ * @returns {number} The number of bytes consumed from the buffer
+ */
+function deserializeNakedMessage(schemaMap, hashMap, msgdef, view, offset, output, options) {
+  let innerOffset = 0
+
+  for (const field of msgdef.definitions) {
+    if (field.isArray === true) {
+      // Array field (fixed or variable length)
+      let arrayLength = field.arrayLength
+      if (arrayLength == undefined) {
+        arrayLength = view.getUint32(offset + innerOffset, true)
+        innerOffset += 4
+      }
+
+      // The byte offset into the underlying ArrayBuffer we are reading from, for constructing
+      // typed arrays
+      const bufferOffset = view.byteOffset + offset + innerOffset
+
+      switch (field.type) {
+        case "bool":
+        case "uint8":
+          output[field.name] = typedArray(Uint8Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength
+          break
+        case "int8":
+          output[field.name] = typedArray(Int8Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength
+          break
+        case "uint16":
+          output[field.name] = typedArray(Uint16Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 2
+          break
+        case "int16":
+          output[field.name] = typedArray(Int16Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 2
+          break
+        case "uint32":
+          output[field.name] = typedArray(Uint32Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 4
+          break
+        case "int32":
+          output[field.name] = typedArray(Int32Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 4
+          break
+        case "uint64":
+          // eslint-disable-next-line no-undef
+          output[field.name] = typedArray(BigUint64Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 8
+          break
+        case "int64":
+          // eslint-disable-next-line no-undef
+          output[field.name] = typedArray(BigInt64Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 8
+          break
+        case "float32":
+          output[field.name] = typedArray(Float32Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 4
+          break
+        case "float64":
+          output[field.name] = typedArray(Float64Array, view.buffer, bufferOffset, arrayLength)
+          innerOffset += arrayLength * 8
+          break
+        default: {
+          // string arrau or nested struct array. Read each element individually and push onto an
+          // array
+          const array = []
+          const fieldOutput = {}
+          for (let i = 0; i < arrayLength; i++) {
+            const curOffset = offset + innerOffset
+            innerOffset += readNonArrayField(
+              schemaMap,
+              hashMap,
+              field,
+              view,
+              curOffset,
+              fieldOutput,
+              options,
+            )
+            array.push(fieldOutput[field.name])
+          }
+          output[field.name] = array
+          break
+        }
+      }
+    } else {
+      innerOffset += readNonArrayField(
+        schemaMap,
+        hashMap,
+        field,
+        view,
+        offset + innerOffset,
+        output,
+        options,
+      )
+    }
+  }
+
+  return innerOffset
+}
+
+function typedArray(TypedArrayConstructor, buffer, offset, length) {
+  // new TypedArrayConstructor(...) will throw if you try to make a typed array on unaligned boundary
+  // but for aligned access we can use a typed array and avoid any extra memory alloc/copy
+  if (offset % TypedArrayConstructor.BYTES_PER_ELEMENT === 0) {
+    return new TypedArrayConstructor(buffer, offset, length)
+  }
+
+  // Copy the data to align it
+  // Using _set_ is slightly faster than slice on the array buffer according to benchmarks when written
+  const size = TypedArrayConstructor.BYTES_PER_ELEMENT * length
+  const copy = new Uint8Array(size)
+  copy.set(new Uint8Array(buffer, offset, size))
+  return new TypedArrayConstructor(copy.buffer, copy.byteOffset, length)
+}
+
+/**
+ * @param {number} size The size from a message header
+ * @param {number} decoded The number of bytes decoded for the message, including the header
+ */
+function checkDecodedSize(size, decoded) {
+  if (decoded !== size) {
+    throw new Error(`cbuf size ${size} does not match decoded size ${decoded}`)
+  }
+}
+
+/**
+ * Read a string of `length` bytes, interning it when a `StringCache` is given.
+ *
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {number} length
+ * @param {{ stringCache?: StringCache } | undefined} options
+ * @returns {string}
+ */
+function readString(view, offset, length, options) {
+  const bytes = new Uint8Array(view.buffer, view.byteOffset + offset, length)
+  const stringCache = options?.stringCache
+  return stringCache != undefined ? stringCache.decode(bytes) : decodeString(bytes)
+}
+
+/**
+ * Check the header of a nested non-naked struct and return its size.
+ *
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {bigint} hashValue The hash the nested struct is expected to have
+ * @returns {number}
+ */
+function nestedMessageSize(view, offset, hashValue) {
+  const magic = view.getUint32(offset, true)
+  if (magic !== 0x56444e54) {
+    throw new Error(`Invalid cbuf magic 0x${magic.toString(16)}`)
+  }
+  const actual = view.getBigUint64(offset + 8, true)
+  if (actual !== hashValue) {
+    throw new Error(`Nested cbuf hash value ${actual} does not match expected ${hashValue}`)
+  }
+  const sizeAndVariant = view.getUint32(offset + 4, true)
+  return sizeAndVariant & 0x80000000 ? sizeAndVariant & 0x07ffffff : sizeAndVariant & 0x7fffffff
+}
+
+// The helpers generated decoders call through `rt`
+const DECODER_RUNTIME = {
+  typedArray,
+  readString,
+  nestedSize: nestedMessageSize,
+  checkSize: checkDecodedSize,
+}
+
+/**
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {MessageDefinitionField} field
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {Record<string, unknown>} output
+ * @param {{ stringCache?: StringCache } | undefined} options
+ * @returns {number}
+ */
+function readNonArrayField(schemaMap, hashMap, field, view, offset, output, options) {
+  let innerOffset = 0
+
+  if (field.isComplex === true) {
+    // Look up the nested message definition
+    const nestedMsgdef = schemaMap.get(field.type)
+    if (!nestedMsgdef) {
+      throw new Error(`Nested message type ${field.type} not found in schema map`)
+    }
+
+    if (nestedMsgdef.naked === true) {
+      // Nested naked struct (no header). Just deserialize the nested message
+      const nestedMessage = {}
+      innerOffset += deserializeNakedMessage(
+        schemaMap,
+        hashMap,
+        nestedMsgdef,
+        view,
+        offset + innerOffset,
+        nestedMessage,
+        options,
+      )
+      output[field.name] = nestedMessage
+    } else {
+      // Nested non-naked struct. This has a cbuf message header followed by the message data
+      const nestedMessage = deserializeMessage(
+        schemaMap,
+        hashMap,
+        view,
+        offset + innerOffset,
+        options,
+      )
+      output[field.name] = nestedMessage.message
+      innerOffset += nestedMessage.size
+    }
+  } else {
+    // Simple non-array type
+    innerOffset += readBasicType(view, offset, output, field, options)
+  }
+
+  return innerOffset
+}
+
+/**
+ * Read a basic cbuf type from a DataView into an output message object.
+ * @param {DataView} view DataView to read from
+ * @param {number} offset Byte offset in the DataView to read from
+ * @param {Record<string, unknown>} message Output message object to write a new field to
+ * @param {MessageDefinitionField} field Message definition for the field
+ * @param {{ stringCache?: StringCache } | undefined} options Optional decoding options
+ * @returns {number} The number of bytes consumed from the buffer
+ */
+function readBasicType(view, offset, message, field, options) {
+  switch (field.type) {
+    case "bool":
+      message[field.name] = view.getUint8(offset) !== 0
+      return 1
+    case "int8":
+      message[field.name] = view.getInt8(offset)
+      return 1
+    case "uint8":
+      message[field.name] = view.getUint8(offset)
+      return 1
+    case "int16":
+      message[field.name] = view.getInt16(offset, true)
+      return 2
+    case "uint16":
+      message[field.name] = view.getUint16(offset, true)
+      return 2
+    case "int32":
+      message[field.name] = view.getInt32(offset, true)
+      return 4
+    case "uint32":
+      message[field.name] = view.getUint32(offset, true)
+      return 4
+    case "int64":
+      message[field.name] = view.getBigInt64(offset, true)
+      return 8
+    case "uint64":
+      message[field.name] = view.getBigUint64(offset, true)
+      return 8
+    case "float32":
+      message[field.name] = view.getFloat32(offset, true)
+      return 4
+    case "float64":
+      message[field.name] = view.getFloat64(offset, true)
+      return 8
+    case "string": {
+      let curOffset = 0
+      let length = field.upperBound
+      if (length == undefined) {
+        length = view.getUint32(offset, true)
+        curOffset += 4
+      }
+      message[field.name] = readString(view, offset + curOffset, length, options)
+      return curOffset + length
+    }
+    default:
+      throw new Error(`Unsupported type ${field.type}`)
+  }
+}
+
+/**
+ * Look up the message definition for a `CbufMessage` by hash value, with a fallback check for the
+ * built-in metadata definition.
+ *
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufMessage} message
+ * @returns {CbufMessageDefinition}
+ */
+function messageDefinitionFor(hashMap, message) {
+  const msgdef =
+    message.hashValue === METADATA_DEFINITION.hashValue
+      ? METADATA_DEFINITION
+      : hashMap.get(message.hashValue)
+  if (!msgdef) {
+    throw new Error(`Unknown message hash value ${message.hashValue} (${message.typeName})`)
+  }
+  return msgdef
+}
+
+/**
+ * Decode a cbuf string from its bytes. The string ends at the first null byte, if any. Short
+ * ASCII strings are built directly with `String.fromCharCode`, which avoids the `TextDecoder` call
+ * overhead; everything else is decoded natively without an intermediate copy.
+ *
+ * @param {Uint8Array} bytes
+ * @returns {string}
+ */
+function decodeString(bytes) {
+  const length = bytes.byteLength
+  if (length <= SHORT_STRING_LENGTH) {
+    let i = 0
+    for (; i < length; i++) {
+      const c = bytes[i]
+      if (c === 0) break
+      if (c >= 0x80) {
+        // Not ASCII, decode from here to the null terminator
+        const end = bytes.indexOf(0, i)
+        return textDecoder.decode(end === -1 ? bytes : bytes.subarray(0, end))
+      }
+    }
+    return i === 0 ? "" : String.fromCharCode.apply(null, bytes.subarray(0, i))
+  }
+
+  const end = bytes.indexOf(0)
+  return textDecoder.decode(end === -1 ? bytes : bytes.subarray(0, end))
+}
+
+/**
+ * A bounded LRU cache of decoded string values, keyed by their encoded bytes. Passing the same
+ * cache to every `deserializeMessage()` call returns one JavaScript string instance for repeated
+ * values such as frame ids and status strings, skipping the UTF-8 decode and the garbage from a
+ * fresh string per message.
+ */
+class StringCache {
+  /**
+   * @param {{ maxEntries?: number; maxLength?: number } | undefined} options
+   *   - `maxEntries`: The maximum number of distinct strings kept. Defaults to 4096.
+   *   - `maxLength`: Strings longer than this many bytes are decoded without caching. Defaults
+   *     to 256.
+   */
+  constructor(options) {
+    this.maxEntries = options?.maxEntries ?? 4096
+    this.maxLength = options?.maxLength ?? 256
+    this._entries = new Map()
+    this.clear()
+    trackMemory(this)
+  }
+
+  /**
+   * Decode a cbuf string, returning a cached instance if the same bytes were decoded before.
+   *
+   * @param {Uint8Array} bytes
+   * @returns {string}
+   */
+  decode(bytes) {
+    const length = bytes.byteLength
+    if (length > this.maxLength) {
+      return decodeString(bytes)
+    }
+
+    // 32-bit FNV-1a hash of the bytes, combined with the length into an exact integer key
+    let hash = 0x811c9dc5
+    for (let i = 0; i < length; i++) {
+      hash = Math.imul(hash ^ bytes[i], 0x01000193)
+    }
+    const key = length * 0x100000000 + (hash >>> 0)
+
+    const entry = this._entries.get(key)
+    if (entry != undefined) {
+      this._entries.delete(key)
+      this._bytes -= entry.bytes.byteLength
+      if (bytesEqual(entry.bytes, bytes)) {
+        this._bytes += length
+        // Move the entry to the most recently used end
+        this._entries.set(key, entry)
+        this.hits++
+        this.bytesSaved += length
+        return entry.value
+      }
+    }
+
+    this.misses++
+    const value = decodeString(bytes)
+    this._entries.set(key, { bytes: bytes.slice(), value })
+    this._bytes += length
+    if (this._entries.size > this.maxEntries) {
+      // Maps iterate in insertion order, so the first entry is the least recently used
+      const [oldestKey, oldest] = this._entries.entries().next().value
+      this._entries.delete(oldestKey)
+      this._bytes -= oldest.bytes.byteLength
+      this.evictions++
+    }
+    return value
+  }
+
+  /** Remove all cached strings and reset the statistics. */
+  clear() {
+    this._entries.clear()
+    this._bytes = 0
+    this.hits = 0
+    this.misses = 0
+    this.evictions = 0
+    this.bytesSaved = 0
+  }
+
+  /**
+   * @returns {{
+   *   entries: number; // The number of cached strings
+   *   hits: number; // Lookups that returned a cached string
+   *   misses: number; // Lookups that decoded a new string
+   *   evictions: number; // Strings evicted to stay within maxEntries
+   *   hitRate: number; // hits / (hits + misses), or 0 before any lookup
+   *   bytesSaved: number; // Encoded bytes that did not need to be decoded
+   * }}
+   */
+  stats() {
+    const lookups = this.hits + this.misses
+    return {
+      entries: this._entries.size,
+      hits: this.hits,
+      misses: this.misses,
+      evictions: this.evictions,
+      hitRate: lookups > 0 ? this.hits / lookups : 0,
+      bytesSaved: this.bytesSaved,
+    }
+  }
+
+  /** @returns {{ entries: number; bytes: number }} The encoded bytes held by cached entries */
+  _memoryUsage() {
+    return { entries: this._entries.size, bytes: this._bytes }
+  }
+}
+
+/**
+ * A bounded LRU cache of decoded messages, keyed by a source id and the file offset of each
+ * message. Its budget is the estimated memory retained by the cached messages rather than their
+ * count, so a few large point clouds and many small status messages are weighed fairly. Messages
+ * with timestamps in the pinned window are never evicted, so the messages around the playhead stay
+ * cached while scrubbing.
+ */
+class MessageCache {
+  /**
+   * @param {{ maxBytes?: number } | undefined} options
+   *   - `maxBytes`: The estimated retained bytes to stay within. Defaults to 64MB.
+   */
+  constructor(options) {
+    this.maxBytes = options?.maxBytes ?? 64 * 1024 * 1024
+    /** @type {Map<unknown, Map<number, MessageCacheEntry>>} */
+    this._sources = new Map()
+    this.unpin()
+    this.clear()
+    trackMemory(this)
+  }
+
+  /**
+   * @param {unknown} sourceId
+   * @param {number} offset
+   * @returns {CbufMessage | undefined} The cached message, if any
+   */
+  get(sourceId, offset) {
+    const entry = this._sources.get(sourceId)?.get(offset)
+    if (entry == undefined) {
+      this.misses++
+      return undefined
+    }
+    this.hits++
+    this._unlink(entry)
+    this._pushFront(entry)
+    return entry.message
+  }
+
+  /**
+   * Cache a decoded message, evicting the least recently used unpinned messages to stay within
+   * `maxBytes`.
+   *
+   * @param {unknown} sourceId
+   * @param {number} offset
+   * @param {CbufMessage} message
+   */
+  set(sourceId, offset, message) {
+    // Remove a replaced entry first, since that may drop the source's map
+    const existing = this._sources.get(sourceId)?.get(offset)
+    if (existing != undefined) {
+      this._remove(existing)
+    }
+    let offsets = this._sources.get(sourceId)
+    if (offsets == undefined) {
+      offsets = new Map()
+      this._sources.set(sourceId, offsets)
+    }
+    const bytes = retainedSize(message)
+    const entry = { sourceId, offset, message, bytes, prev: undefined, next: undefined }
+    offsets.set(offset, entry)
+    this._pushFront(entry)
+    this._count++
+    this._bytes += bytes
+    this._evict()
+  }
+
+  /**
+   * Keep messages with timestamps in `[start, end]` cached regardless of the budget, replacing any
+   * previously pinned window.
+   *
+   * @param {number} start
+   * @param {number} end
+   */
+  pin(start, end) {
+    this.pinStart = start
+    this.pinEnd = end
+    this._evict()
+  }
+
+  unpin() {
+    this.pinStart = Infinity
+    this.pinEnd = -Infinity
+  }
+
+  /**
+   * Remove the cached messages of one source, or of every source, and with no source also reset
+   * the statistics.
+   *
+   * @param {unknown} [sourceId]
+   */
+  clear(sourceId) {
+    if (sourceId !== undefined) {
+      for (const entry of this._sources.get(sourceId)?.values() ?? []) {
+        this._remove(entry)
+      }
+      return
+    }
+    this._sources.clear()
+    this._head = undefined
+    this._tail = undefined
+    this._count = 0
+    this._bytes = 0
+    this.hits = 0
+    this.misses = 0
+    this.evictions = 0
+  }
+
+  /**
+   * @returns {{
+   *   entries: number; // The number of cached messages
+   *   bytes: number; // Their estimated retained size
+   *   hits: number; // Lookups that returned a cached message
+   *   misses: number; // Lookups that found nothing
+   *   evictions: number; // Messages evicted to stay within maxBytes
+   *   hitRate: number; // hits / (hits + misses), or 0 before any lookup
+   * }}
+   */
+  stats() {
+    const lookups = this.hits + this.misses
+    return {
+      entries: this._count,
+      bytes: this._bytes,
+      hits: this.hits,
+      misses: this.misses,
+      evictions: this.evictions,
+      hitRate: lookups > 0 ? this.hits / lookups : 0,
+    }
+  }
+
+  /** @returns {{ entries: number; bytes: number }} */
+  _memoryUsage() {
+    return { entries: this._count, bytes: this._bytes }
+  }
+
+  _evict() {
+    // Pinned messages met on the way are moved to the front, so each is passed over once
+    let remaining = this._count
+    while (this._bytes > this.maxBytes && remaining-- > 0) {
+      const entry = this._tail
+      const timestamp = entry.message.timestamp
+      this._unlink(entry)
+      if (timestamp >= this.pinStart && timestamp <= this.pinEnd) {
+        this._pushFront(entry)
+      } else {
+        this._remove(entry, true)
+        this.evictions++
+      }
+    }
+  }
+
+  /**
+   * @param {MessageCacheEntry} entry
+   * @param {boolean} [unlinked]
+   */
+  _remove(entry, unlinked = false) {
+    if (!unlinked) {
+      this._unlink(entry)
+    }
+    const offsets = this._sources.get(entry.sourceId)
+    offsets.delete(entry.offset)
+    if (offsets.size === 0) {
+      this._sources.delete(entry.sourceId)
+    }
+    this._count--
+    this._bytes -= entry.bytes
+  }
+
+  /** @param {MessageCacheEntry} entry */
+  _pushFront(entry) {
+    entry.prev = undefined
+    entry.next = this._head
+    if (this._head != undefined) {
+      this._head.prev = entry
+    } else {
+      this._tail = entry
+    }
+    this._head = entry
+  }
+
+  /** @param {MessageCacheEntry} entry */
+  _unlink(entry) {
+    if (entry.prev != undefined) {
+      entry.prev.next = entry.next
+    } else {
+      this._head = entry.next
+    }
+    if (entry.next != undefined) {
+      entry.next.prev = entry.prev
+    } else {
+      this._tail = entry.prev
+    }
+    entry.prev = undefined
+    entry.next = undefined
+  }
+}
+
+/**
+ * Estimate the bytes a decoded value retains, counting typed arrays by their length whether they
+ * are views of the input or copies.
+ *
+ * @param {unknown} value
+ * @returns {number}
+ */
+function retainedSize(value) {
+  switch (typeof value) {
+    case "string":
+      return 16 + value.length * 2
+    case "bigint":
+      return 24
+    case "object": {
+      if (value == null) {
+        return 8
+      }
+      if (ArrayBuffer.isView(value)) {
+        return 64 + value.byteLength
+      }
+      let size = 16
+      if (Array.isArray(value)) {
+        for (const element of value) size += 8 + retainedSize(element)
+      } else {
+        for (const key in value) size += 8 + retainedSize(value[key])
+      }
+      return size
+    }
+    default:
+      return 8
+  }
+}
+
+/**
+ * @param {Uint8Array} a
+ * @param {Uint8Array} b
+ * @returns {boolean} True if both arrays hold the same bytes
+ */
+function bytesEqual(a, b) {
+  if (a.byteLength !== b.byteLength) return false
+  for (let i = 0; i < a.byteLength; i++) {
+    if (a[i] !== b[i]) return false
+  }
+  return true
+}
+
+/**
+ * Return the number of bytes needed to encode a string as UTF-8, without encoding it. Unpaired
+ * surrogates count as the 3 byte replacement character, matching `TextEncoder`.
+ *
+ * @param {string} str
+ * @returns {number}
+ */
+function utf8ByteLength(str) {
+  const length = str.length
+  let size = length
+  for (let i = 0; i < length; i++) {
+    const c = str.charCodeAt(i)
+    if (c < 0x80) continue
+    if (c < 0x800) {
+      size += 1
+    } else {
+      size += 2
+      // A surrogate pair is 2 UTF-16 units and 4 UTF-8 bytes
+      if (c >= 0xd800 && c <= 0xdbff && i + 1 < length) {
+        const next = str.charCodeAt(i + 1)
+        if (next >= 0xdc00 && next <= 0xdfff) i++
+      }
+    }
+  }
+  return size
+}
+
+/**
+ * Encode a string as UTF-8 directly into a DataView, writing at most `maxLength` bytes. Short
+ * ASCII strings are written byte by byte; anything else goes through `TextEncoder.encodeInto`,
+ * which never splits a multi-byte character.
+ *
+ * @param {string} str
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {number} maxLength
+ * @returns {number} The number of bytes written
+ */
+function encodeString(str, view, offset, maxLength) {
+  const dst = new Uint8Array(view.buffer, view.byteOffset + offset, maxLength)
+  const length = str.length
+  if (length <= SHORT_STRING_LENGTH) {
+    const end = Math.min(length, maxLength)
+    let i = 0
+    for (; i < end; i++) {
+      const c = str.charCodeAt(i)
+      if (c >= 0x80) break
+      dst[i] = c
+    }
+    if (i === length || i === maxLength) {
+      return i
+    }
+  }
+  return textEncoder.encodeInto(str, dst).written
+}
+
+/**
+ * Zero `length` bytes of a DataView starting at `offset`.
+ *
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {number} length
+ */
+function zeroFill(view, offset, length) {
+  if (length > 0) {
+    new Uint8Array(view.buffer, view.byteOffset + offset, length).fill(0)
+  }
+}
+
+/**
+ * Given a schema map and hash map, and a `CbufMessage` object, return the size of the serialized
+ * message in bytes, including the CBUF header.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufMessage} message
+ * @returns {number} The size of the serialized message in bytes, including the CBUF header
+ */
+function serializedMessageSize(schemaMap, hashMap, message) {
+  if (typeof message.hashValue !== "bigint") {
+    throw new Error(`hashValue must be a bigint`)
+  }
+  if (typeof message.message !== "object") {
+    throw new Error(`message must be an object`)
+  }
+
+  const msgdef = messageDefinitionFor(hashMap, message)
+  return HEADER_SIZE + serializedNakedMessageSize(schemaMap, hashMap, msgdef, message.message)
+}
+
+/**
+ * Given a schema map and hash map, and a plain JavaScript object representing the message payload,
+ * return the size of the serialized message in bytes (not including the CBUF header since this is
+ * assumed to be a naked message struct).
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufMessageDefinition} msgdef
+ * @param {Record<string, unknown>} message
+ * @returns {number} The size of the serialized message in bytes
+ */
+function serializedNakedMessageSize(schemaMap, hashMap, msgdef, message) {
+  let size = 0
+  for (const field of msgdef.definitions) {
+    const value = message[field.name]
+
+    if (field.isArray === true) {
+      // Array field (fixed or variable length)
+      let arrayLength = field.arrayLength
+      if (arrayLength == undefined) {
+        arrayLength = arrayValueLength(value)
+        size += 4
+      }
+
+      switch (field.type) {
+        case "bool":
+        case "uint8":
+        case "int8":
+          size += arrayLength
+          break
+        case "uint16":
+        case "int16":
+          size += arrayLength * 2
+          break
+        case "uint32":
+        case "int32":
+        case "float32":
+          size += arrayLength * 4
+          break
+        case "uint64":
+        case "int64":
+        case "float64":
+          size += arrayLength * 8
+          break
+        default:
+          // string array or nested struct array. Size each element individually
+          for (let i = 0; i < arrayLength; i++) {
+            size += serializedNonArrayFieldSize(schemaMap, hashMap, field, value[i])
+          }
+          break
+      }
+    } else {
+      size += serializedNonArrayFieldSize(schemaMap, hashMap, field, value)
+    }
+  }
+
+  return size
+}
+
+/**
+ * Return the serialized size in bytes of a single non-array field value.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {MessageDefinitionField} field
+ * @param {unknown} value
+ * @returns {number}
+ */
+function serializedNonArrayFieldSize(schemaMap, hashMap, field, value) {
+  if (field.isComplex === true) {
+    // Look up the nested message definition
+    const nestedMsgdef = schemaMap.get(field.type)
+    if (!nestedMsgdef) {
+      throw new Error(`Nested message type ${field.type} not found in schema map`)
+    }
+
+    const headerSize = nestedMsgdef.naked !== true ? HEADER_SIZE : 0
+    return headerSize + serializedNakedMessageSize(schemaMap, hashMap, nestedMsgdef, value)
+  }
+
+  switch (field.type) {
+    case "bool":
+    case "uint8":
+    case "int8":
+      return 1
+    case "uint16":
+    case "int16":
+      return 2
+    case "uint32":
+    case "int32":
+    case "float32":
+      return 4
+    case "uint64":
+    case "int64":
+    case "float64":
+      return 8
+    case "string": {
+      if (field.upperBound != undefined) {
+        return field.upperBound
+      }
+      return 4 + (typeof value === "string" ? utf8ByteLength(value) : 0)
+    }
+    default:
+      throw new Error(`Unsupported type ${field.type}`)
+  }
+}
+
+/**
+ * Given a schema map and hash map, and a `CbufMessage` object, serialize the message into a byte
+ * buffer.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap A map of fully qualified message names to
+ *   message definitions obtained from `parseCBufSchema()`.
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap A map of hash values to message definitions
+ *   obtained from `schemaMapToHashMap()`.
+ * @param {CbufMessage} message The message to serialize.
+ * @returns {ArrayBuffer} A byte buffer containing the serialized message.
+ */
+function serializeMessage(schemaMap, hashMap, message) {
+  // Determine the total message size
+  const size = serializedMessageSize(schemaMap, hashMap, message)
+  const buffer = new ArrayBuffer(size)
+  writeMessage(schemaMap, hashMap, message, size, new DataView(buffer), 0)
+  return buffer
+}
+
+/**
+ * Given a schema map and hash map, and a `CbufMessage` object, serialize the message into a
+ * caller-provided buffer at the given offset. This avoids allocating a new `ArrayBuffer` per
+ * message when building large logs.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap A map of fully qualified message names to
+ *   message definitions obtained from `parseCBufSchema()`.
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap A map of hash values to message definitions
+ *   obtained from `schemaMapToHashMap()`.
+ * @param {CbufMessage} message The message to serialize.
+ * @param {ArrayBufferView} data The byte buffer to serialize into.
+ * @param {number | undefined} offset Optional byte offset into the buffer to serialize to.
+ * @returns {number} The number of bytes written, including the CBUF header.
+ */
+function serializeMessageInto(schemaMap, hashMap, message, data, offset) {
+  const curOffset = offset || 0
+  const size = serializedMessageSize(schemaMap, hashMap, message)
+  const view =
+    data instanceof DataView ? data : new DataView(data.buffer, data.byteOffset, data.byteLength)
+  if (curOffset < 0 || curOffset + size > view.byteLength) {
+    throw new Error(
+      `Message of ${size} bytes does not fit at offset ${curOffset} in buffer of length ${view.byteLength}`,
+    )
+  }
+
+  writeMessage(schemaMap, hashMap, message, size, view, curOffset)
+  return size
+}
+
+/**
+ * Given a schema map and hash map, and a list of `CbufMessage` objects, serialize all messages back
+ * to back into contiguous memory that can be appended directly to a `.cb` file. All message sizes
+ * are computed up front so the output is allocated once.
+ *
+ * Without options, a single `ArrayBuffer` holding every message is returned. When
+ * `options.chunkSize` is set, messages are instead packed into a rolling set of fixed-size chunks
+ * and a list of `Uint8Array`s covering the filled portion of each chunk is returned. A message is
+ * never split across chunks; a message larger than `chunkSize` gets a chunk of its own. When
+ * `options.region` is set, the messages are written into memory allocated from that
+ * `CbufOutputRegion` and a `Uint8Array` view of them is returned.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap A map of fully qualified message names to
+ *   message definitions obtained from `parseCBufSchema()`.
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap A map of hash values to message definitions
+ *   obtained from `schemaMapToHashMap()`.
+ * @param {CbufMessage[]} messages The messages to serialize, in output order.
+ * @param {{ chunkSize?: number; region?: CbufOutputRegion } | undefined} options
+ * @returns {ArrayBuffer | Uint8Array | Uint8Array[]} The serialized messages.
+ */
+function serializeMessages(schemaMap, hashMap, messages, options) {
+  const chunkSize = options?.chunkSize
+  const region = options?.region
+  if (region != undefined && chunkSize != undefined) {
+    throw new Error(`chunkSize and region cannot be combined`)
+  }
+  const span = tracer?.begin("serializeMessages", { messages: messages.length })
+
+  const sizes = new Array(messages.length)
+  let totalSize = 0
+  for (let i = 0; i < messages.length; i++) {
+    sizes[i] = serializedMessageSize(schemaMap, hashMap, messages[i])
+    totalSize += sizes[i]
+  }
+
+  if (chunkSize == undefined) {
+    const output = region != undefined ? region.allocate(totalSize) : undefined
+    const buffer = output != undefined ? output.buffer : new ArrayBuffer(totalSize)
+    const view = new DataView(buffer, output?.byteOffset ?? 0, totalSize)
+    let offset = 0
+    for (let i = 0; i < messages.length; i++) {
+      writeMessage(schemaMap, hashMap, messages[i], sizes[i], view, offset)
+      offset += sizes[i]
+    }
+    span?.tracer.end(span, { bytes: totalSize })
+    return output ?? buffer
+  }
+
+  if (!(chunkSize > 0)) {
+    throw new Error(`Invalid chunkSize ${chunkSize}`)
+  }
+
+  const chunks = []
+  let view
+  let used = 0
+  for (let i = 0; i < messages.length; i++) {
+    const size = sizes[i]
+    if (view == undefined || used + size > view.byteLength) {
+      if (view != undefined) {
+        chunks.push(new Uint8Array(view.buffer, 0, used))
+      }
+      view = new DataView(new ArrayBuffer(Math.max(chunkSize, size)))
+      used = 0
+    }
+    writeMessage(schemaMap, hashMap, messages[i], size, view, used)
+    used += size
+  }
+  if (view != undefined) {
+    chunks.push(new Uint8Array(view.buffer, 0, used))
+  }
+  span?.tracer.end(span, { bytes: totalSize, chunks: chunks.length })
+  return chunks
+}
+
+/**
+ * Write a message header and message data into a DataView at the given offset. The caller is
+ * responsible for computing `size` with `serializedMessageSize()` and ensuring it fits.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufMessage} message
+ * @param {number} size The total serialized size of the message, including the CBUF header
+ * @param {DataView} view
+ * @param {number} offset
+ */
+function writeMessage(schemaMap, hashMap, message, size, view, offset) {
+  const msgdef = messageDefinitionFor(hashMap, message)
+  writeHeader(view, offset, size, message.hashValue, message.timestamp, message.variant)
+  serializeNakedMessage(schemaMap, hashMap, msgdef, message.message, view, offset + HEADER_SIZE)
+}
+
+/**
+ * Write a CBUF message header into a DataView at the given offset.
+ *
+ * @param {DataView} view
+ * @param {number} offset
+ * @param {number} size The total serialized size of the message, including the CBUF header
+ * @param {bigint} hashValue
+ * @param {number} timestamp
+ * @param {number | undefined} variant
+ */
+function writeHeader(view, offset, size, hashValue, timestamp, variant) {
+  let curOffset = offset
+
+  // CBuf layout for a non-naked struct:
+  //   CBUF_MAGIC (4 bytes) 0x56444e54
+  //   size uint32_t (4 bytes)
+  //   hashValue uint64_t (8 bytes)
+  //   timestamp double (8 bytes)
+  //   message data
+
+  // CBUF_MAGIC
+  view.setUint32(curOffset, 0x56444e54, true)
+  curOffset += 4
+
+  // size and variant. The top bit flags the presence of a variant in the next 4 bits
+  const hasVariant = variant != undefined && variant !== 0
+  const sizeAndVariant = hasVariant ? (0x80000000 | (variant << 27) | size) >>> 0 : size
+  view.setUint32(curOffset, sizeAndVariant, true)
+  curOffset += 4
+
+  // hashValue
+  view.setBigUint64(curOffset, hashValue, true)
+  curOffset += 8
+
+  // timestamp
+  view.setFloat64(curOffset, timestamp, true)
+}
+
+/**
+ * Serialize a single naked struct message into the given DataView at the given offset.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {CbufMessageDefinition} msgdef The message definition for the message to serialize
+ * @param {Record<string, unknown>} message The message payload to serialize
+ * @param {DataView} view The DataView to write to
+ * @param {number} offset The byte offset into the DataView to write to
+ * @returns {number} The number of bytes written to the DataView
+ */
+function serializeNakedMessage(schemaMap, hashMap, msgdef, message, view, offset) {
+  let innerOffset = 0
+  for (const field of msgdef.definitions) {
+    const value = message[field.name]
+
+    if (field.isArray === true) {
+      // Array field (fixed or variable length)
+      let arrayLength = field.arrayLength
+      if (arrayLength == undefined) {
+        arrayLength = arrayValueLength(value)
+        view.setUint32(offset + innerOffset, arrayLength, true)
+        innerOffset += 4
+      }
+
+      // Numeric arrays that are already typed arrays are written in bulk
+      const TypedArrayConstructor = TYPED_ARRAY_TYPES[field.type]
+      if (
+        TypedArrayConstructor != undefined &&
+        ArrayBuffer.isView(value) &&
+        value.length >= arrayLength &&
+        writeTypedArray(TypedArrayConstructor, value, arrayLength, view, offset + innerOffset)
+      ) {
+        innerOffset += arrayLength * TypedArrayConstructor.BYTES_PER_ELEMENT
+        continue
+      }
+
+      for (let i = 0; i < arrayLength; i++) {
+        innerOffset += serializeNonArrayField(
+          schemaMap,
+          hashMap,
+          field,
+          value[i],
+          view,
+          offset + innerOffset,
+        )
+      }
+    } else {
+      innerOffset += serializeNonArrayField(
+        schemaMap,
+        hashMap,
+        field,
+        value,
+        view,
+        offset + innerOffset,
+      )
+    }
+  }
+
+  return innerOffset
+}
+
+/**
+ * Return the number of elements in an array field value, which may be a plain array or a typed
+ * array. Missing values serialize as empty arrays.
+ *
+ * @param {unknown} value
+ * @returns {number}
+ */
+function arrayValueLength(value) {
+  return Array.isArray(value) || ArrayBuffer.isView(value) ? value.length : 0
+}
+
+/**
+ * Write the first `arrayLength` elements of a typed array into the given DataView as a contiguous
+ * run of little-endian `TypedArrayConstructor` elements. A typed array of the matching element type
+ * is copied with a single `Uint8Array.set`. Other typed arrays (for example a `Float64Array`
+ * feeding a `float32[]` field) are converted by the engine's native `TypedArray.set`.
+ *
+ * @param {TypedArrayConstructor} TypedArrayConstructor The element type of the field
+ * @param {ArrayBufferView} value The typed array to write
+ * @param {number} arrayLength The number of elements to write
+ * @param {DataView} view The DataView to write to
+ * @param {number} offset The byte offset into the DataView to write to
+ * @returns {boolean} True if the array was written, false if the caller must fall back to writing
+ *   each element individually
+ */
+function writeTypedArray(TypedArrayConstructor, value, arrayLength, view, offset) {
+  // DataView has no element type and BigInt arrays cannot be converted to or from number arrays
+  if (value instanceof DataView || isBigIntArray(value) !== isBigIntArray(TypedArrayConstructor)) {
+    return false
+  }
+  // Typed arrays use host byte order while cbuf is always little-endian
+  if (!IS_LITTLE_ENDIAN) {
+    return false
+  }
+
+  const byteLength = arrayLength * TypedArrayConstructor.BYTES_PER_ELEMENT
+  const bufferOffset = view.byteOffset + offset
+  const dst = new Uint8Array(view.buffer, bufferOffset, byteLength)
+
+  if (value.BYTES_PER_ELEMENT === TypedArrayConstructor.BYTES_PER_ELEMENT) {
+    const sameType =
+      value instanceof TypedArrayConstructor ||
+      (TypedArrayConstructor === Uint8Array && value instanceof Uint8ClampedArray)
+    if (sameType) {
+      dst.set(new Uint8Array(value.buffer, value.byteOffset, byteLength))
+      return true
+    }
+  }
+
+  const src = value.length === arrayLength ? value : value.subarray(0, arrayLength)
+  if (bufferOffset % TypedArrayConstructor.BYTES_PER_ELEMENT === 0) {
+    // Convert directly into the output buffer
+    new TypedArrayConstructor(view.buffer, bufferOffset, arrayLength).set(src)
+  } else {
+    // Convert into an aligned scratch array, then copy the bytes to the unaligned destination
+    const converted = new TypedArrayConstructor(arrayLength)
+    converted.set(src)
+    dst.set(new Uint8Array(converted.buffer))
+  }
+  return true
+}
+
+/**
+ * @param {ArrayBufferView | TypedArrayConstructor} value A typed array or typed array constructor
+ * @returns {boolean} True if the typed array holds BigInt elements
+ */
+function isBigIntArray(value) {
+  const TypedArrayConstructor = typeof value === "function" ? value : value.constructor
+  return (
+    TypedArrayConstructor === TYPED_ARRAY_TYPES.int64 ||
+    TypedArrayConstructor === TYPED_ARRAY_TYPES.uint64
+  )
+}
+
+/**
+ * Serialize a single non-array field into the given DataView at the given offset.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap
+ * @param {MessageDefinitionField} field
+ * @param {unknown} value
+ * @param {DataView} view
+ * @param {number} curOffset
+ * @returns {number}
+ */
+function serializeNonArrayField(schemaMap, hashMap, field, value, view, curOffset) {
+  let innerOffset = 0
+
+  if (field.isComplex === true) {
+    // Look up the nested message definition
+    const nestedMsgdef = schemaMap.get(field.type)
+    if (!nestedMsgdef) {
+      throw new Error(`Nested message type ${field.type} not found in schema map`)
+    }
+
+    if (nestedMsgdef.naked !== true) {
+      const nestedSize = serializedNakedMessageSize(schemaMap, hashMap, nestedMsgdef, value)
+
+      view.setUint32(curOffset + innerOffset, 0x56444e54, true)
+      innerOffset += 4
+      view.setUint32(curOffset + innerOffset, HEADER_SIZE + nestedSize, true)
+      innerOffset += 4
+      view.setBigUint64(curOffset + innerOffset, nestedMsgdef.hashValue, true)
+      innerOffset += 8
+      view.setFloat64(curOffset + innerOffset, 0.0, true)
+      innerOffset += 8
+    }
+
+    innerOffset += serializeNakedMessage(
+      schemaMap,
+      hashMap,
+      nestedMsgdef,
+      value,
+      view,
+      curOffset + innerOffset,
+    )
+  } else {
+    switch (field.type) {
+      case "bool":
+      case "uint8":
+        view.setUint8(curOffset + innerOffset, value)
+        innerOffset += 1
+        break
+      case "int8":
+        view.setInt8(curOffset + innerOffset, value)
+        innerOffset += 1
+        break
+      case "uint16":
+        view.setUint16(curOffset + innerOffset, value, true)
+        innerOffset += 2
+        break
+      case "int16":
+        view.setInt16(curOffset + innerOffset, value, true)
+        innerOffset += 2
+        break
+      case "uint32":
+        view.setUint32(curOffset + innerOffset, value, true)
+        innerOffset += 4
+        break
+      case "int32":
+        view.setInt32(curOffset + innerOffset, value, true)
+        innerOffset += 4
+        break
+      case "float32":
+        view.setFloat32(curOffset + innerOffset, value, true)
+        innerOffset += 4
+        break
+      case "uint64":
+        view.setBigUint64(curOffset + innerOffset, value, true)
+        innerOffset += 8
+        break
+      case "int64":
+        view.setBigInt64(curOffset + innerOffset, value, true)
+        innerOffset += 8
+        break
+      case "float64":
+        view.setFloat64(curOffset + innerOffset, value, true)
+        innerOffset += 8
+        break
+      case "string": {
+        let length = field.upperBound
+        if (length == undefined) {
+          length = typeof value === "string" ? utf8ByteLength(value) : 0
+          view.setUint32(curOffset + innerOffset, length, true)
+          innerOffset += 4
+        }
+        const written = value ? encodeString(value, view, curOffset + innerOffset, length) : 0
+        // A fixed-size string is padded with zeros, since the buffer may hold earlier data
+        zeroFill(view, curOffset + innerOffset + written, length - written)
+        innerOffset += length
+        break
+      }
+      default:
+        throw new Error(`Unsupported type ${field.type}`)
+    }
+  }
+
+  return innerOffset
+}
+
+/**
+ * Given a schema map and hash map, and a batch of column-oriented message data, serialize `count`
+ * complete messages of a single type back to back into one byte buffer. This avoids building a
+ * JavaScript object per message when data is already held as one typed array per field.
+ *
+ * Columns are keyed by field name, with nested struct fields keyed by their dotted path (e.g.
+ * `header.seq`). Each column holds the values for all rows:
+ * - Scalar fields: an array or typed array with one value per row.
+ * - Fixed-length arrays: an array or typed array of `count * arrayLength` values in row order.
+ * - Dynamic and compact arrays: `{ values, offsets }` where the elements of row `i` are
+ *   `values[offsets[i]]` up to (not including) `values[offsets[i + 1]]`.
+ * - Strings: an array of strings, or `{ bytes, offsets }` holding UTF-8 bytes in the same layout
+ *   as dynamic arrays.
+ *
+ * Arrays of strings and arrays of structs are not supported by the columnar encoder. A column
+ * holding fewer than `count` rows throws.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap A map of fully qualified message names to
+ *   message definitions obtained from `parseCBufSchema()`.
+ * @param {Map<bigint, CbufMessageDefinition>} hashMap A map of hash values to message definitions
+ *   obtained from `schemaMapToHashMap()`.
+ * @param {{
+ *   typeName: string;
+ *   count: number;
+ *   timestamps: ArrayLike<number>;
+ *   variants?: ArrayLike<number>;
+ *   columns: Record<string, unknown>;
+ * }} batch The message type, row count, per-row header values, and field columns.
+ * @param {{ region?: CbufOutputRegion } | undefined} options `region` writes the messages into
+ *   memory allocated from a `CbufOutputRegion` and returns a `Uint8Array` view of them.
+ * @returns {ArrayBuffer | Uint8Array} A byte buffer containing all serialized messages.
+ */
+function serializeColumns(schemaMap, hashMap, batch, options) {
+  const { typeName, count, timestamps, variants, columns } = batch
+  const msgdef =
+    typeName === METADATA_DEFINITION.name ? METADATA_DEFINITION : schemaMap.get(typeName)
+  if (!msgdef) {
+    throw new Error(`Message type ${typeName} not found in schema map`)
+  }
+  if (msgdef.naked === true) {
+    throw new Error(`Naked struct ${typeName} cannot be serialized as a message`)
+  }
+  if (timestamps.length < count) {
+    throw new Error(`Expected ${count} timestamps, got ${timestamps.length}`)
+  }
+
+  const span = tracer?.begin("serializeColumns", { type: typeName, messages: count })
+  const plan = columnarPlan(schemaMap, msgdef, columns, "", count)
+
+  // Size every row up front. Rows of a struct without variable-length fields all share one size
+  let sizes
+  let totalSize = 0
+  if (plan.constantSize != undefined) {
+    totalSize = count * (HEADER_SIZE + plan.constantSize)
+  } else {
+    sizes = new Uint32Array(count)
+    for (let row = 0; row < count; row++) {
+      sizes[row] = HEADER_SIZE + columnarRowSize(plan, row)
+      totalSize += sizes[row]
+    }
+  }
+
+  const output = options?.region != undefined ? options.region.allocate(totalSize) : undefined
+  const buffer = output != undefined ? output.buffer : new ArrayBuffer(totalSize)
+  const view = new DataView(buffer, output?.byteOffset ?? 0, totalSize)
+  let offset = 0
+  for (let row = 0; row < count; row++) {
+    const size = sizes != undefined ? sizes[row] : HEADER_SIZE + plan.constantSize
+    const variant = variants != undefined ? variants[row] : undefined
+    writeHeader(view, offset, size, msgdef.hashValue, timestamps[row], variant)
+    writeColumnarRow(plan, row, view, offset + HEADER_SIZE)
+    offset += size
+  }
+
+  span?.tracer.end(span, { bytes: totalSize })
+  return output ?? buffer
+}
+
+/**
+ * Precompute the wire layout of a struct for columnar encoding. Each field becomes a step that
+ * knows its column, element type and fixed size, so encoding a row does no schema lookups.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {CbufMessageDefinition} msgdef
+ * @param {Record<string, unknown>} columns
+ * @param {string} prefix The dotted path of the struct, including a trailing `.`
+ * @param {number} count The number of rows
+ * @returns {{ fixedSize: number; constantSize: number | undefined; steps: object[] }}
+ */
+function columnarPlan(schemaMap, msgdef, columns, prefix, count) {
+  const plan = { fixedSize: 0, constantSize: undefined, steps: [] }
+  let variable = false
+
+  for (const field of msgdef.definitions) {
+    const path = prefix + field.name
+
+    if (field.isComplex === true) {
+      if (field.isArray === true) {
+        throw new Error(`Struct array field ${path} is not supported by the columnar encoder`)
+      }
+      const nestedMsgdef = schemaMap.get(field.type)
+      if (!nestedMsgdef) {
+        throw new Error(`Nested message type ${field.type} not found in schema map`)
+      }
+      const child = columnarPlan(schemaMap, nestedMsgdef, columns, path + ".", count)
+      const naked = nestedMsgdef.naked === true
+      plan.steps.push({ kind: "struct", child, naked, hashValue: nestedMsgdef.hashValue })
+      plan.fixedSize += naked ? 0 : HEADER_SIZE
+      variable = variable || child.constantSize == undefined
+      continue
+    }
+
+    const column = columns[path]
+    if (column == undefined) {
+      throw new Error(`Missing column for field ${path}`)
+    }
+
+    if (field.type === "string") {
+      if (field.isArray === true) {
+        throw new Error(`String array field ${path} is not supported by the columnar encoder`)
+      }
+      const step = { kind: "string", upperBound: field.upperBound, column, lengths: undefined }
+      if (Array.isArray(column)) {
+        checkColumnLength(path, column, count)
+        // Measure each string once; the byte length is needed for both sizing and writing
+        step.lengths = new Uint32Array(count)
+        for (let row = 0; row < count; row++) {
+          const value = column[row]
+          step.lengths[row] = typeof value === "string" ? utf8ByteLength(value) : 0
+        }
+      } else {
+        checkOffsetsColumn(path, column.bytes, column.offsets, count)
+      }
+      plan.steps.push(step)
+      if (field.upperBound != undefined) {
+        plan.fixedSize += field.upperBound
+      } else {
+        plan.fixedSize += 4
+        variable = true
+      }
+      continue
+    }
+
+    const TypedArrayConstructor = TYPED_ARRAY_TYPES[field.type]
+    if (TypedArrayConstructor == undefined) {
+      throw new Error(`Unsupported type ${field.type}`)
+    }
+    const elementSize = TypedArrayConstructor.BYTES_PER_ELEMENT
+    const setter = DATAVIEW_SETTERS[field.type]
+
+    if (field.isArray !== true) {
+      checkColumnLength(path, column, count)
+      plan.steps.push({ kind: "scalar", column, setter, elementSize })
+      plan.fixedSize += elementSize
+    } else if (field.arrayLength != undefined) {
+      const length = field.arrayLength
+      checkColumnLength(path, column, count * length)
+      plan.steps.push({ kind: "fixedArray", column, length, setter, TypedArrayConstructor })
+      plan.fixedSize += length * elementSize
+    } else {
+      if (column.values == undefined || column.offsets == undefined) {
+        throw new Error(`Column for dynamic array field ${path} must have values and offsets`)
+      }
+      checkOffsetsColumn(path, column.values, column.offsets, count)
+      plan.steps.push({ kind: "dynamicArray", column, setter, TypedArrayConstructor })
+      plan.fixedSize += 4
+      variable = true
+    }
+  }
+
+  if (!variable) {
+    plan.constantSize = plan.fixedSize
+    for (const step of plan.steps) {
+      if (step.kind === "struct") {
+        plan.constantSize += step.child.constantSize
+      }
+    }
+  }
+  return plan
+}
+
+/**
+ * Throw unless a column holds at least `length` values, so rows never read past its end.
+ *
+ * @param {string} path
+ * @param {ArrayLike<unknown>} column
+ * @param {number} length
+ */
+function checkColumnLength(path, column, length) {
+  if (!(column.length >= length)) {
+    throw new Error(`Column for field ${path} has ${column.length} values, expected ${length}`)
+  }
+}
+
+/**
+ * Throw unless a `{ values, offsets }` column has an offset for the end of every row, within
+ * `values`.
+ *
+ * @param {string} path
+ * @param {ArrayLike<unknown>} values
+ * @param {ArrayLike<number>} offsets
+ * @param {number} count
+ */
+function checkOffsetsColumn(path, values, offsets, count) {
+  if (values == undefined || offsets == undefined) {
+    throw new Error(`Column for field ${path} must have values and offsets`)
+  }
+  if (count === 0) {
+    return
+  }
+  if (offsets.length <= count) {
+    throw new Error(`Column for field ${path} has ${offsets.length} offsets, expected ${count + 1}`)
+  }
+  if (offsets[count] > values.length) {
+    throw new Error(
+      `Column for field ${path} ends at ${offsets[count]}, past its ${values.length} values`,
+    )
+  }
+}
+
+/**
+ * Return the serialized size of one row of a columnar plan, not including the CBUF header.
+ *
+ * @param {{ fixedSize: number; constantSize: number | undefined; steps: object[] }} plan
+ * @param {number} row
+ * @returns {number}
+ */
+function columnarRowSize(plan, row) {
+  if (plan.constantSize != undefined) {
+    return plan.constantSize
+  }
+
+  let size = plan.fixedSize
+  for (const step of plan.steps) {
+    switch (step.kind) {
+      case "struct":
+        size += columnarRowSize(step.child, row)
+        break
+      case "string":
+        if (step.upperBound == undefined) {
+          size += columnarStringLength(step, row)
+        }
+        break
+      case "dynamicArray": {
+        const offsets = step.column.offsets
+        size += (offsets[row + 1] - offsets[row]) * step.TypedArrayConstructor.BYTES_PER_ELEMENT
+        break
+      }
+    }
+  }
+  return size
+}
+
+/**
+ * @param {{ column: unknown; lengths: Uint32Array | undefined }} step
+ * @param {number} row
+ * @returns {number} The UTF-8 byte length of a row of a string column
+ */
+function columnarStringLength(step, row) {
+  if (step.lengths != undefined) {
+    return step.lengths[row]
+  }
+  return step.column.offsets[row + 1] - step.column.offsets[row]
+}
+
+/**
+ * Write one row of a columnar plan into a DataView at the given offset.
+ *
+ * @param {{ fixedSize: number; constantSize: number | undefined; steps: object[] }} plan
+ * @param {number} row
+ * @param {DataView} view
+ * @param {number} offset
+ * @returns {number} The number of bytes written
+ */
+function writeColumnarRow(plan, row, view, offset) {
+  let innerOffset = 0
+
+  for (const step of plan.steps) {
+    switch (step.kind) {
+      case "scalar":
+        step.setter(view, offset + innerOffset, step.column[row])
+        innerOffset += step.elementSize
+        break
+      case "fixedArray":
+        innerOffset += writeColumnarArray(
+          step,
+          step.column,
+          row * step.length,
+          step.length,
+          view,
+          offset + innerOffset,
+        )
+        break
+      case "dynamicArray": {
+        const { values, offsets } = step.column
+        const start = offsets[row]
+        const length = offsets[row + 1] - start
+        view.setUint32(offset + innerOffset, length, true)
+        innerOffset += 4
+        innerOffset += writeColumnarArray(step, values, start, length, view, offset + innerOffset)
+        break
+      }
+      case "string": {
+        let length = step.upperBound
+        if (length == undefined) {
+          length = columnarStringLength(step, row)
+          view.setUint32(offset + innerOffset, length, true)
+          innerOffset += 4
+        }
+        let written = 0
+        if (step.lengths != undefined) {
+          const value = step.column[row]
+          if (typeof value === "string") {
+            written = encodeString(value, view, offset + innerOffset, length)
+          }
+        } else {
+          const { bytes, offsets } = step.column
+          const end = Math.min(offsets[row + 1], offsets[row] + length)
+          const byteOffset = view.byteOffset + offset + innerOffset
+          new Uint8Array(view.buffer, byteOffset, length).set(bytes.subarray(offsets[row], end))
+          written = end - offsets[row]
+        }
+        // Pad fixed-size strings, since regions and chunks are reused
+        zeroFill(view, offset + innerOffset + written, length - written)
+        innerOffset += length
+        break
+      }
+      case "struct": {
+        const headerSize = step.naked ? 0 : HEADER_SIZE
+        const size = writeColumnarRow(step.child, row, view, offset + innerOffset + headerSize)
+        if (!step.naked) {
+          writeHeader(view, offset + innerOffset, headerSize + size, step.hashValue, 0.0)
+        }
+        innerOffset += headerSize + size
+        break
+      }
+    }
+  }
+
+  return innerOffset
+}
+
+/**
+ * Write `length` elements of a column starting at element `start` as a contiguous array.
+ *
+ * @param {{ setter: Function; TypedArrayConstructor: TypedArrayConstructor }} step
+ * @param {ArrayLike<unknown>} values
+ * @param {number} start
+ * @param {number} length
+ * @param {DataView} view
+ * @param {number} offset
+ * @returns {number} The number of bytes written
+ */
+function writeColumnarArray(step, values, start, length, view, offset) {
+  const elementSize = step.TypedArrayConstructor.BYTES_PER_ELEMENT
+  if (
+    ArrayBuffer.isView(values) &&
+    writeTypedArray(
+      step.TypedArrayConstructor,
+      values.subarray(start, start + length),
+      length,
+      view,
+      offset,
+    )
+  ) {
+    return length * elementSize
+  }
+
+  for (let i = 0; i < length; i++) {
+    step.setter(view, offset + i * elementSize, values[start + i])
+  }
+  return length * elementSize
+}
+
+/**
+ * A block of memory reserved once and handed out to batch outputs, so a session that knows its
+ * working set can serialize batch after batch without allocating. `allocate()` returns views
+ * that stay valid until `reset()`, which makes the whole region available again, or `free()`,
+ * which releases it.
+ */
+class CbufOutputRegion {
+  /**
+   * @param {number} capacity The size of the region in bytes
+   */
+  constructor(capacity) {
+    if (!(capacity >= 0)) {
+      throw new Error(`Invalid region capacity ${capacity}`)
+    }
+    /** @type {ArrayBuffer | undefined} */
+    this._buffer = new ArrayBuffer(capacity)
+    this._used = 0
+    this._peak = 0
+    trackMemory(this)
+  }
+
+  /** The size of the region in bytes, zero once freed */
+  get capacity() {
+    return this._buffer != undefined ? this._buffer.byteLength : 0
+  }
+
+  /** Bytes handed out since the last `reset()` */
+  get used() {
+    return this._used
+  }
+
+  /** The most bytes in use at once since the region was created */
+  get peak() {
+    return this._peak
+  }
+
+  /**
+   * Hand out `size` bytes, starting at an 8-byte aligned offset so typed arrays can be placed in
+   * them. Throws if the region does not have room.
+   *
+   * @param {number} size
+   * @returns {Uint8Array}
+   */
+  allocate(size) {
+    if (this._buffer == undefined) {
+      throw new Error(`CbufOutputRegion has been freed`)
+    }
+    const offset = (this._used + 7) & ~7
+    if (offset + size > this._buffer.byteLength) {
+      throw new Error(
+        `CbufOutputRegion of ${this._buffer.byteLength} bytes cannot fit ${size} more bytes ` +
+          `(${this._used} in use)`,
+      )
+    }
+    this._used = offset + size
+    this._peak = Math.max(this._peak, this._used)
+    return new Uint8Array(this._buffer, offset, size)
+  }
+
+  /** Make the whole region available again. Views handed out earlier will be overwritten */
+  reset() {
+    this._used = 0
+  }
+
+  /** Release the region's memory. Views handed out earlier keep it alive until dropped */
+  free() {
+    this._buffer = undefined
+    this._used = 0
+  }
+
+  _memoryUsage() {
+    return { bytes: this.capacity, used: this._used }
+  }
+}
+
+const DEFAULT_CHUNK_SIZE = 1024 * 1024
+
+/**
+ * A streaming writer for self-describing `.cb` logs. Messages are serialized into fixed-size
+ * chunks which are handed to a sink once full. The first time a message type appears, a
+ * `cbufmsg::metadata` message carrying its schema is written ahead of it so the log can be read
+ * back without any external schema.
+ *
+ * The sink can be a Node.js `Writable`, a WHATWG `WritableStream`, or a function receiving each
+ * chunk. `write()` resolves once the sink is ready to accept more data, so awaiting each write
+ * respects the sink's backpressure.
+ */
+class CbufWriter {
+  /**
+   * @param {{
+   *   schemaMap: Map<string, CbufMessageDefinition>;
+   *   hashMap: Map<bigint, CbufMessageDefinition>;
+   *   sink: unknown;
+   *   schemaText?: string | Map<string, string>;
+   *   chunkSize?: number;
+   *   flushInterval?: number;
+   *   sync?: () => unknown;
+   * }} options
+   *   - `schemaMap`, `hashMap`: The schema used to serialize messages.
+   *   - `sink`: A Node.js `Writable`, a `WritableStream`, or a function receiving each chunk.
+   *   - `schemaText`: The `.cbuf` schema text written into metadata messages, either a single
+   *     string used for every message type or a map of fully qualified message names to schema
+   *     text. Metadata messages are not written if this is omitted.
+   *   - `chunkSize`: The size in bytes of each output chunk. Defaults to 1MB.
+   *   - `flushInterval`: If set, buffered output is flushed at least this often in milliseconds,
+   *     for live recording.
+   *   - `sync`: Called after each interval flush and on close, e.g. `() => fileHandle.sync()`.
+   */
+  constructor(options) {
+    this.schemaMap = options.schemaMap
+    this.hashMap = options.hashMap
+    this.schemaText = options.schemaText
+    this.chunkSize = options.chunkSize ?? DEFAULT_CHUNK_SIZE
+    this.sync = options.sync
+    this.bytesWritten = 0
+    this.messagesWritten = 0
+
+    this._sink = openSink(options.sink)
+    this._describedHashes = new Set([METADATA_DEFINITION.hashValue])
+    this._chunk = undefined
+    this._used = 0
+    this._error = undefined
+    this._closed = false
+    this._timer = undefined
+    this._unsynced = false
+    trackMemory(this)
+
+    if (options.flushInterval != undefined) {
+      this._timer = setInterval(() => {
+        this.flush()
+          .then(() => this._syncIfNeeded())
+          .catch((err) => (this._error = err))
+      }, options.flushInterval)
+      // Do not keep a Node.js process alive just for the flush timer
+      this._timer.unref?.()
+    }
+  }
+
+  /**
+   * Serialize a message into the current chunk, preceded by a metadata message if this is the
+   * first message of its type. Resolves once the sink can accept more data.
+   *
+   * @param {CbufMessage} message
+   * @returns {Promise<void>}
+   */
+  write(message) {
+    if (this._error != undefined) {
+      return Promise.reject(this._error)
+    }
+    if (this._closed) {
+      return Promise.reject(new Error("CbufWriter is closed"))
+    }
+
+    const pending = []
+    if (message.hashValue === METADATA_DEFINITION.hashValue) {
+      // A metadata message written by hand describes its type, don't write another one
+      this._describedHashes.add(message.message.msg_hash)
+    } else if (!this._describedHashes.has(message.hashValue)) {
+      const metadata = this._metadataFor(message)
+      if (metadata != undefined) {
+        pending.push(this._append(metadata))
+      }
+      this._describedHashes.add(message.hashValue)
+    }
+    pending.push(this._append(message))
+    this.messagesWritten++
+    return Promise.all(pending).then(() => {})
+  }
+
+  /**
+   * Hand any partially filled chunk to the sink.
+   *
+   * @returns {Promise<void>}
+   */
+  flush() {
+    if (this._chunk == undefined || this._used === 0) {
+      return Promise.resolve()
+    }
+    const chunk = new Uint8Array(this._chunk.buffer, 0, this._used)
+    this._chunk = undefined
+    this._used = 0
+    this._unsynced = true
+    // The span covers the time until the sink is ready for more data
+    const span = tracer?.begin("flush", { bytes: chunk.byteLength }, "CbufWriter")
+    const written = this._sink.write(chunk)
+    return span != undefined ? written.then(() => span.tracer.end(span)) : written
+  }
+
+  /**
+   * Flush buffered output, call `sync` if set, and end the sink.
+   *
+   * @returns {Promise<void>}
+   */
+  async close() {
+    if (this._closed) {
+      return
+    }
+    this._closed = true
+    if (this._timer != undefined) {
+      clearInterval(this._timer)
+      this._timer = undefined
+    }
+    await this.flush()
+    await this._syncIfNeeded()
+    await this._sink.close()
+    if (this._error != undefined) {
+      throw this._error
+    }
+  }
+
+  /**
+   * Serialize a message into the current chunk, handing the chunk to the sink first if the
+   * message does not fit.
+   *
+   * @param {CbufMessage} message
+   * @returns {Promise<void>}
+   */
+  _append(message) {
+    const size = serializedMessageSize(this.schemaMap, this.hashMap, message)
+    let flushed = Promise.resolve()
+    if (this._chunk != undefined && this._used + size > this._chunk.byteLength) {
+      flushed = this.flush()
+    }
+    if (this._chunk == undefined) {
+      this._chunk = new DataView(new ArrayBuffer(Math.max(this.chunkSize, size)))
+      this._used = 0
+    }
+    writeMessage(this.schemaMap, this.hashMap, message, size, this._chunk, this._used)
+    this._used += size
+    this.bytesWritten += size
+    return flushed
+  }
+
+  /** @returns {{ bytes: number }} The size of the chunk currently being filled */
+  _memoryUsage() {
+    return { bytes: this._chunk?.byteLength ?? 0 }
+  }
+
+  /**
+   * Call `sync` if any chunks were handed to the sink since the last sync.
+   *
+   * @returns {Promise<void>}
+   */
+  async _syncIfNeeded() {
+    if (this.sync != undefined && this._unsynced) {
+      this._unsynced = false
+      await this.sync()
+    }
+  }
+
+  /**
+   * @param {CbufMessage} message
+   * @returns {CbufMessage | undefined} The metadata message describing the message's type
+   */
+  _metadataFor(message) {
+    const msgdef = messageDefinitionFor(this.hashMap, message)
+    const schemaText =
+      typeof this.schemaText === "string" ? this.schemaText : this.schemaText?.get(msgdef.name)
+    if (schemaText == undefined) {
+      return undefined
+    }
+    return {
+      typeName: METADATA_DEFINITION.name,
+      hashValue: METADATA_DEFINITION.hashValue,
+      timestamp: message.timestamp,
+      message: { msg_hash: msgdef.hashValue, msg_name: msgdef.name, msg_meta: schemaText },
+    }
+  }
+}
+
+/**
+ * Wrap a Node.js `Writable`, WHATWG `WritableStream`, or chunk callback in a common interface.
+ * Chunks are handed to the sink synchronously so they stay in order, and the returned promise
+ * resolves once the sink is ready for more data.
+ *
+ * @param {unknown} sink
+ * @returns {{ write: (chunk: Uint8Array) => Promise<void>; close: () => Promise<void> }}
+ */
+function openSink(sink) {
+  if (typeof sink === "function") {
+    return {
+      write: (chunk) => Promise.resolve(sink(chunk)),
+      close: () => Promise.resolve(),
+    }
+  }
+
+  if (typeof sink?.getWriter === "function") {
+    // WHATWG WritableStream
+    const writer = sink.getWriter()
+    let error
+    return {
+      write: (chunk) => {
+        writer.write(chunk).catch((err) => (error = err))
+        return writer.ready.then(() => {
+          if (error != undefined) throw error
+        })
+      },
+      close: () => writer.close(),
+    }
+  }
+
+  if (typeof sink?.write === "function" && typeof sink?.once === "function") {
+    // Node.js Writable. One listener stays attached for the life of the sink, since an 'error'
+    // event without a listener crashes the process. The error fails pending and later calls
+    let error
+    /** @type {Set<(err: Error) => void>} */
+    const waiting = new Set()
+    sink.on("error", (err) => {
+      error ??= err
+      for (const fail of waiting) fail(err)
+      waiting.clear()
+    })
+    const waitFor = (event) =>
+      new Promise((resolve, reject) => {
+        const fail = (err) => {
+          sink.off(event, onEvent)
+          reject(err)
+        }
+        const onEvent = () => {
+          waiting.delete(fail)
+          resolve()
+        }
+        sink.once(event, onEvent)
+        waiting.add(fail)
+      })
+    return {
+      write: (chunk) => {
+        if (error != undefined) return Promise.reject(error)
+        return sink.write(chunk) ? Promise.resolve() : waitFor("drain")
+      },
+      close: () => {
+        if (error != undefined) return Promise.reject(error)
+        const finished = waitFor("finish")
+        sink.end()
+        return finished
+      },
+    }
+  }
+
+  throw new Error("sink must be a Node.js Writable, a WritableStream, or a function")
+}
+
+/**
+ * Records begin/end spans, counters and per-message-type decode batches into a fixed-size ring
+ * buffer and exports them in the Chrome Trace Event format, which loads in Perfetto and
+ * chrome://tracing. Install one with `setTracer()` to trace the library; applications can record
+ * their own spans (framing scans, worker tasks) on the same tracer.
+ */
+class CbufTracer {
+  /**
+   * @param {{ capacity?: number; decodeBatchSize?: number } | undefined} options
+   *   - `capacity`: The maximum number of events kept. Older events are overwritten. Defaults to
+   *     65536.
+   *   - `decodeBatchSize`: `deserializeMessage()` calls are summarized into one event per message
+   *     type every this many messages. Defaults to 1000.
+   */
+  constructor(options) {
+    this.capacity = options?.capacity ?? 65536
+    this.decodeBatchSize = options?.decodeBatchSize ?? 1000
+    if (!(this.capacity > 0)) {
+      throw new Error(`Invalid capacity ${this.capacity}`)
+    }
+    this.clear()
+  }
+
+  /** @returns {number} The current time in microseconds */
+  now() {
+    return performance.now() * 1000
+  }
+
+  /**
+   * Start a span. Pass the returned object to `end()`.
+   *
+   * @param {string} name
+   * @param {Record<string, unknown> | undefined} args
+   * @param {string | undefined} track The name of the track (trace thread) to draw the span on
+   */
+  begin(name, args, track) {
+    return { tracer: this, name, ts: this.now(), args, track }
+  }
+
+  /**
+   * Finish a span started with `begin()`, merging in additional `args`.
+   *
+   * @param {{ name: string; ts: number; args?: Record<string, unknown>; track?: string }} span
+   * @param {Record<string, unknown> | undefined} args
+   */
+  end(span, args) {
+    const merged = args != undefined ? { ...span.args, ...args } : span.args
+    this.complete(span.name, span.ts, this.now() - span.ts, merged, span.track)
+  }
+
+  /**
+   * Record a span with a known start time and duration, both in microseconds.
+   *
+   * @param {string} name
+   * @param {number} ts
+   * @param {number} dur
+   * @param {Record<string, unknown> | undefined} args
+   * @param {string | undefined} track
+   */
+  complete(name, ts, dur, args, track) {
+    this._push({ name, ph: "X", ts, dur, pid: 1, tid: this._tid(track), args })
+  }
+
+  /**
+   * Record counter values, drawn as a stacked graph named `name`.
+   *
+   * @param {string} name
+   * @param {Record<string, number>} values
+   */
+  counter(name, values) {
+    this._push({ name, ph: "C", ts: this.now(), pid: 1, tid: 0, args: values })
+  }
+
+  /**
+   * Record a point in time.
+   *
+   * @param {string} name
+   * @param {Record<string, unknown> | undefined} args
+   * @param {string | undefined} track
+   */
+  instant(name, args, track) {
+    this._push({ name, ph: "i", s: "t", ts: this.now(), pid: 1, tid: this._tid(track), args })
+  }
+
+  /** Record partially filled decode batches as events. */
+  flush() {
+    for (const [typeName, batch] of this._decodeBatches) {
+      this._emitDecodeBatch(typeName, batch)
+    }
+    this._decodeBatches.clear()
+  }
+
+  /** @returns {number} The number of events overwritten because the ring buffer was full */
+  get dropped() {
+    return Math.max(0, this._recorded - this.capacity)
+  }
+
+  /** @returns {object[]} The recorded events, oldest first */
+  events() {
+    this.flush()
+    const count = Math.min(this._recorded, this.capacity)
+    const first = this._recorded - count
+    const events = new Array(count)
+    for (let i = 0; i < count; i++) {
+      events[i] = this._events[(first + i) % this.capacity]
+    }
+    return events
+  }
+
+  /**
+   * @returns {{ traceEvents: object[]; displayTimeUnit: string; otherData: object }} The trace in
+   *   Chrome Trace Event JSON object format, so `JSON.stringify(tracer)` produces a trace file.
+   */
+  toJSON() {
+    const events = this.events()
+    const metadata = [{ name: "process_name", ph: "M", pid: 1, tid: 0, args: { name: "cbuf" } }]
+    for (const [track, tid] of this._tracks) {
+      metadata.push({ name: "thread_name", ph: "M", pid: 1, tid, args: { name: track } })
+    }
+    return {
+      traceEvents: metadata.concat(events),
+      displayTimeUnit: "ms",
+      otherData: { droppedEvents: this.dropped },
+    }
+  }
+
+  /** Remove all recorded events. */
+  clear() {
+    this._events = new Array(this.capacity)
+    this._recorded = 0
+    this._tracks = new Map([["main", 0]])
+    this._decodeBatches = new Map()
+  }
+
+  /**
+   * Add one decoded message to its type's batch.
+   *
+   * @param {string} typeName
+   * @param {number} size
+   * @param {number} startMs The `performance.now()` time decoding started
+   */
+  _decoded(typeName, size, startMs) {
+    const dur = (performance.now() - startMs) * 1000
+    let batch = this._decodeBatches.get(typeName)
+    if (batch == undefined) {
+      batch = { ts: startMs * 1000, dur: 0, messages: 0, bytes: 0 }
+      this._decodeBatches.set(typeName, batch)
+    }
+    batch.dur += dur
+    batch.messages++
+    batch.bytes += size
+    if (batch.messages >= this.decodeBatchSize) {
+      this._emitDecodeBatch(typeName, batch)
+      this._decodeBatches.delete(typeName)
+    }
+  }
+
+  _emitDecodeBatch(typeName, batch) {
+    // The duration is the summed decode time, so batches on a track never overlap
+    const args = { type: typeName, messages: batch.messages, bytes: batch.bytes }
+    this.complete("decode", batch.ts, batch.dur, args, `decode ${typeName}`)
+  }
+
+  _push(event) {
+    this._events[this._recorded % this.capacity] = event
+    this._recorded++
+  }
+
+  _tid(track) {
+    if (track == undefined) return 0
+    let tid = this._tracks.get(track)
+    if (tid == undefined) {
+      tid = this._tracks.size
+      this._tracks.set(track, tid)
+    }
+    return tid
+  }
+}
+
+/**
+ * Install a tracer that records library activity: schema parsing and its stages, per-type
+ * `deserializeMessage()` batches, `serializeMessages()`/`serializeColumns()` exports and
+ * `CbufWriter` flushes. Pass undefined to stop tracing.
+ *
+ * @param {CbufTracer | undefined} newTracer
+ * @returns {CbufTracer | undefined} The previously installed tracer
+ */
+function setTracer(newTracer) {
+  const previous = tracer
+  tracer = newTracer
+  return previous
+}
+
+/**
+ * Accumulates decode time and bytes per message type and field path while installed with
+ * `setDecodeProfiler()`. Each field is tagged with how it is decoded, so a report points at the
+ * fields worth changing in the schema or decoder:
+ *
+ * - `scalar`: A number, bigint or boolean read from the buffer.
+ * - `zero-copy`: A typed array viewing the message buffer.
+ * - `copy`: A typed array copied out of the buffer because its data is unaligned.
+ * - `string decode`: A string, or an array of strings.
+ * - `object build`: An array of structs, built one object per element.
+ *
+ * Nested structs are attributed to their fields with dotted paths. Profiling times every field,
+ * which slows decoding, and bypasses compiled decoders.
+ */
+class CbufDecodeProfiler {
+  constructor() {
+    this.clear()
+  }
+
+  /** Remove all accumulated timings. */
+  clear() {
+    /** @type {Map<string, { messages: number; bytes: number; ms: number; fields: Map }>} */
+    this._types = new Map()
+    // Field timings of the message being decoded, by path
+    this._pending = new Map()
+    this._active = false
+  }
+
+  /**
+   * @returns {Array<{
+   *   typeName: string;
+   *   messages: number;
+   *   bytes: number;
+   *   ms: number; // Total decode time, including headers and object allocation
+   *   fields: Array<{
+   *     path: string;
+   *     strategy: string;
+   *     count: number; // Times the field was decoded
+   *     bytes: number;
+   *     ms: number;
+   *     share: number; // Fraction of the type's decode time
+   *   }>;
+   * }>} Per-type timings, slowest type first, each with its fields slowest first
+   */
+  report() {
+    const report = []
+    for (const [typeName, type] of this._types) {
+      const fields = []
+      for (const [path, field] of type.fields) {
+        const share = type.ms > 0 ? field.ms / type.ms : 0
+        fields.push({ path, ...field, share })
+      }
+      fields.sort((a, b) => b.ms - a.ms)
+      report.push({ typeName, messages: type.messages, bytes: type.bytes, ms: type.ms, fields })
+    }
+    return report.sort((a, b) => b.ms - a.ms)
+  }
+
+  /**
+   * @param {number | undefined} maxFields The most fields listed per type. Defaults to 10.
+   * @returns {string} `report()` as a plain text table
+   */
+  format(maxFields) {
+    const lines = []
+    for (const type of this.report()) {
+      const perMessage = type.messages > 0 ? (type.ms * 1000) / type.messages : 0
+      lines.push(
+        `${type.typeName}: ${type.messages} messages, ${type.bytes} bytes, ` +
+          `${type.ms.toFixed(3)} ms (${perMessage.toFixed(2)} us/message)`,
+      )
+      for (const field of type.fields.slice(0, maxFields ?? 10)) {
+        const share = `${(field.share * 100).toFixed(1)}%`.padStart(6)
+        const ms = `${field.ms.toFixed(3)} ms`.padStart(12)
+        lines.push(`  ${share} ${ms}  ${field.strategy.padEnd(13)}  ${field.path}`)
+      }
+    }
+    return lines.join("\n")
+  }
+
+  /**
+   * Decode a message body field by field, timing each field. Mirrors `deserializeNakedMessage()`.
+   *
+   * @param {Map<string, CbufMessageDefinition>} schemaMap
+   * @param {Map<bigint, CbufMessageDefinition>} hashMap
+   * @param {CbufMessageDefinition} msgdef
+   * @param {DataView} view
+   * @param {number} offset
+   * @param {Record<string, unknown>} output
+   * @param {{ stringCache?: StringCache } | undefined} options
+   * @returns {number} The number of bytes consumed from the buffer
+   */
+  _decode(schemaMap, hashMap, msgdef, view, offset, output, options) {
+    const start = performance.now()
+    this._pending.clear()
+    const size = this._decodeFields(schemaMap, hashMap, msgdef, "", view, offset, output, options)
+    let type = this._types.get(msgdef.name)
+    if (type == undefined) {
+      type = { messages: 0, bytes: 0, ms: 0, fields: new Map() }
+      this._types.set(msgdef.name, type)
+    }
+    // Fields are recorded under the top-level type once it is known
+    for (const [path, field] of this._pending) {
+      const total = type.fields.get(path)
+      if (total == undefined) {
+        type.fields.set(path, field)
+      } else {
+        total.count += field.count
+        total.bytes += field.bytes
+        total.ms += field.ms
+      }
+    }
+    this._pending.clear()
+    type.messages++
+    type.bytes += HEADER_SIZE + size
+    type.ms += performance.now() - start
+    return size
+  }
+
+  /**
+   * Decode the fields of a struct body into `output`, recording each under its dotted path.
+   * Nested structs are decoded through their own fields.
+   *
+   * @param {Map<string, CbufMessageDefinition>} schemaMap
+   * @param {Map<bigint, CbufMessageDefinition>} hashMap
+   * @param {CbufMessageDefinition} msgdef
+   * @param {string} prefix The dotted path of the struct, including a trailing `.`
+   * @param {DataView} view
+   * @param {number} offset
+   * @param {Record<string, unknown>} output
+   * @param {{ stringCache?: StringCache } | undefined} options
+   * @returns {number} The number of bytes consumed from the buffer
+   */
+  _decodeFields(schemaMap, hashMap, msgdef, prefix, view, offset, output, options) {
+    let innerOffset = 0
+    for (const field of msgdef.definitions) {
+      const path = prefix + field.name
+      const curOffset = offset + innerOffset
+
+      if (field.isComplex === true && field.isArray !== true) {
+        const nestedMsgdef = schemaMap.get(field.type)
+        if (!nestedMsgdef) {
+          throw new Error(`Nested message type ${field.type} not found in schema map`)
+        }
+        const nestedMessage = {}
+        if (nestedMsgdef.naked === true) {
+          innerOffset += this._decodeFields(
+            schemaMap,
+            hashMap,
+            nestedMsgdef,
+            path + ".",
+            view,
+            curOffset,
+            nestedMessage,
+            options,
+          )
+        } else {
+          const nestedSize = nestedMessageSize(view, curOffset, nestedMsgdef.hashValue)
+          const decoded = this._decodeFields(
+            schemaMap,
+            hashMap,
+            nestedMsgdef,
+            path + ".",
+            view,
+            curOffset + HEADER_SIZE,
+            nestedMessage,
+            options,
+          )
+          checkDecodedSize(nestedSize, HEADER_SIZE + decoded)
+          innerOffset += nestedSize
+        }
+        output[field.name] = nestedMessage
+        continue
+      }
+
+      const strategy = decodeStrategy(field, view, curOffset)
+      const start = performance.now()
+      // Nested `deserializeMessage()` calls for struct array elements are part of this field
+      this._active = true
+      let size
+      try {
+        size = deserializeNakedMessage(
+          schemaMap,
+          hashMap,
+          singleFieldDefinition(field),
+          view,
+          curOffset,
+          output,
+          options,
+        )
+      } finally {
+        this._active = false
+      }
+      const ms = performance.now() - start
+      innerOffset += size
+
+      const pending = this._pending.get(path)
+      if (pending == undefined) {
+        this._pending.set(path, { strategy, count: 1, bytes: size, ms })
+      } else {
+        pending.count++
+        pending.bytes += size
+        pending.ms += ms
+      }
+    }
+    return innerOffset
+  }
+}
+
+// One-field definitions for decoding a field on its own with `deserializeNakedMessage()`
+const singleFieldDefinitions = new WeakMap()
+
+/**
+ * @param {MessageDefinitionField} field
+ * @returns {{ definitions: MessageDefinitionField[] }}
+ */
+function singleFieldDefinition(field) {
+  let msgdef = singleFieldDefinitions.get(field)
+  if (msgdef == undefined) {
+    msgdef = { definitions: [field] }
+    singleFieldDefinitions.set(field, msgdef)
+  }
+  return msgdef
+}
+
+/**
+ * @param {MessageDefinitionField} field A field that is not a nested struct
+ * @param {DataView} view
+ * @param {number} offset The offset of the field in `view`
+ * @returns {string} How the generic decoder decodes the field at `offset`
+ */
+function decodeStrategy(field, view, offset) {
+  if (field.isComplex === true) {
+    return "object build"
+  }
+  if (field.type === "string") {
+    return "string decode"
+  }
+  if (field.isArray !== true) {
+    return "scalar"
+  }
+  const TypedArrayConstructor = TYPED_ARRAY_TYPES[field.type]
+  const dataOffset = view.byteOffset + offset + (field.arrayLength == undefined ? 4 : 0)
+  return dataOffset % TypedArrayConstructor.BYTES_PER_ELEMENT === 0 ? "zero-copy" : "copy"
+}
+
+/**
+ * Install a profiler that attributes `deserializeMessage()` time to message fields. Pass undefined
+ * to stop profiling.
+ *
+ * @param {CbufDecodeProfiler | undefined} newProfiler
+ * @returns {CbufDecodeProfiler | undefined} The previously installed profiler
+ */
+function setDecodeProfiler(newProfiler) {
+  const previous = profiler
+  profiler = newProfiler
+  return previous
+}
+
+/** The bootstrapped snapshot definitions, built on first use */
+let snapshotSchema
+
+function snapshotMaps() {
+  if (snapshotSchema == undefined) {
+    const schemaMap = new Map()
+    for (const definition of [
+      SNAPSHOT_FIELD_DEFINITION,
+      SNAPSHOT_STRUCT_DEFINITION,
+      SNAPSHOT_DEFINITION,
+    ]) {
+      schemaMap.set(definition.name, definition)
+    }
+    snapshotSchema = { schemaMap, hashMap: schemaMapToHashMap(schemaMap) }
+  }
+  return snapshotSchema
+}
+
+/**
+ * Write a parsed schema as a compact binary snapshot, so consumers that only decode and encode
+ * messages can load it with `deserializeSchemaSnapshot()` instead of parsing `.cbuf` text with the
+ * wasm schema compiler. The snapshot is itself a cbuf message.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap A parsed schema from `parseCBufSchema()`
+ * @returns {Uint8Array}
+ */
+function serializeSchemaSnapshot(schemaMap) {
+  const structs = []
+  for (const definition of schemaMap.values()) {
+    structs.push({
+      name: definition.name,
+      hashValue: definition.hashValue,
+      line: definition.line ?? 0,
+      column: definition.column ?? 0,
+      naked: definition.naked === true,
+      definitions: definition.definitions.map((field) => ({
+        name: field.name,
+        type: field.type,
+        isComplex: field.isComplex === true,
+        isArray: field.isArray === true,
+        arrayLength: field.arrayLength ?? -1,
+        arrayUpperBound: field.arrayUpperBound ?? -1,
+        upperBound: field.upperBound ?? -1,
+        // JSON so an empty string default survives, with 64-bit defaults as decimal strings and
+        // non-finite floats as "Infinity", "-Infinity" or "NaN", as in the C ABI's JSON
+        defaultValue:
+          field.defaultValue === undefined
+            ? ""
+            : JSON.stringify(field.defaultValue, (_key, value) =>
+                typeof value === "bigint" || (typeof value === "number" && !isFinite(value))
+                  ? String(value)
+                  : value,
+              ),
+      })),
+    })
+  }
+
+  const { schemaMap: snapshotSchemaMap, hashMap } = snapshotMaps()
+  const message = {
+    typeName: SNAPSHOT_DEFINITION.name,
+    hashValue: SNAPSHOT_DEFINITION.hashValue,
+    timestamp: 0,
+    message: { version: SNAPSHOT_VERSION, structs },
+  }
+  return new Uint8Array(serializeMessage(snapshotSchemaMap, hashMap, message))
+}
+
+/**
+ * Restore a default value, or one element of an array default, from its snapshot JSON.
+ *
+ * @param {string} type The field's element type
+ * @param {unknown} value
+ * @returns {unknown}
+ */
+function snapshotDefault(type, value) {
+  if (typeof value !== "string") return value
+  if (type === "int64" || type === "uint64") return BigInt(value)
+  if (type === "float32" || type === "float64") return Number(value)
+  return value
+}
+
+/**
+ * Read a schema snapshot written by `serializeSchemaSnapshot()`.
+ *
+ * @param {ArrayBufferView} data
+ * @returns {Map<string, CbufMessageDefinition>} The same schema `parseCBufSchema()` returned
+ */
+function deserializeSchemaSnapshot(data) {
+  const bytes = new Uint8Array(data.buffer, data.byteOffset, data.byteLength)
+  const { schemaMap: snapshotSchemaMap, hashMap } = snapshotMaps()
+  if (bytes.byteLength < HEADER_SIZE) {
+    throw new Error(`Schema snapshot of ${bytes.byteLength} bytes is too small`)
+  }
+  const header = new DataView(bytes.buffer, bytes.byteOffset, HEADER_SIZE)
+  if (header.getBigUint64(8, true) !== SNAPSHOT_DEFINITION.hashValue) {
+    throw new Error(`Not a cbuf schema snapshot`)
+  }
+  const { message } = deserializeMessage(snapshotSchemaMap, hashMap, bytes, 0)
+  if (message.version !== SNAPSHOT_VERSION) {
+    throw new Error(`Unsupported schema snapshot version ${message.version}`)
+  }
+
+  const schemaMap = new Map()
+  for (const struct of message.structs) {
+    const definitions = struct.definitions.map((snapshotField) => {
+      const field = { name: snapshotField.name, type: snapshotField.type }
+      if (snapshotField.isComplex) field.isComplex = true
+      if (snapshotField.defaultValue !== "") {
+        const value = JSON.parse(snapshotField.defaultValue)
+        field.defaultValue = Array.isArray(value)
+          ? value.map((element) => snapshotDefault(field.type, element))
+          : snapshotDefault(field.type, value)
+      }
+      if (snapshotField.upperBound >= 0) field.upperBound = snapshotField.upperBound
+      if (snapshotField.isArray) field.isArray = true
+      if (snapshotField.arrayUpperBound >= 0) field.arrayUpperBound = snapshotField.arrayUpperBound
+      if (snapshotField.arrayLength >= 0) field.arrayLength = snapshotField.arrayLength
+      return field
+    })
+    schemaMap.set(struct.name, {
+      name: struct.name,
+      hashValue: struct.hashValue,
+      line: struct.line,
+      column: struct.column,
+      naked: struct.naked,
+      definitions,
+    })
+  }
+  return schemaMap
+}
+
+/**
+ * Register a specialized decoder for one message hash, which `deserializeMessage()` then uses
+ * instead of the generic decoder. `factory` is a decoder factory written by `bin/cbuf-codegen.js`.
+ * Registering a hash again replaces its decoder.
+ *
+ * @param {bigint} hashValue
+ * @param {(rt: typeof DECODER_RUNTIME) => Function} factory
+ */
+function registerDecoder(hashValue, factory) {
+  compiledDecoders.set(hashValue, factory(DECODER_RUNTIME))
+}
+
+/**
+ * Generate and register specialized decoders for message types of a parsed schema. This compiles
+ * generated code with `new Function()`; where a content security policy forbids that, generate the
+ * decoders ahead of time with `bin/cbuf-codegen.js` instead.
+ *
+ * @param {Map<string, CbufMessageDefinition>} schemaMap
+ * @param {string[] | undefined} typeNames The message types to compile, by default every non-naked
+ *   struct in the schema
+ * @returns {number} The number of decoders registered
+ */
+function compileDecoders(schemaMap, typeNames) {
+  const names =
+    typeNames ?? [...schemaMap.values()].filter((def) => def.naked !== true).map((def) => def.name)
+  for (const typeName of names) {
+    const source = generateDecoderSource(schemaMap, typeName)
+    registerDecoder(schemaMap.get(typeName).hashValue, new Function("rt", source))
+  }
+  return names.length
+}
+
+/** Remove every registered specialized decoder */
+function clearDecoders() {
+  compiledDecoders.clear()
+}
+
+/**
+ * The tracer installed with `setTracer()`, if any.
+ *
+ * @returns {CbufTracer | undefined}
+ */
+function getTracer() {
+  return tracer
+}
+
+module.exports.getMemoryStats = getMemoryStats
+module.exports.schemaMapToHashMap = schemaMapToHashMap
+module.exports.deserializeMessage = deserializeMessage
+module.exports.serializeMessage = serializeMessage
+module.exports.serializeMessageInto = serializeMessageInto
+module.exports.serializeMessages = serializeMessages
+module.exports.serializeColumns = serializeColumns
+module.exports.CbufWriter = CbufWriter
+module.exports.CbufOutputRegion = CbufOutputRegion
+module.exports.StringCache = StringCache
+module.exports.MessageCache = MessageCache
+module.exports.CbufTracer = CbufTracer
+module.exports.setTracer = setTracer
+module.exports.getTracer = getTracer
+module.exports.CbufDecodeProfiler = CbufDecodeProfiler
+module.exports.setDecodeProfiler = setDecodeProfiler
+module.exports.registerDecoder = registerDecoder
+module.exports.compileDecoders = compileDecoders
+module.exports.clearDecoders = clearDecoders
+module.exports.generateDecoderSource = generateDecoderSource
+module.exports.serializedMessageSize = serializedMessageSize
+module.exports.serializeSchemaSnapshot = serializeSchemaSnapshot
+module.exports.deserializeSchemaSnapshot = deserializeSchemaSnapshot
+
+// The log reader builds on the codec exports above
+const log = require("./log")
+module.exports.CbufIndex = log.CbufIndex
+module.exports.CbufFollower = log.CbufFollower
+module.exports.CbufPlayer = log.CbufPlayer
+module.exports.mergeLogs = log.mergeLogs
+module.exports.deserializeMessagesAt = log.deserializeMessagesAt
+module.exports.readMessage = log.readMessage
+module.exports.readMessagesAt = log.readMessagesAt
+
+const source = require("./source")
+module.exports.CbufMemorySource = source.CbufMemorySource
+module.exports.CbufFileSource = source.CbufFileSource
+module.exports.CbufBlobSource = source.CbufBlobSource
+module.exports.BlockCache = source.BlockCache
+
+const changes = require("./changes")
+module.exports.diffMessages = changes.diffMessages
+module.exports.CbufChangeDetector = changes.CbufChangeDetector
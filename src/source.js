@@ -0,0 +1,290 @@
+// Random access to `.cb` logs that are not held in memory. A source reads byte ranges of a log,
+// and `BlockCache` wraps any source with an LRU cache of fixed-size blocks, so indexing, seeking
+// and decoding a log far larger than memory only ever holds the cache budget.
+
+/**
+ * @typedef {import("./index").CbufSource} CbufSource
+ */
+
+/** A source over a log already in memory */
+class CbufMemorySource {
+  /** @param {ArrayBufferView} data */
+  constructor(data) {
+    this.data = new Uint8Array(data.buffer, data.byteOffset, data.byteLength)
+  }
+
+  /** @returns {number} */
+  size() {
+    return this.data.byteLength
+  }
+
+  /**
+   * @param {number} offset
+   * @param {number} length
+   * @returns {Uint8Array} A view of up to `length` bytes, shorter at the end of the log
+   */
+  read(offset, length) {
+    return this.data.subarray(offset, offset + length)
+  }
+}
+
+/** A source over a Node.js `FileHandle` from `fs.promises.open()`, read with positional reads */
+class CbufFileSource {
+  /** @param {import("fs/promises").FileHandle} handle */
+  constructor(handle) {
+    this.handle = handle
+  }
+
+  /** @returns {Promise<number>} The current file size, so a growing log can be followed */
+  async size() {
+    return (await this.handle.stat()).size
+  }
+
+  /**
+   * @param {number} offset
+   * @param {number} length
+   * @returns {Promise<Uint8Array>} Up to `length` bytes, shorter at the end of the file
+   */
+  async read(offset, length) {
+    const buffer = new Uint8Array(length)
+    let read = 0
+    while (read < length) {
+      const { bytesRead } = await this.handle.read(buffer, read, length - read, offset + read)
+      if (bytesRead === 0) {
+        break
+      }
+      read += bytesRead
+    }
+    return read === length ? buffer : buffer.subarray(0, read)
+  }
+}
+
+/** A source over a browser `Blob` or `File`, read with `Blob.slice()` */
+class CbufBlobSource {
+  /** @param {Blob} blob */
+  constructor(blob) {
+    this.blob = blob
+  }
+
+  /** @returns {number} */
+  size() {
+    return this.blob.size
+  }
+
+  /**
+   * @param {number} offset
+   * @param {number} length
+   * @returns {Promise<Uint8Array>} Up to `length` bytes, shorter at the end of the blob
+   */
+  async read(offset, length) {
+    return new Uint8Array(await this.blob.slice(offset, offset + length).arrayBuffer())
+  }
+}
+
+/**
+ * Wraps a source with an LRU cache of `blockSize` blocks, holding at most `maxBytes`. Each read
+ * fetches its missing blocks with one underlying read per contiguous run, and concurrent reads of
+ * the same block share one fetch. Reads that continue where the previous read ended are treated as
+ * sequential and prefetch up to `readahead` following blocks in the background, doubling the
+ * prefetch with each sequential read. A `BlockCache` is itself a source.
+ */
+class BlockCache {
+  /**
+   * @param {CbufSource} source
+   * @param {{ blockSize?: number; maxBytes?: number; readahead?: number } | undefined} options
+   *   - `blockSize`: Bytes per block. Defaults to 64KB.
+   *   - `maxBytes`: The most block bytes kept. Defaults to 16MB.
+   *   - `readahead`: The most blocks prefetched for sequential reads. Defaults to 16.
+   */
+  constructor(source, options) {
+    this.source = source
+    this.blockSize = options?.blockSize ?? 64 * 1024
+    this.maxBytes = options?.maxBytes ?? 16 * 1024 * 1024
+    this.readahead = options?.readahead ?? 16
+    /** @type {Map<number, Uint8Array>} Full blocks by block number, least recently used first */
+    this._blocks = new Map()
+    /** @type {Map<number, Promise<Uint8Array>>} Blocks being fetched */
+    this._fetching = new Map()
+    this._bytes = 0
+    this._nextBlock = -1
+    this._prefetch = 0
+    this.hits = 0
+    this.misses = 0
+    this.reads = 0
+    this.bytesRead = 0
+  }
+
+  /** @returns {number | Promise<number>} */
+  size() {
+    return this.source.size()
+  }
+
+  /**
+   * @param {number} offset
+   * @param {number} length
+   * @returns {Promise<Uint8Array>} Up to `length` bytes, shorter at the end of the log. A read
+   *   within one block is a view of the cached block
+   */
+  async read(offset, length) {
+    if (length <= 0) {
+      return new Uint8Array(0)
+    }
+    const blockSize = this.blockSize
+    const first = Math.floor(offset / blockSize)
+    const last = Math.floor((offset + length - 1) / blockSize)
+
+    const sequential = first === this._nextBlock || first === this._nextBlock - 1
+    this._prefetch = sequential ? Math.min(this.readahead, Math.max(1, this._prefetch * 2)) : 0
+    this._nextBlock = last + 1
+    const blocks = this._load(first, last)
+    if (this._prefetch > 0) {
+      // Prefetch failures surface when the blocks are actually read
+      this._load(last + 1, last + this._prefetch).catch(() => {})
+    }
+
+    const loaded = await blocks
+    const start = offset - first * blockSize
+    if (loaded.length === 1) {
+      return loaded[0].subarray(start, start + length)
+    }
+    const out = new Uint8Array(length)
+    let pos = 0
+    for (let i = 0; i < loaded.length && pos < length; i++) {
+      const from = i === 0 ? start : 0
+      const part = loaded[i].subarray(from, from + length - pos)
+      out.set(part, pos)
+      pos += part.length
+      // A short block is the end of the log
+      if (loaded[i].length < blockSize) {
+        break
+      }
+    }
+    return pos === length ? out : out.subarray(0, pos)
+  }
+
+  /** Drop every cached block and reset the statistics. */
+  clear() {
+    this._blocks.clear()
+    this._bytes = 0
+    this.hits = 0
+    this.misses = 0
+    this.reads = 0
+    this.bytesRead = 0
+  }
+
+  /**
+   * @returns {{
+   *   blocks: number; // Cached blocks
+   *   bytes: number; // Bytes they hold
+   *   hits: number; // Blocks read from the cache
+   *   misses: number; // Blocks fetched from the source
+   *   reads: number; // Reads issued to the source
+   *   bytesRead: number; // Bytes read from the source
+   * }}
+   */
+  stats() {
+    return {
+      blocks: this._blocks.size,
+      bytes: this._bytes,
+      hits: this.hits,
+      misses: this.misses,
+      reads: this.reads,
+      bytesRead: this.bytesRead,
+    }
+  }
+
+  /**
+   * Get blocks `first` to `last`, fetching missing runs of blocks with one read each.
+   *
+   * @param {number} first
+   * @param {number} last
+   * @returns {Promise<Uint8Array[]>}
+   */
+  _load(first, last) {
+    /** @type {Array<Uint8Array | Promise<Uint8Array>>} */
+    const blocks = []
+    let runStart = -1
+    for (let block = first; block <= last + 1; block++) {
+      const cached = block <= last ? this._blocks.get(block) : undefined
+      const fetching = block <= last ? this._fetching.get(block) : undefined
+      if (block <= last && cached == undefined && fetching == undefined) {
+        if (runStart === -1) runStart = block
+        continue
+      }
+      if (runStart !== -1) {
+        blocks.push(...this._fetch(runStart, block - 1))
+        runStart = -1
+      }
+      if (cached != undefined) {
+        // Move the block to the most recently used end
+        this._blocks.delete(block)
+        this._blocks.set(block, cached)
+        this.hits++
+        blocks.push(cached)
+      } else if (fetching != undefined) {
+        blocks.push(fetching)
+      }
+    }
+    return Promise.all(blocks)
+  }
+
+  /**
+   * Fetch blocks `first` to `last` with one read from the source.
+   *
+   * @param {number} first
+   * @param {number} last
+   * @returns {Promise<Uint8Array>[]} One promise per block
+   */
+  _fetch(first, last) {
+    const blockSize = this.blockSize
+    const count = last - first + 1
+    this.reads++
+    this.misses += count
+    const data = Promise.resolve(this.source.read(first * blockSize, count * blockSize))
+    const promises = []
+    for (let i = 0; i < count; i++) {
+      const block = first + i
+      const promise = data.then(
+        (bytes) => {
+          this._fetching.delete(block)
+          // Copy blocks out of a multi-block read so each can be evicted on its own
+          const blockBytes =
+            count === 1 ? bytes : bytes.slice(i * blockSize, (i + 1) * blockSize)
+          if (i === 0) this.bytesRead += bytes.length
+          // Only full blocks are cached, since a partial block at the end of the log may grow
+          if (blockBytes.length === blockSize) {
+            this._insert(block, blockBytes)
+          }
+          return blockBytes
+        },
+        (err) => {
+          this._fetching.delete(block)
+          throw err
+        },
+      )
+      this._fetching.set(block, promise)
+      promises.push(promise)
+    }
+    return promises
+  }
+
+  /**
+   * @param {number} block
+   * @param {Uint8Array} bytes
+   */
+  _insert(block, bytes) {
+    this._blocks.set(block, bytes)
+    this._bytes += bytes.length
+    while (this._bytes > this.maxBytes && this._blocks.size > 0) {
+      // Maps iterate in insertion order, so the first block is the least recently used
+      const [oldest, oldestBytes] = this._blocks.entries().next().value
+      this._blocks.delete(oldest)
+      this._bytes -= oldestBytes.length
+    }
+  }
+}
+
+module.exports.CbufMemorySource = CbufMemorySource
+module.exports.CbufFileSource = CbufFileSource
+module.exports.CbufBlobSource = CbufBlobSource
+module.exports.BlockCache = BlockCache
@@ -1,17 +1,31 @@
 #include <emscripten/bind.h>
+#include <emscripten/heap.h>
 #include <emscripten/val.h>
+#include <malloc.h>
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 
+#include "AllocTags.h"
+#include "Allocator.h"
+#include "ParseStats.h"
 #include "SchemaParser.h"
+#include "TextType.h"
 #include "SymbolTable.h"
 #include "ast.h"
 
 using emscripten::val;
 
+// Most malloc bytes in use seen at the end of a parse, while the parser is still alive
+static size_t peak_malloc_in_use = 0;
+
 int main(int argc, char** argv) {}
 
+void SampleMallocInUse() {
+  peak_malloc_in_use = std::max(peak_malloc_in_use, size_t(mallinfo().uordblks));
+}
+
 val MakeError(const std::string& error) {
   val obj = val::object();
   obj.set("error", error);
@@ -19,6 +33,27 @@ val MakeError(const std::string& error) {
   return obj;
 }
 
+val DefaultValueToVal(ElementType type, const ast_value* value) {
+  SchemaDefaultValue converted = SchemaParser::DefaultValue(type, value);
+  switch (converted.kind) {
+    case SchemaDefaultValue::UINT32:
+      return val(converted.u32);
+    case SchemaDefaultValue::INT32:
+      return val(converted.i32);
+    case SchemaDefaultValue::INT64:
+      return val(converted.i64);
+    case SchemaDefaultValue::FLOAT:
+      return val(converted.f64);
+    case SchemaDefaultValue::STRING:
+      return val(std::string{converted.str});
+    case SchemaDefaultValue::BOOL:
+      return val(converted.b);
+    case SchemaDefaultValue::NONE:
+      break;
+  }
+  return val::undefined();
+}
+
 void ParseNamespace(const ast_namespace* ns, const SymbolTable* symtable, val& array) {
   std::string nsName = ns->name != nullptr ? std::string{ns->name} : "";
   if (nsName == GLOBAL_NAMESPACE) {
@@ -27,6 +62,8 @@ void ParseNamespace(const ast_namespace* ns, const SymbolTable* symtable, val& a
 
   // Iterate each struct in this namespace
   for (const ast_struct* st : ns->structs) {
+    CBUF_STATS_ADD(structs, 1);
+    CBUF_STATS_ADD(fields, st->elements.size());
     std::string name = nsName.empty() ? std::string{st->name} : nsName + "::" + st->name;
     val entry = val::object();
     entry.set("name", name);
@@ -49,39 +86,15 @@ void ParseNamespace(const ast_namespace* ns, const SymbolTable* symtable, val& a
       // Default value handling
       if (elem->init_value) {
         if (elem->init_value->exptype == EXPTYPE_ARRAY_LITERAL) {
-          // TODO: Handle array literals
-          def.set("defaultValue", val::array());
-        } else {
-          switch (elem->type) {
-            case TYPE_U8:
-            case TYPE_U16:
-            case TYPE_U32:
-              def.set("defaultValue", uint32_t(elem->init_value->int_val));
-              break;
-            case TYPE_S8:
-            case TYPE_S16:
-            case TYPE_S32:
-              def.set("defaultValue", int32_t(elem->init_value->int_val));
-              break;
-            case TYPE_U64:
-            case TYPE_S64:
-              def.set("defaultValue", elem->init_value->int_val);
-              break;
-            case TYPE_F32:
-            case TYPE_F64:
-              def.set("defaultValue", elem->init_value->float_val);
-              break;
-            case TYPE_STRING:
-            case TYPE_SHORT_STRING:
-              def.set("defaultValue", std::string{elem->init_value->str_val});
-              break;
-            case TYPE_BOOL:
-              def.set("defaultValue", elem->init_value->bool_val);
-              break;
-            case TYPE_CUSTOM:
-              // Custom type default values are not supported
-              break;
+          val values = val::array();
+          if (elem->type != TYPE_CUSTOM) {
+            for (const ast_value* value : static_cast<ast_array_value*>(elem->init_value)->values) {
+              values.call<void>("push", DefaultValueToVal(elem->type, value));
+            }
           }
+          def.set("defaultValue", values);
+        } else if (elem->type != TYPE_CUSTOM) {
+          def.set("defaultValue", DefaultValueToVal(elem->type, elem->init_value));
         }
       }
 
@@ -110,12 +123,39 @@ void ParseNamespace(const ast_namespace* ns, const SymbolTable* symtable, val& a
   }
 }
 
+#ifdef CBUF_ENABLE_STATS
+val MakeStats() {
+  const auto& stats = g_parse_stats;
+  val timings = val::object();
+  timings.set("lex", stats.stage_ms[PARSE_STAGE_LEX]);
+  timings.set("parse", stats.stage_ms[PARSE_STAGE_PARSE]);
+  timings.set("symbolTable", stats.stage_ms[PARSE_STAGE_SYMBOL_TABLE]);
+  timings.set("computeSizes", stats.stage_ms[PARSE_STAGE_COMPUTE_SIZES]);
+  timings.set("computeHashes", stats.stage_ms[PARSE_STAGE_COMPUTE_HASHES]);
+  timings.set("convert", stats.stage_ms[PARSE_STAGE_CONVERT]);
+
+  val obj = val::object();
+  obj.set("timings", timings);
+  obj.set("tokens", double(stats.tokens));
+  obj.set("structs", double(stats.structs));
+  obj.set("fields", double(stats.fields));
+  obj.set("symbolLookups", double(stats.symbol_lookups));
+  obj.set("internHits", double(stats.intern_hits));
+  obj.set("internMisses", double(stats.intern_misses));
+  obj.set("poolBytes", double(stats.pool_bytes));
+  return obj;
+}
+#endif
+
 /**
  * Parses `.cbuf` schema text data where all #include statements have been replaced by the contents
  * of the included files, and returns a JSON object containing the parsed schema on success or an
- * error string on failure.
+ * error string on failure. If `collectStats` is true and the module was built with
+ * CBUF_ENABLE_STATS, the object also has a `stats` field with stage timings and counters.
  */
-val parseCBufSchema(val schemaText) {
+val parseCBufSchema(val schemaText, bool collectStats) {
+  CBUF_STATS_RESET();
+
   std::string schemaStr = schemaText.as<std::string>();
   // Ensure schemaStr ends with a newline. The parser will fail otherwise
   if (schemaStr.back() != '\n') {
@@ -144,17 +184,69 @@ val parseCBufSchema(val schemaText) {
   val array = val::array();
 
   // Iterate each namespace
-  ParseNamespace(&ast->global_space, symtable, array);
-  for (const ast_namespace* ns : ast->spaces) {
-    ParseNamespace(ns, symtable, array);
+  {
+    CBUF_STATS_TIME_STAGE(PARSE_STAGE_CONVERT);
+    CBUF_ALLOC_TAG(ALLOC_TAG_CONVERT);
+    ParseNamespace(&ast->global_space, symtable, array);
+    for (const ast_namespace* ns : ast->spaces) {
+      ParseNamespace(ns, symtable, array);
+    }
   }
 
+  SampleMallocInUse();
+
   val ret = val::object();
   ret.set("schema", array);
+#ifdef CBUF_ENABLE_STATS
+  if (collectStats) {
+    ret.set("stats", MakeStats());
+  }
+#else
+  (void)collectStats;
+#endif
   return ret;
 }
 
+/**
+ * Returns the wasm heap size, malloc usage, live parser pool memory and intern table size. Builds
+ * with CBUF_ALLOC_TAGGING also attribute malloc bytes to parser subsystems in `allocTags`.
+ */
+val getMemoryStats() {
+  struct mallinfo info = mallinfo();
+  peak_malloc_in_use = std::max(peak_malloc_in_use, size_t(info.uordblks));
+
+  u64 intern_entries, intern_bytes;
+  InternTableSize(intern_entries, intern_bytes);
+
+  val obj = val::object();
+  obj.set("heapSize", double(emscripten_get_heap_size()));
+  obj.set("heapMax", double(emscripten_get_heap_max()));
+  obj.set("mallocInUse", double(info.uordblks));
+  obj.set("mallocFree", double(info.fordblks));
+  obj.set("peakMallocInUse", double(peak_malloc_in_use));
+  obj.set("livePools", double(PoolAllocator::livePools()));
+  obj.set("poolReservedBytes", double(PoolAllocator::liveReservedBytes()));
+  obj.set("peakPoolReservedBytes", double(PoolAllocator::peakReservedBytes()));
+  obj.set("internEntries", double(intern_entries));
+  obj.set("internBytes", double(intern_bytes));
+
+#ifdef CBUF_ALLOC_TAGGING
+  val tags = val::object();
+  for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+    val tag = val::object();
+    tag.set("allocations", double(g_alloc_tag_stats.allocations[i]));
+    tag.set("bytes", double(g_alloc_tag_stats.bytes[i]));
+    tags.set(AllocTagNames[i], tag);
+  }
+  obj.set("allocTags", tags);
+  obj.set("taggedLiveBytes", double(g_alloc_tag_stats.live_bytes));
+  obj.set("taggedPeakLiveBytes", double(g_alloc_tag_stats.peak_live_bytes));
+#endif
+  return obj;
+}
+
 // Exported JavaScript API
 EMSCRIPTEN_BINDINGS(cbuf) {
   emscripten::function("parseCBufSchema", &parseCBufSchema);
+  emscripten::function("getMemoryStats", &getMemoryStats);
 }
@@ -21,6 +21,18 @@ describe("parsing", () => {
     Cbuf.isLoaded.then(done)
   })
 
+  it("reports startup timings and the compiled module", async () => {
+    await Cbuf.isLoaded
+    assert.strictEqual(Cbuf.init(), Cbuf.init())
+    assert.throws(() => Cbuf.init({ wasmModule: Cbuf.getWasmModule() }), /already loading/)
+    assert.throws(() => Cbuf.init({ initialMemory: 1 << 24 }), /already loading.*initialMemory/)
+    assert.throws(() => Cbuf.init({ memoryGrowthStep: 1 << 20 }), /memoryGrowthStep/)
+    assert(Cbuf.getWasmModule() instanceof WebAssembly.Module)
+    const timings = Cbuf.getStartupTimings()
+    assert.equal(timings.source, "file")
+    assert(timings.totalMs >= timings.compileMs + timings.instantiateMs)
+  })
+
   it("parses the metadata.cbuf definition", async () => {
     await Cbuf.isLoaded
 
@@ -154,7 +166,14 @@ namespace messages {
         { name: "k", type: "bool", defaultValue: true },
         { name: "l", type: "string", defaultValue: "test" },
         { name: "m", type: "string", upperBound: 16 },
-        { name: "n", type: "uint8", isArray: true, arrayLength: 4, defaultValue: [] },
+        {
+          name: "n",
+          type: "uint8",
+          isArray: true,
+          arrayLength: 4,
+          // -70 wraps to the width of a uint8 element
+          defaultValue: [30, 186, 97, 98],
+        },
         { name: "o", type: "uint16", isArray: true },
         { name: "p", type: "uint8", isArray: true, arrayUpperBound: 4 },
         { name: "q", type: "string", isArray: true, arrayLength: 2 },
@@ -198,6 +217,46 @@ namespace messages {
   })
 })
 
+describe("parseCBufSchema stats", () => {
+  const schema = `
+namespace messages {
+  enum Mode { IDLE, RUN }
+  struct inner @naked { f64 x; Mode mode; }
+  struct outer { inner a; inner b[2]; string name; }
+}
+`
+
+  it("does not return stats unless requested", async () => {
+    await Cbuf.isLoaded
+    const result = Cbuf.parseCBufSchema(schema)
+    assert.equal(result.error, undefined)
+    assert.equal(result.stats, undefined)
+  })
+
+  it("returns stage timings and counters in instrumented builds", async () => {
+    await Cbuf.isLoaded
+    const result = Cbuf.parseCBufSchema(schema, { stats: true })
+    assert.equal(result.error, undefined)
+    assert.equal(result.schema.size, 2)
+    if (result.stats == undefined) {
+      // Built without CBUF_ENABLE_STATS
+      return
+    }
+
+    const { stats } = result
+    assert.equal(stats.structs, 2)
+    assert.equal(stats.fields, 5)
+    assert(stats.tokens > 0)
+    assert(stats.symbolLookups > 0)
+    assert(stats.internMisses + stats.internHits > 0)
+    assert(stats.poolBytes > 0)
+    for (const [stage, ms] of Object.entries(stats.timings)) {
+      assert(ms >= 0, `${stage} timing ${ms}`)
+    }
+    assert(stats.timings.total >= stats.timings.lex + stats.timings.parse)
+  })
+})
+
 describe("deserializeMessage", () => {
   it("reads a self-describing .cb buffer", () => {
     // Cbuf.deserializeMessage does not use the wasm module, so no need to
@@ -326,3 +385,1762 @@ describe("serializeMessage", () => {
     )
   })
 })
+
+describe("serializeMessages", () => {
+  const structPoint = {
+    name: "messages::point",
+    naked: true,
+    hashValue: 2n,
+    definitions: [
+      { name: "x", type: "float64" },
+      { name: "y", type: "float64" },
+    ],
+  }
+  const structHeader = {
+    name: "messages::header",
+    naked: false,
+    hashValue: 3n,
+    definitions: [{ name: "seq", type: "uint32" }],
+  }
+  const structPath = {
+    name: "messages::path",
+    naked: false,
+    hashValue: 4n,
+    definitions: [
+      { name: "header", type: "messages::header", isComplex: true },
+      { name: "frame", type: "string" },
+      { name: "tags", type: "string", isArray: true },
+      { name: "points", type: "messages::point", isComplex: true, isArray: true },
+    ],
+  }
+
+  const schemaMap = new Map()
+  schemaMap.set(structPoint.name, structPoint)
+  schemaMap.set(structHeader.name, structHeader)
+  schemaMap.set(structPath.name, structPath)
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  function makeMessage(i) {
+    return {
+      typeName: "messages::path",
+      hashValue: 4n,
+      timestamp: 1000 + i,
+      variant: i % 3,
+      message: {
+        header: { seq: i },
+        frame: "map",
+        tags: ["a", "bc"],
+        points: Array.from({ length: i }, (_, j) => ({ x: j, y: -j })),
+      },
+    }
+  }
+
+  it("serializes into a caller-provided buffer", () => {
+    const message = makeMessage(2)
+    const size = Cbuf.serializedMessageSize(schemaMap, hashMap, message)
+    const data = new Uint8Array(size + 10)
+    const written = Cbuf.serializeMessageInto(schemaMap, hashMap, message, data, 10)
+    assert.equal(written, size)
+    assert(arrayBuffersEqual(data.slice(10), Cbuf.serializeMessage(schemaMap, hashMap, message)))
+
+    const result = Cbuf.deserializeMessage(schemaMap, hashMap, data, 10)
+    assert.equal(result.size, size)
+    assert.equal(result.variant, 2)
+    assert.equal(result.message.header.seq, 2)
+    assert.deepStrictEqual(result.message.tags, ["a", "bc"])
+    assert.deepStrictEqual(result.message.points, [
+      { x: 0, y: -0 },
+      { x: 1, y: -1 },
+    ])
+
+    assert.throws(() => Cbuf.serializeMessageInto(schemaMap, hashMap, message, data, 11))
+  })
+
+  it("zero-pads fixed-size strings in a reused buffer", () => {
+    const structLabel = {
+      name: "messages::label",
+      naked: false,
+      hashValue: 5n,
+      definitions: [
+        { name: "s", type: "string", upperBound: 8 },
+        { name: "empty", type: "string", upperBound: 4 },
+      ],
+    }
+    const labelSchema = new Map([[structLabel.name, structLabel]])
+    const labelHashes = Cbuf.schemaMapToHashMap(labelSchema)
+    const message = {
+      typeName: structLabel.name,
+      hashValue: 5n,
+      timestamp: 1,
+      message: { s: "hi" },
+    }
+    const data = new Uint8Array(64).fill(0x41)
+    Cbuf.serializeMessageInto(labelSchema, labelHashes, message, data, 0)
+    const result = Cbuf.deserializeMessage(labelSchema, labelHashes, data, 0)
+    assert.deepStrictEqual(result.message, { s: "hi", empty: "" })
+  })
+
+  it("serializes many messages into one contiguous buffer", () => {
+    const messages = Array.from({ length: 20 }, (_, i) => makeMessage(i))
+    const data = new Uint8Array(Cbuf.serializeMessages(schemaMap, hashMap, messages))
+
+    let offset = 0
+    for (let i = 0; i < messages.length; i++) {
+      const result = Cbuf.deserializeMessage(schemaMap, hashMap, data, offset)
+      assert.equal(result.timestamp, 1000 + i)
+      assert.equal(result.message.points.length, i)
+      offset += result.size
+    }
+    assert.equal(offset, data.byteLength)
+  })
+
+  it("serializes many messages into fixed-size chunks", () => {
+    const messages = Array.from({ length: 20 }, (_, i) => makeMessage(i))
+    const expected = new Uint8Array(Cbuf.serializeMessages(schemaMap, hashMap, messages))
+    const chunks = Cbuf.serializeMessages(schemaMap, hashMap, messages, { chunkSize: 256 })
+
+    assert(chunks.length > 1)
+    let offset = 0
+    for (const chunk of chunks) {
+      assert(chunk.byteLength <= 256 || chunk.buffer.byteLength === chunk.byteLength)
+      assert(arrayBuffersEqual(chunk, expected.subarray(offset, offset + chunk.byteLength)))
+      offset += chunk.byteLength
+    }
+    assert.equal(offset, expected.byteLength)
+  })
+
+  it("serializes batches into a reusable output region", () => {
+    const messages = Array.from({ length: 5 }, (_, i) => makeMessage(i))
+    const expected = new Uint8Array(Cbuf.serializeMessages(schemaMap, hashMap, messages))
+    const region = new Cbuf.CbufOutputRegion(2 * expected.byteLength + 8)
+
+    const first = Cbuf.serializeMessages(schemaMap, hashMap, messages, { region })
+    const second = Cbuf.serializeMessages(schemaMap, hashMap, messages, { region })
+    assert.strictEqual(first.buffer, second.buffer)
+    assert.equal(second.byteOffset % 8, 0)
+    assert(arrayBuffersEqual(first, expected))
+    assert(arrayBuffersEqual(second, expected))
+    assert.throws(() => Cbuf.serializeMessages(schemaMap, hashMap, messages, { region }), /fit/)
+
+    region.reset()
+    const third = Cbuf.serializeMessages(schemaMap, hashMap, messages, { region })
+    assert.equal(third.byteOffset, 0)
+    assert.equal(region.used, expected.byteLength)
+    assert.equal(region.peak, second.byteOffset + expected.byteLength)
+
+    region.free()
+    assert.equal(region.capacity, 0)
+    assert.throws(() => region.allocate(1), /freed/)
+  })
+})
+
+describe("serializeMessage typed arrays", () => {
+  const structCloud = {
+    name: "messages::cloud",
+    naked: false,
+    hashValue: 5n,
+    definitions: [
+      { name: "flag", type: "uint8" },
+      { name: "xyz", type: "float32", isArray: true },
+      { name: "rgb", type: "uint8", isArray: true },
+      { name: "stamps", type: "uint64", isArray: true, arrayLength: 2 },
+      { name: "ids", type: "int16", isArray: true, arrayLength: 3 },
+    ],
+  }
+  const schemaMap = new Map([[structCloud.name, structCloud]])
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  function roundTrip(message) {
+    const data = new Uint8Array(
+      Cbuf.serializeMessage(schemaMap, hashMap, {
+        typeName: "messages::cloud",
+        hashValue: 5n,
+        timestamp: 0,
+        message,
+      }),
+    )
+    return { data, result: Cbuf.deserializeMessage(schemaMap, hashMap, data) }
+  }
+
+  it("copies typed arrays of the matching element type", () => {
+    const xyz = new Float32Array([1.5, -2.25, 3e9, 4])
+    const rgb = new Uint8Array([1, 2, 3])
+    const stamps = new BigUint64Array([1n, 2n ** 63n])
+    const ids = new Int16Array([-1, 2, -3])
+    const { data, result } = roundTrip({ flag: 7, xyz, rgb, stamps, ids })
+
+    // 24 byte header, 1 byte flag, 4 + 16 bytes xyz, 4 + 3 bytes rgb, 16 bytes stamps, 6 bytes ids
+    assert.equal(data.byteLength, 24 + 1 + 20 + 7 + 16 + 6)
+    assert.deepStrictEqual(Array.from(result.message.xyz), Array.from(xyz))
+    assert.deepStrictEqual(Array.from(result.message.rgb), Array.from(rgb))
+    assert.deepStrictEqual(Array.from(result.message.stamps), Array.from(stamps))
+    assert.deepStrictEqual(Array.from(result.message.ids), Array.from(ids))
+  })
+
+  it("converts typed arrays of a different element type", () => {
+    const xyz = new Float64Array([0.1, 0.2, 0.3])
+    const ids = new Int32Array([100, -200, 300, 400])
+    const { result } = roundTrip({
+      flag: 0,
+      xyz,
+      rgb: new Uint16Array([255, 256]),
+      stamps: [3n, 4n],
+      ids,
+    })
+
+    assert.deepStrictEqual(Array.from(result.message.xyz), Array.from(new Float32Array(xyz)))
+    assert.deepStrictEqual(Array.from(result.message.rgb), [255, 0])
+    assert.deepStrictEqual(Array.from(result.message.stamps), [3n, 4n])
+    // Fixed-length arrays only take the first arrayLength elements
+    assert.deepStrictEqual(Array.from(result.message.ids), [100, -200, 300])
+  })
+
+  it("produces the same bytes as plain arrays", () => {
+    const typed = roundTrip({
+      flag: 1,
+      xyz: new Float32Array([1, 2, 3]),
+      rgb: new Uint8Array([4, 5]),
+      stamps: new BigUint64Array([6n, 7n]),
+      ids: new Int16Array([8, 9, 10]),
+    })
+    const plain = roundTrip({
+      flag: 1,
+      xyz: [1, 2, 3],
+      rgb: [4, 5],
+      stamps: [6n, 7n],
+      ids: [8, 9, 10],
+    })
+    assert(arrayBuffersEqual(typed.data, plain.data))
+  })
+})
+
+describe("serializeColumns", () => {
+  const structStamp = {
+    name: "messages::stamp",
+    naked: false,
+    hashValue: 6n,
+    definitions: [
+      { name: "seq", type: "uint32" },
+      { name: "frame", type: "string" },
+    ],
+  }
+  const structScan = {
+    name: "messages::scan",
+    naked: false,
+    hashValue: 7n,
+    definitions: [
+      { name: "stamp", type: "messages::stamp", isComplex: true },
+      { name: "valid", type: "bool" },
+      { name: "angle", type: "float64" },
+      { name: "label", type: "string", upperBound: 4 },
+      { name: "cov", type: "float32", isArray: true, arrayLength: 2 },
+      { name: "ranges", type: "uint16", isArray: true },
+    ],
+  }
+  const schemaMap = new Map([
+    [structStamp.name, structStamp],
+    [structScan.name, structScan],
+  ])
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  it("matches serializeMessages on the equivalent messages", () => {
+    const count = 5
+    const frames = ["base", "", "lidar_ü", "x", "map"]
+    const rangeOffsets = new Uint32Array([0, 3, 3, 4, 8, 10])
+    const ranges = new Uint16Array(10).map((_, i) => i * 100)
+    const frameBytes = frames.map((frame) => new TextEncoder().encode(frame))
+    const frameOffsets = [0]
+    for (const bytes of frameBytes) frameOffsets.push(frameOffsets.at(-1) + bytes.byteLength)
+    const columns = {
+      "stamp.seq": new Uint32Array([10, 11, 12, 13, 14]),
+      "stamp.frame": { bytes: Buffer.concat(frameBytes), offsets: frameOffsets },
+      valid: [true, false, true, false, true],
+      angle: new Float64Array([0.5, 1.5, 2.5, 3.5, 4.5]),
+      label: ["a", "bb", "ccc", "dddd", "eeeee"],
+      cov: new Float64Array(count * 2).map((_, i) => i / 4),
+      ranges: { values: ranges, offsets: rangeOffsets },
+    }
+    const timestamps = new Float64Array([1, 2, 3, 4, 5])
+    const variants = [0, 1, 2, 3, 0]
+
+    const output = Cbuf.serializeColumns(schemaMap, hashMap, {
+      typeName: "messages::scan",
+      count,
+      timestamps,
+      variants,
+      columns,
+    })
+
+    const messages = []
+    for (let i = 0; i < count; i++) {
+      messages.push({
+        typeName: "messages::scan",
+        hashValue: 7n,
+        timestamp: timestamps[i],
+        variant: variants[i],
+        message: {
+          stamp: { seq: 10 + i, frame: frames[i] },
+          valid: columns.valid[i],
+          angle: columns.angle[i],
+          label: columns.label[i].slice(0, 4),
+          cov: [columns.cov[i * 2], columns.cov[i * 2 + 1]],
+          ranges: ranges.subarray(rangeOffsets[i], rangeOffsets[i + 1]),
+        },
+      })
+    }
+
+    const data = new Uint8Array(output)
+    let offset = 0
+    for (let i = 0; i < count; i++) {
+      const result = Cbuf.deserializeMessage(schemaMap, hashMap, data, offset)
+      assert.equal(result.variant, variants[i])
+      assert.equal(result.message.stamp.seq, 10 + i)
+      assert.equal(result.message.stamp.frame, frames[i])
+      assert.equal(result.message.label, messages[i].message.label)
+      assert.deepStrictEqual(
+        Array.from(result.message.ranges),
+        Array.from(messages[i].message.ranges),
+      )
+      offset += result.size
+    }
+    assert.equal(offset, data.byteLength)
+
+    // Rows with ASCII-only strings match the object serializer byte for byte
+    const asciiMessages = messages.filter((_, i) => i !== 2)
+    const asciiOutput = Cbuf.serializeColumns(schemaMap, hashMap, {
+      typeName: "messages::scan",
+      count: 4,
+      timestamps: timestamps.filter((_, i) => i !== 2),
+      variants: variants.filter((_, i) => i !== 2),
+      columns: {
+        "stamp.seq": asciiMessages.map((m) => m.message.stamp.seq),
+        "stamp.frame": asciiMessages.map((m) => m.message.stamp.frame),
+        valid: asciiMessages.map((m) => m.message.valid),
+        angle: asciiMessages.map((m) => m.message.angle),
+        label: asciiMessages.map((m) => m.message.label),
+        cov: asciiMessages.flatMap((m) => m.message.cov),
+        ranges: {
+          values: asciiMessages.flatMap((m) => Array.from(m.message.ranges)),
+          offsets: [0, 3, 3, 7, 9],
+        },
+      },
+    })
+    assert(
+      arrayBuffersEqual(asciiOutput, Cbuf.serializeMessages(schemaMap, hashMap, asciiMessages)),
+    )
+  })
+
+  it("rejects missing columns", () => {
+    assert.throws(
+      () =>
+        Cbuf.serializeColumns(schemaMap, hashMap, {
+          typeName: "messages::stamp",
+          count: 1,
+          timestamps: [0],
+          columns: { seq: [1] },
+        }),
+      /Missing column for field frame/,
+    )
+  })
+
+  it("rejects columns shorter than the batch", () => {
+    const columns = {
+      "stamp.seq": new Uint32Array([1, 2]),
+      "stamp.frame": ["a", "b"],
+      valid: [true, false],
+      angle: new Float64Array([0, 1]),
+      label: { bytes: new Uint8Array([0x61]), offsets: [0, 1, 1] },
+      cov: new Float32Array(4),
+      ranges: { values: new Uint16Array(3), offsets: [0, 1, 3] },
+    }
+    const serialize = (overrides) =>
+      Cbuf.serializeColumns(schemaMap, hashMap, {
+        typeName: "messages::scan",
+        count: 2,
+        timestamps: [0, 1],
+        columns: { ...columns, ...overrides },
+      })
+    assert(serialize({}).byteLength > 0)
+
+    // A short view of a larger buffer must not expose the elements after it
+    const window = new Float32Array([1, 2, 3, 4, 5, 6, 7, 8]).subarray(0, 3)
+    assert.throws(() => serialize({ cov: window }), /field cov has 3 values, expected 4/)
+    assert.throws(() => serialize({ cov: [1, 2, 3] }), /field cov has 3 values, expected 4/)
+    assert.throws(() => serialize({ angle: [0] }), /field angle has 1 values, expected 2/)
+    assert.throws(() => serialize({ "stamp.frame": ["a"] }), /field stamp.frame has 1 values/)
+    assert.throws(
+      () => serialize({ ranges: { values: new Uint16Array(3), offsets: [0, 1] } }),
+      /field ranges has 2 offsets, expected 3/,
+    )
+    assert.throws(
+      () => serialize({ ranges: { values: new Uint16Array(2), offsets: [0, 1, 3] } }),
+      /field ranges ends at 3, past its 2 values/,
+    )
+    assert.throws(
+      () => serialize({ label: { bytes: new Uint8Array(0), offsets: [0, 1, 1] } }),
+      /field label ends at 1, past its 0 values/,
+    )
+  })
+
+  it("zero-pads fixed-size strings in a reused output region", () => {
+    const structTag = {
+      name: "messages::tag",
+      naked: false,
+      hashValue: 8n,
+      definitions: [{ name: "name", type: "string", upperBound: 8 }],
+    }
+    const tagSchema = new Map([[structTag.name, structTag]])
+    const tagHashes = Cbuf.schemaMapToHashMap(tagSchema)
+    const region = new Cbuf.CbufOutputRegion(256)
+    const batch = (columns) => ({
+      typeName: "messages::tag",
+      count: 2,
+      timestamps: [1, 2],
+      columns,
+    })
+    const names = (data) => {
+      const first = Cbuf.deserializeMessage(tagSchema, tagHashes, data)
+      const second = Cbuf.deserializeMessage(tagSchema, tagHashes, data, first.size)
+      return [first.message.name, second.message.name]
+    }
+
+    Cbuf.serializeColumns(tagSchema, tagHashes, batch({ name: ["AAAAAAAA", "BBBBBBBB"] }), {
+      region,
+    })
+    region.reset()
+    const strings = Cbuf.serializeColumns(tagSchema, tagHashes, batch({ name: ["a", ""] }), {
+      region,
+    })
+    assert.deepStrictEqual(names(strings), ["a", ""])
+
+    region.reset()
+    const bytes = { bytes: new Uint8Array([0x62, 0x63]), offsets: [0, 2, 2] }
+    const encoded = Cbuf.serializeColumns(tagSchema, tagHashes, batch({ name: bytes }), { region })
+    assert.deepStrictEqual(names(encoded), ["bc", ""])
+
+    region.reset()
+    const messages = ["d", ""].map((name, i) => ({
+      typeName: "messages::tag",
+      hashValue: 8n,
+      timestamp: i,
+      message: { name },
+    }))
+    const rows = Cbuf.serializeMessages(tagSchema, tagHashes, messages, { region })
+    assert.deepStrictEqual(names(rows), ["d", ""])
+  })
+})
+
+describe("CbufWriter", () => {
+  const { Writable } = require("stream")
+  const { WritableStream } = require("stream/web")
+
+  const schemaText = `namespace messages { struct pose { f64 x; f64 y; string frame; } }`
+  const structPose = {
+    name: "messages::pose",
+    naked: false,
+    hashValue: 8n,
+    definitions: [
+      { name: "x", type: "float64" },
+      { name: "y", type: "float64" },
+      { name: "frame", type: "string" },
+    ],
+  }
+  const structOther = {
+    name: "messages::other",
+    naked: false,
+    hashValue: 9n,
+    definitions: [{ name: "value", type: "int32" }],
+  }
+  const schemaMap = new Map([
+    [structPose.name, structPose],
+    [structOther.name, structOther],
+  ])
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  function pose(i) {
+    return {
+      typeName: "messages::pose",
+      hashValue: 8n,
+      timestamp: i,
+      message: { x: i, y: -i, frame: "odom" },
+    }
+  }
+
+  function readAll(data) {
+    const messages = []
+    for (let offset = 0; offset < data.byteLength; ) {
+      const result = Cbuf.deserializeMessage(schemaMap, hashMap, data, offset)
+      messages.push(result)
+      offset += result.size
+    }
+    return messages
+  }
+
+  it("writes metadata once per type ahead of the first message", async () => {
+    const chunks = []
+    const writer = new Cbuf.CbufWriter({
+      schemaMap,
+      hashMap,
+      schemaText: new Map([["messages::pose", schemaText]]),
+      sink: (chunk) => chunks.push(chunk),
+      chunkSize: 200,
+    })
+    for (let i = 0; i < 10; i++) {
+      await writer.write(pose(i))
+    }
+    await writer.write({
+      typeName: "messages::other",
+      hashValue: 9n,
+      timestamp: 10,
+      message: { value: 3 },
+    })
+    await writer.close()
+
+    assert(chunks.length > 1)
+    const messages = readAll(Buffer.concat(chunks))
+    assert.deepStrictEqual(
+      messages.map((m) => m.typeName),
+      ["cbufmsg::metadata", ...new Array(10).fill("messages::pose"), "messages::other"],
+    )
+    assert.equal(messages[0].message.msg_hash, 8n)
+    assert.equal(messages[0].message.msg_name, "messages::pose")
+    assert.equal(messages[0].message.msg_meta, schemaText)
+    assert.equal(writer.messagesWritten, 11)
+    assert.equal(writer.bytesWritten, Buffer.concat(chunks).byteLength)
+  })
+
+  it("respects Node.js stream backpressure", async () => {
+    const received = []
+    let pending = 0
+    const sink = new Writable({
+      highWaterMark: 64,
+      write(chunk, _encoding, callback) {
+        pending++
+        setTimeout(() => {
+          pending--
+          received.push(chunk)
+          callback()
+        }, 1)
+      },
+    })
+    const writer = new Cbuf.CbufWriter({ schemaMap, hashMap, schemaText, sink, chunkSize: 128 })
+    for (let i = 0; i < 50; i++) {
+      await writer.write(pose(i))
+      assert(sink.writableLength <= 128 + 64)
+    }
+    await writer.close()
+    assert.equal(pending, 0)
+
+    const messages = readAll(Buffer.concat(received))
+    assert.equal(messages.length, 51)
+    assert.equal(messages[50].timestamp, 49)
+  })
+
+  it("reports Node.js stream errors from the next write or close", async () => {
+    const sink = new Writable({
+      highWaterMark: 1 << 20,
+      write(_chunk, _encoding, callback) {
+        setImmediate(() => callback(new Error("disk full")))
+      },
+    })
+    const writer = new Cbuf.CbufWriter({ schemaMap, hashMap, schemaText, sink, chunkSize: 128 })
+    for (let i = 0; i < 10; i++) {
+      await writer.write(pose(i))
+    }
+    // The error is emitted while no write is waiting on the stream
+    await new Promise((resolve) => setTimeout(resolve, 5))
+    await assert.rejects(() => writer.close(), /disk full/)
+  })
+
+  it("writes to a WritableStream and syncs on a flush interval", async () => {
+    const received = []
+    const sink = new WritableStream({ write: (chunk) => received.push(chunk) })
+    let syncs = 0
+    const writer = new Cbuf.CbufWriter({
+      schemaMap,
+      hashMap,
+      schemaText,
+      sink,
+      flushInterval: 5,
+      sync: () => syncs++,
+    })
+    await writer.write(pose(1))
+    assert.equal(received.length, 0)
+    await new Promise((resolve) => setTimeout(resolve, 30))
+    assert.equal(received.length, 1)
+    assert.equal(syncs, 1)
+
+    await writer.close()
+    assert.equal(readAll(Buffer.concat(received)).length, 2)
+    await assert.rejects(writer.write(pose(2)), /closed/)
+  })
+})
+
+describe("strings", () => {
+  const structNames = {
+    name: "messages::names",
+    naked: false,
+    hashValue: 10n,
+    definitions: [
+      { name: "name", type: "string" },
+      { name: "short", type: "string", upperBound: 16 },
+      { name: "list", type: "string", isArray: true },
+    ],
+  }
+  const schemaMap = new Map([[structNames.name, structNames]])
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  function roundTrip(message) {
+    const msg = { typeName: structNames.name, hashValue: 10n, timestamp: 0, message }
+    const data = new Uint8Array(Cbuf.serializeMessage(schemaMap, hashMap, msg))
+    return { data, result: Cbuf.deserializeMessage(schemaMap, hashMap, data).message }
+  }
+
+  it("sizes strings by UTF-8 byte length", () => {
+    const samples = ["", "ascii", "é", "日本語", "emoji 😀!", "lone \ud800 surrogate", "x".repeat(99)]
+    for (const name of samples) {
+      const { data, result } = roundTrip({ name, short: "", list: [name, "b"] })
+      const nameBytes = new TextEncoder().encode(name).byteLength
+      assert.equal(data.byteLength, 24 + 4 + nameBytes + 16 + 4 + 4 + nameBytes + 4 + 1)
+      assert.equal(result.name, name.replace("\ud800", "�"))
+      assert.deepStrictEqual(result.list, [result.name, "b"])
+    }
+  })
+
+  it("truncates short strings without splitting characters", () => {
+    const short = (value) => roundTrip({ name: "", short: value, list: [] }).result.short
+    assert.equal(short("0123456789abcdefXYZ"), "0123456789abcdef")
+    assert.equal(short("ééééééééé"), "éééééééé")
+    assert.equal(short("abc"), "abc")
+  })
+
+  it("stops decoding at the first null byte", () => {
+    const list = ["ü\0x", "y".repeat(40) + "\0z"]
+    const { data } = roundTrip({ name: "abc\0def", short: "", list })
+    const { message } = Cbuf.deserializeMessage(schemaMap, hashMap, data)
+    assert.equal(message.name, "abc")
+    assert.deepStrictEqual(message.list, ["ü", "y".repeat(40)])
+  })
+})
+
+describe("StringCache", () => {
+  const structStatus = {
+    name: "messages::status",
+    naked: false,
+    hashValue: 11n,
+    definitions: [
+      { name: "frame_id", type: "string" },
+      { name: "source", type: "string", upperBound: 16 },
+      { name: "notes", type: "string", isArray: true },
+    ],
+  }
+  const schemaMap = new Map([[structStatus.name, structStatus]])
+  const hashMap = Cbuf.schemaMapToHashMap(schemaMap)
+
+  const messages = Array.from({ length: 100 }, (_, i) => ({
+    typeName: structStatus.name,
+    hashValue: 11n,
+    timestamp: i,
+    message: { frame_id: i % 2 ? "base_link" : "odom", source: "lidar", notes: [`n${i}`] },
+  }))
+  const data = new Uint8Array(Cbuf.serializeMessages(schemaMap, hashMap, messages))
+
+  function decodeAll(options) {
+    const results = []
+    for (let offset = 0; offset < data.byteLength; ) {
+      const result = Cbuf.deserializeMessage(schemaMap, hashMap, data, offset, options)
+      results.push(result.message)
+      offset += result.size
+    }
+    return results
+  }
+
+  it("decodes the same values as the uncached path", () => {
+    const stringCache = new Cbuf.StringCache()
+    assert.deepStrictEqual(decodeAll({ stringCache }), decodeAll())
+
+    const stats = stringCache.stats()
+    // 3 distinct repeated values plus 100 distinct notes
+    assert.equal(stats.misses, 103)
+    assert.equal(stats.hits, 197)
+    assert.equal(stats.entries, 103)
+    assert.equal(stats.evictions, 0)
+    assert.equal(stats.hitRate, 197 / 300)
+    assert.equal(stats.bytesSaved, 49 * "base_link".length + 49 * "odom".length + 99 * 16)
+  })
+
+  it("stays within maxEntries", () => {
+    const stringCache = new Cbuf.StringCache({ maxEntries: 8, maxLength: 12 })
+    decodeAll({ stringCache })
+
+    const stats = stringCache.stats()
+    assert.equal(stats.entries, 8)
+    assert(stats.evictions > 0)
+    // The 16 byte short string is longer than maxLength and is never cached
+    assert.equal(stats.hits + stats.misses, 200)
+
+    stringCache.clear()
+    assert.deepStrictEqual(stringCache.stats(), {
+      entries: 0,
+      hits: 0,
+      misses: 0,
+      evictions: 0,
+      hitRate: 0,
+      bytesSaved: 0,
+    })
+  })
+})
+
+describe("getMemoryStats", () => {
+  it("releases parser pools and interned identifiers after each parse", async () => {
+    await Cbuf.isLoaded
+    const schema = `namespace messages { struct point { f64 x; f64 y; } }`
+
+    assert.equal(Cbuf.parseCBufSchema(schema).error, undefined)
+    const before = Cbuf.getMemoryStats().wasm
+    for (let i = 0; i < 10; i++) {
+      assert.equal(Cbuf.parseCBufSchema(schema).error, undefined)
+    }
+    const after = Cbuf.getMemoryStats().wasm
+
+    assert(after.heapSize > 0)
+    assert.equal(after.livePools, 0)
+    assert.equal(after.poolReservedBytes, 0)
+    assert(after.peakPoolReservedBytes > 0)
+    assert.equal(after.internEntries, before.internEntries)
+  })
+
+  it("reports buffers held by string caches and writers", async () => {
+    await Cbuf.isLoaded
+    const encoder = new TextEncoder()
+
+    const before = Cbuf.getMemoryStats().js
+    const cache = new Cbuf.StringCache()
+    cache.decode(encoder.encode("abc"))
+    cache.decode(encoder.encode("hello"))
+    cache.decode(encoder.encode("abc"))
+    const writer = new Cbuf.CbufWriter({
+      schemaMap: new Map(),
+      hashMap: new Map(),
+      sink: () => {},
+    })
+    const after = Cbuf.getMemoryStats().js
+
+    assert.equal(after.stringCaches.count, before.stringCaches.count + 1)
+    assert.equal(after.stringCaches.entries, before.stringCaches.entries + 2)
+    assert.equal(after.stringCaches.bytes, before.stringCaches.bytes + 8)
+    assert.equal(after.writers.count, before.writers.count + 1)
+    await writer.close()
+  })
+})
+
+describe("CbufTracer", () => {
+  const schemaText = `namespace messages { struct pose { f64 x; f64 y; string frame; } }`
+
+  it("records library activity as Chrome trace events", async () => {
+    await Cbuf.isLoaded
+    const tracer = new Cbuf.CbufTracer({ decodeBatchSize: 2 })
+    const previous = Cbuf.setTracer(tracer)
+    try {
+      const { schema } = Cbuf.parseCBufSchema(schemaText)
+      const hashMap = Cbuf.schemaMapToHashMap(schema)
+      const hashValue = schema.get("messages::pose").hashValue
+      const messages = [1, 2, 3].map((x) => ({
+        typeName: "messages::pose",
+        hashValue,
+        timestamp: x,
+        message: { x, y: -x, frame: "map" },
+      }))
+      const data = new Uint8Array(Cbuf.serializeMessages(schema, hashMap, messages))
+      let offset = 0
+      for (let i = 0; i < messages.length; i++) {
+        offset += Cbuf.deserializeMessage(schema, hashMap, data, offset).size
+      }
+    } finally {
+      Cbuf.setTracer(previous)
+    }
+
+    const trace = JSON.parse(JSON.stringify(tracer))
+    assert.equal(trace.otherData.droppedEvents, 0)
+    const events = trace.traceEvents.filter((e) => e.ph === "X")
+    for (const event of events) {
+      assert.equal(typeof event.ts, "number")
+      assert(event.dur >= 0)
+    }
+
+    const parse = events.find((e) => e.name === "parseCBufSchema")
+    assert.equal(parse.args.schemaLength, schemaText.length)
+    const serialize = events.find((e) => e.name === "serializeMessages")
+    assert.deepStrictEqual(serialize.args, { messages: 3, bytes: 3 * (24 + 8 + 8 + 4 + 3) })
+
+    // Three decodes in batches of two: one full batch and one flushed partial batch
+    const decodes = events.filter((e) => e.name === "decode")
+    assert.deepStrictEqual(
+      decodes.map((e) => e.args),
+      [
+        { type: "messages::pose", messages: 2, bytes: 2 * 47 },
+        { type: "messages::pose", messages: 1, bytes: 47 },
+      ],
+    )
+    const track = trace.traceEvents.find(
+      (e) => e.ph === "M" && e.args.name === "decode messages::pose",
+    )
+    assert.equal(decodes[0].tid, track.tid)
+  })
+
+  it("keeps the newest events in its ring buffer", () => {
+    const tracer = new Cbuf.CbufTracer({ capacity: 3 })
+    for (let i = 0; i < 5; i++) {
+      tracer.end(tracer.begin(`span${i}`, { i }))
+    }
+    assert.equal(tracer.dropped, 2)
+    assert.deepStrictEqual(
+      tracer.events().map((e) => e.name),
+      ["span2", "span3", "span4"],
+    )
+  })
+})
+
+describe("CbufDecodeProfiler", () => {
+  const schemaText = `
+namespace profile {
+  struct vec { f64 x; f64 y; }
+  struct sample { f64 times[2]; u8 flag; f32 values[]; vec pos; vec path[]; string tags[]; }
+}
+`
+
+  it("attributes decode time to fields and strategies", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const hashValue = schema.get("profile::sample").hashValue
+    const message = {
+      times: new Float64Array([1, 2]),
+      flag: 1,
+      values: new Float32Array([1, 2, 3]),
+      pos: { x: 1, y: 2 },
+      path: [
+        { x: 0, y: 0 },
+        { x: 1, y: 1 },
+      ],
+      tags: ["a", "b"],
+    }
+    const data = new Uint8Array(
+      Cbuf.serializeMessage(schema, hashMap, {
+        typeName: "profile::sample",
+        hashValue,
+        timestamp: 1,
+        message,
+      }),
+    )
+    const expected = Cbuf.deserializeMessage(schema, hashMap, data)
+
+    const profiler = new Cbuf.CbufDecodeProfiler()
+    const previous = Cbuf.setDecodeProfiler(profiler)
+    try {
+      assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, data), expected)
+      assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, data), expected)
+    } finally {
+      Cbuf.setDecodeProfiler(previous)
+    }
+
+    // Struct array elements are part of their field, not a type of their own
+    const report = profiler.report()
+    assert.equal(report.length, 1)
+    assert.equal(report[0].typeName, "profile::sample")
+    assert.equal(report[0].messages, 2)
+    assert.equal(report[0].bytes, 2 * data.length)
+
+    const fields = new Map(report[0].fields.map((field) => [field.path, field]))
+    assert.deepStrictEqual(
+      [...fields.keys()].sort(),
+      ["flag", "path", "pos.x", "pos.y", "tags", "times", "values"],
+    )
+    // The f32 data follows a one byte field and a length, so it is unaligned
+    assert.equal(fields.get("values").strategy, "copy")
+    assert.equal(fields.get("values").bytes, 2 * (4 + 3 * 4))
+    assert.equal(fields.get("times").strategy, "zero-copy")
+    assert.equal(fields.get("flag").strategy, "scalar")
+    assert.equal(fields.get("pos.x").count, 2)
+    assert.equal(fields.get("path").strategy, "object build")
+    assert.equal(fields.get("tags").strategy, "string decode")
+    for (let i = 1; i < report[0].fields.length; i++) {
+      assert(report[0].fields[i - 1].ms >= report[0].fields[i].ms)
+    }
+    assert(profiler.format().startsWith("profile::sample: 2 messages"))
+
+    profiler.clear()
+    assert.deepStrictEqual(profiler.report(), [])
+  })
+})
+
+describe("C ABI", () => {
+  const schemaText = `namespace messages { struct pose { f64 x; f64 y; u32 frame; } }`
+
+  function withHeap(mod, bytes, fn) {
+    const ptr = mod._cbuf_alloc(bytes.byteLength)
+    mod.HEAPU8.set(bytes, ptr)
+    try {
+      return fn(ptr)
+    } finally {
+      mod._cbuf_free(ptr)
+    }
+  }
+
+  it("parses schemas into registry handles", async () => {
+    await Cbuf.isLoaded
+    const mod = Cbuf.__module
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashValue = schema.get("messages::pose").hashValue
+    const text = new TextEncoder().encode(schemaText)
+    const handle = withHeap(mod, text, (ptr) => mod._cbuf_registry_parse(ptr, text.length, 0))
+    assert(handle > 0)
+    assert.equal(mod._cbuf_registry_count(handle), 1)
+    assert.equal(mod._cbuf_registry_find(handle, hashValue), 0)
+    assert.equal(mod._cbuf_registry_find(handle, 1n), -1)
+
+    const lenPtr = mod._cbuf_alloc(4)
+    const jsonPtr = mod._cbuf_registry_json(handle, lenPtr)
+    const json = new TextDecoder().decode(
+      mod.HEAPU8.subarray(jsonPtr, jsonPtr + mod.HEAPU32[lenPtr >>> 2]),
+    )
+    assert.equal(JSON.parse(json).schema[0].hashValue, String(hashValue))
+    mod._cbuf_free(lenPtr)
+    mod._cbuf_registry_free(handle)
+  })
+
+  it("converts default values like the embind parser", async () => {
+    await Cbuf.isLoaded
+    const defaultsText = `
+namespace defaults {
+  struct d {
+    f64 inf = 1.0 / 0.0;
+    f32 values[3] = {1, 2.5, -3};
+    u64 ids[2] = {1, 2};
+    string names[2] = {"x", "y"};
+    u8 bytes[2] = {-70, 300};
+    s8 small[2] = {200, -1};
+  }
+}
+`
+    const mod = Cbuf.__module
+    const embind = mod.parseCBufSchema
+    const expected = Cbuf.parseCBufSchema(defaultsText).schema
+    mod.parseCBufSchema = undefined
+    let schema
+    try {
+      schema = Cbuf.parseCBufSchema(defaultsText).schema
+    } finally {
+      mod.parseCBufSchema = embind
+    }
+    assert.deepStrictEqual(schema, expected)
+    const defaults = schema.get("defaults::d").definitions.map((field) => field.defaultValue)
+    assert.deepStrictEqual(defaults, [
+      Infinity,
+      [1, 2.5, -3],
+      [1n, 2n],
+      ["x", "y"],
+      // Integers wrap to the width of the element type
+      [186, 44],
+      [-56, -1],
+    ])
+  })
+
+  it("frames messages and stops before a partial trailing message", async () => {
+    await Cbuf.isLoaded
+    const mod = Cbuf.__module
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const hashValue = schema.get("messages::pose").hashValue
+    const messages = [0, 1, 2].map((i) => ({
+      typeName: "messages::pose",
+      hashValue,
+      timestamp: 10 + i,
+      variant: i,
+      message: { x: i, y: -i, frame: i },
+    }))
+    const data = new Uint8Array(Cbuf.serializeMessages(schema, hashMap, messages))
+    const truncated = data.subarray(0, data.byteLength - 1)
+
+    const entriesPtr = mod._cbuf_alloc(32 * 4 + 4)
+    const consumedPtr = entriesPtr + 32 * 4
+    const count = withHeap(mod, truncated, (ptr) =>
+      mod._cbuf_scan(ptr, truncated.byteLength, entriesPtr, 4, consumedPtr),
+    )
+    const view = new DataView(mod.HEAPU8.buffer, entriesPtr, 32 * 4 + 4)
+    const entries = Array.from({ length: count }, (_, i) => ({
+      hash: view.getBigUint64(i * 32, true),
+      timestamp: view.getFloat64(i * 32 + 8, true),
+      offset: view.getUint32(i * 32 + 16, true),
+      size: view.getUint32(i * 32 + 20, true),
+      variant: view.getUint32(i * 32 + 24, true),
+    }))
+    const consumed = view.getUint32(32 * 4, true)
+    mod._cbuf_free(entriesPtr)
+
+    const size = data.byteLength / 3
+    assert.deepStrictEqual(entries, [
+      { hash: hashValue, timestamp: 10, offset: 0, size, variant: 0 },
+      { hash: hashValue, timestamp: 11, offset: size, size, variant: 1 },
+    ])
+    assert.equal(consumed, 2 * size)
+  })
+})
+
+describe("schema snapshots", () => {
+  const schemaText = `
+namespace messages {
+  enum Mode { IDLE, RUN = 4 }
+  struct point @naked { f64 x = 1.5; f64 y; }
+  struct track {
+    s64 id = -17;
+    u64 stamp = 17;
+    string label = "";
+    short_string tag;
+    bool valid = true;
+    u8 bytes[4] = {1, 2, 3, 4};
+    u8 flags[8] @compact;
+    f64 far = 1.0 / 0.0;
+    f64 near = -1.0 / 0.0;
+    f32 unknown = 0.0 / 0.0;
+    point points[];
+    point origin;
+    Mode mode;
+  }
+}
+`
+
+  it("round-trips a parsed schema", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const defaults = schema.get("messages::track").definitions.map((field) => field.defaultValue)
+    assert(defaults.includes(Infinity) && defaults.includes(-Infinity) && defaults.includes(NaN))
+    const snapshot = Cbuf.serializeSchemaSnapshot(schema)
+    assert.deepStrictEqual(Cbuf.deserializeSchemaSnapshot(snapshot), schema)
+    assert.throws(() => Cbuf.deserializeSchemaSnapshot(new Uint8Array(64)), /Not a cbuf/)
+  })
+
+  it("loads the runtime without the wasm schema compiler", () => {
+    const script = `
+      const runtime = require(${JSON.stringify(`${__dirname}/../dist/runtime`)})
+      const loaded = Object.keys(require.cache).some((path) => path.endsWith("wasm-cbuf.js"))
+      process.stdout.write(JSON.stringify({ loaded, exports: Object.keys(runtime) }))
+    `
+    const { execFileSync } = require("child_process")
+    const result = JSON.parse(execFileSync(process.execPath, ["-e", script], { encoding: "utf8" }))
+    assert.equal(result.loaded, false)
+    assert(result.exports.includes("deserializeSchemaSnapshot"))
+    assert(result.exports.includes("deserializeMessage"))
+  })
+})
+
+describe("compiled decoders", () => {
+  const schemaText = `
+namespace t {
+  enum Mode { A, B = 4 }
+  struct vec @naked { f64 x; f32 y; u8 z; }
+  struct hdr { u32 seq; string frame; }
+  struct msg {
+    hdr header;
+    s8 a; u16 b; s64 c; u64 d; bool e; Mode mode;
+    string name; short_string tag;
+    u8 raw[3]; f64 fixed[2]; f32 dyn[]; bool flags[2];
+    string names[2]; string more[]; short_string tags[2];
+    vec points[]; vec origin; hdr hdrs[];
+    u8 compact[4] @compact;
+  }
+  struct other { u32 value; }
+}
+`
+  const message = {
+    header: { seq: 7, frame: "map" },
+    a: -3,
+    b: 500,
+    c: -5n,
+    d: 9n,
+    e: true,
+    mode: 4,
+    name: "héllo",
+    tag: "sh",
+    raw: [1, 2, 3],
+    fixed: [1.5, 2.5],
+    dyn: [1, 2, 3],
+    flags: [1, 0],
+    names: ["x", "yy"],
+    more: ["a", "b", "c"],
+    tags: ["p", "q"],
+    points: [
+      { x: 1, y: 2, z: 3 },
+      { x: 4, y: 5, z: 6 },
+    ],
+    origin: { x: 0, y: 0, z: 1 },
+    hdrs: [
+      { seq: 1, frame: "a" },
+      { seq: 2, frame: "bb" },
+    ],
+    compact: [1, 2],
+  }
+
+  it("decodes the same messages as the generic decoder", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const msg = {
+      typeName: "t::msg",
+      hashValue: schema.get("t::msg").hashValue,
+      timestamp: 5,
+      variant: 2,
+      message,
+    }
+    const data = new Uint8Array(Cbuf.serializeMessage(schema, hashMap, msg))
+    // An odd offset leaves the numeric arrays unaligned
+    const shifted = new Uint8Array(data.length + 1)
+    shifted.set(data, 1)
+    const expected = Cbuf.deserializeMessage(schema, hashMap, data, 0)
+
+    try {
+      assert.equal(Cbuf.compileDecoders(schema), 3)
+      assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, data, 0), expected)
+      assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, shifted, 1), expected)
+      const stringCache = new Cbuf.StringCache()
+      const cached = Cbuf.deserializeMessage(schema, hashMap, data, 0, { stringCache })
+      assert.deepStrictEqual(cached, expected)
+
+      const truncated = data.slice()
+      new DataView(truncated.buffer).setUint32(4, (data.length - 1) | 0x90000000, true)
+      assert.throws(() => Cbuf.deserializeMessage(schema, hashMap, truncated, 0), /does not match/)
+    } finally {
+      Cbuf.clearDecoders()
+    }
+  })
+
+  it("falls back to the generic decoder for other hashes", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const other = {
+      typeName: "t::other",
+      hashValue: schema.get("t::other").hashValue,
+      timestamp: 0,
+      message: { value: 3 },
+    }
+    const data = new Uint8Array(Cbuf.serializeMessage(schema, hashMap, other))
+    try {
+      assert.equal(Cbuf.compileDecoders(schema, ["t::msg"]), 1)
+      assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, data).message, { value: 3 })
+
+      // Ahead-of-time decoders register the same factories
+      const source = Cbuf.generateDecoderSource(schema, "t::other")
+      let calls = 0
+      Cbuf.registerDecoder(schema.get("t::other").hashValue, (rt) => {
+        const decode = new Function("rt", source)(rt)
+        return (...args) => (calls++, decode(...args))
+      })
+      assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, data).message, { value: 3 })
+      assert.equal(calls, 1)
+    } finally {
+      Cbuf.clearDecoders()
+    }
+  })
+})
+
+describe("log reading", () => {
+  const schemaText = `
+namespace logs {
+  struct pose { f64 x; f64 y; }
+  struct status { u32 code; string text; }
+}
+`
+
+  // Serialize `[typeName, timestamp, message]` tuples into a log buffer
+  function makeLog(schema, hashMap, entries) {
+    const messages = entries.map(([typeName, timestamp, message]) => ({
+      typeName,
+      hashValue: schema.get(typeName).hashValue,
+      timestamp,
+      message,
+    }))
+    return new Uint8Array(Cbuf.serializeMessages(schema, hashMap, messages))
+  }
+
+  it("indexes a log incrementally", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const data = makeLog(schema, hashMap, [
+      ["logs::pose", 1, { x: 1, y: 2 }],
+      ["logs::status", 3, { code: 7, text: "ok" }],
+      ["logs::pose", 2, { x: 3, y: 4 }],
+    ])
+
+    const index = new Cbuf.CbufIndex()
+    // A partial trailing message is left for the next scan
+    assert.equal(index.scan(data.subarray(0, data.length - 1)), 2)
+    assert.equal(index.scan(data.subarray(index.end), index.end), 1)
+    assert.equal(index.end, data.length)
+    assert.deepStrictEqual(Array.from(index.timestamps), [1, 3, 2])
+    assert.equal(index.hashes[1], schema.get("logs::status").hashValue)
+    assert.equal(index.offsets[1], index.sizes[0])
+    assert.equal(index.sorted, false)
+    assert.deepStrictEqual([0, 1, 2].map((rank) => index.byTime(rank)), [0, 2, 1])
+    assert.equal(index.lowerBound(2), 1)
+    assert.equal(index.lowerBound(2, true), 2)
+    assert.throws(() => Cbuf.CbufIndex.fromBuffer(new Uint8Array(32)), /Invalid cbuf magic/)
+  })
+
+  it("merges logs by timestamp", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const logs = [
+      makeLog(schema, hashMap, [
+        ["logs::pose", 1, { x: 0, y: 0 }],
+        ["logs::pose", 2, { x: 0, y: 1 }],
+        ["logs::pose", 4, { x: 0, y: 2 }],
+      ]),
+      makeLog(schema, hashMap, [
+        ["logs::status", 2, { code: 1, text: "a" }],
+        ["logs::status", 2, { code: 2, text: "b" }],
+        ["logs::status", 0.5, { code: 3, text: "c" }],
+      ]),
+      makeLog(schema, hashMap, []),
+    ]
+
+    const merged = [...Cbuf.mergeLogs(logs)]
+    assert.deepStrictEqual(
+      merged.map((ref) => [ref.log, ref.timestamp]),
+      [
+        [1, 0.5],
+        [0, 1],
+        [0, 2],
+        [1, 2],
+        [1, 2],
+        [0, 4],
+      ],
+    )
+    assert.equal(merged[3].offset, 0)
+    assert.equal(merged[4].offset, merged[3].size)
+
+    const options = { start: 2, end: 2, decode: true, schemaMap: schema, hashMap }
+    const decoded = [...Cbuf.mergeLogs(logs, options)]
+    assert.deepStrictEqual(
+      decoded.map((ref) => ref.message.message.code ?? ref.message.message.y),
+      [1, 1, 2],
+    )
+  })
+
+  it("finds the latest message of each type at a time", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const pose = schema.get("logs::pose").hashValue
+    const status = schema.get("logs::status").hashValue
+    const metadata = {
+      typeName: "cbufmsg::metadata",
+      hashValue: 0xbe6738d544ab72c6n,
+      timestamp: 0,
+      message: { msg_hash: pose, msg_name: "logs::pose", msg_meta: schemaText },
+    }
+    const data = makeLog(schema, hashMap, [
+      ["logs::pose", 1, { x: 1, y: 0 }],
+      ["logs::status", 3, { code: 3, text: "" }],
+      ["logs::status", 2, { code: 2, text: "" }],
+      ["logs::pose", 4, { x: 4, y: 0 }],
+    ])
+    const header = new Uint8Array(Cbuf.serializeMessage(schema, hashMap, metadata))
+    const log = new Uint8Array([...header, ...data])
+    const index = Cbuf.CbufIndex.fromBuffer(log)
+    const offsets = index.offsets
+    const snapshot = (timestamp, hashes) => [...index.snapshotAt(timestamp, hashes).values()]
+
+    assert.deepStrictEqual(snapshot(0.5), [])
+    assert.deepStrictEqual(snapshot(2), [offsets[1], offsets[3]])
+    assert.deepStrictEqual(snapshot(3.5), [offsets[1], offsets[2]])
+    assert.deepStrictEqual(snapshot(9, [pose]), [offsets[4]])
+    assert.deepStrictEqual(snapshot(9, [0xbe6738d544ab72c6n]), [offsets[0]])
+
+    const messages = Cbuf.deserializeMessagesAt(schema, hashMap, log, index.snapshotAt(3.5))
+    assert.deepStrictEqual([...messages.keys()], [pose, status])
+    assert.equal(messages.get(pose).message.x, 1)
+    assert.equal(messages.get(status).message.code, 3)
+  })
+
+  it("follows a growing log", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    let bytes = new Uint8Array(0)
+    const writer = new Cbuf.CbufWriter({
+      schemaMap: schema,
+      hashMap,
+      schemaText,
+      sink: (chunk) => (bytes = new Uint8Array([...bytes, ...chunk])),
+    })
+    // Only `visible` bytes of the log have been written so far
+    let visible = 0
+    const reads = []
+    const source = {
+      size: () => visible,
+      read: (offset, length) => (reads.push(length), bytes.slice(offset, offset + length)),
+    }
+    const follower = new Cbuf.CbufFollower({
+      source,
+      parseSchema: Cbuf.parseCBufSchema,
+      decode: true,
+    })
+    const seen = []
+    follower.subscribe((entries) => seen.push(...entries))
+
+    const pose = (timestamp, x) => ({
+      typeName: "logs::pose",
+      hashValue: schema.get("logs::pose").hashValue,
+      timestamp,
+      message: { x, y: 0 },
+    })
+    await writer.write(pose(1, 1))
+    await writer.write(pose(2, 2))
+    await writer.flush()
+
+    // The metadata message and half of the first pose
+    const metadataSize = bytes.length - 2 * 40
+    visible = metadataSize + 20
+    assert.equal(await follower.poll(), 1)
+    assert.equal(seen[0].message.typeName, "cbufmsg::metadata")
+    assert.notEqual(follower.hashMap.get(schema.get("logs::pose").hashValue), undefined)
+
+    visible = bytes.length
+    assert.equal(await follower.poll(), 2)
+    assert.equal(await follower.poll(), 0)
+    assert.deepStrictEqual(
+      seen.slice(1).map((entry) => [entry.offset, entry.message.message.x]),
+      [
+        [metadataSize, 1],
+        [metadataSize + 40, 2],
+      ],
+    )
+    // Each poll read only the appended bytes
+    assert.deepStrictEqual(reads, [metadataSize + 20, bytes.length - metadataSize - 20])
+    assert.equal(follower.index.count, 3)
+    await writer.close()
+  })
+
+  it("follows a log in bounded chunks and delivers entries before a schema error", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    let bytes = new Uint8Array(0)
+    const writer = new Cbuf.CbufWriter({
+      schemaMap: schema,
+      hashMap,
+      schemaText,
+      sink: (chunk) => (bytes = new Uint8Array([...bytes, ...chunk])),
+    })
+    for (let i = 0; i < 4; i++) {
+      await writer.write({
+        typeName: "logs::pose",
+        hashValue: schema.get("logs::pose").hashValue,
+        timestamp: i,
+        message: { x: i, y: 0 },
+      })
+    }
+    await writer.close()
+    const metadataSize = bytes.length - 4 * 40
+
+    const follow = (parseSchema) => {
+      const reads = []
+      const follower = new Cbuf.CbufFollower({
+        source: {
+          size: () => bytes.length,
+          read: (offset, length) => (reads.push(length), bytes.slice(offset, offset + length)),
+        },
+        parseSchema,
+        decode: true,
+        chunkSize: 64,
+      })
+      const batches = []
+      follower.subscribe((entries) => batches.push(entries))
+      return { follower, reads, batches }
+    }
+
+    // The metadata message is larger than a chunk and is read whole
+    const { follower, reads, batches } = follow(Cbuf.parseCBufSchema)
+    assert.equal(await follower.poll(), 5)
+    assert.equal(reads[0], 64)
+    assert.equal(reads[1], metadataSize - 64)
+    assert(reads.slice(2).every((length) => length <= 64))
+    assert(batches.length > 1)
+    assert.deepStrictEqual(
+      batches.flat().map((entry) => entry.message.message.x),
+      [undefined, 0, 1, 2, 3],
+    )
+
+    // The metadata entry and the rest of its chunk are delivered before the error
+    const failing = follow(() => ({ error: "bad schema", schema: new Map() }))
+    await assert.rejects(failing.follower.poll(), /bad schema/)
+    const delivered = failing.batches.flat()
+    assert.equal(delivered.length, failing.follower.index.count)
+    assert.equal(delivered[0].message.typeName, "cbufmsg::metadata")
+    assert.equal(failing.follower.readOffset, failing.follower.index.end)
+    // The next poll resumes after the delivered entries
+    assert.equal(await failing.follower.poll(), 5 - delivered.length)
+    assert.equal(failing.follower.index.count, 5)
+  })
+
+  it("stops a poll when a followed log is truncated while reading", async () => {
+    const follower = new Cbuf.CbufFollower({
+      source: { size: async () => 1000, read: async () => new Uint8Array(0) },
+    })
+    assert.equal(await follower.poll(), 0)
+    assert.equal(follower.readOffset, 0)
+  })
+
+  it("fails a follower on bytes that cannot be framed", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const log = makeLog(schema, hashMap, [
+      ["logs::pose", 1, { x: 1, y: 0 }],
+      ["logs::pose", 2, { x: 2, y: 0 }],
+    ])
+    // Corrupt the magic of the second message
+    const bytes = log.slice()
+    bytes[40] ^= 0xff
+    const follower = new Cbuf.CbufFollower({
+      source: new Cbuf.CbufMemorySource(bytes),
+      schemaMap: schema,
+      hashMap,
+      decode: true,
+    })
+    const seen = []
+    follower.subscribe((entries) => seen.push(...entries))
+
+    await assert.rejects(follower.poll(), /Invalid cbuf magic .* at offset 40/)
+    assert.deepStrictEqual(
+      seen.map((entry) => [entry.offset, entry.message.message.x]),
+      [[0, 1]],
+    )
+    assert.equal(follower.index.end, 40)
+    // Later polls keep failing rather than framing from the wrong offset
+    await assert.rejects(follower.poll(), /Invalid cbuf magic/)
+    assert.equal(seen.length, 1)
+    assert.equal(follower.index.count, 1)
+  })
+
+  it("plays logs back at their timestamps", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const poses = []
+    const statuses = []
+    for (let i = 0; i < 20; i++) {
+      poses.push(["logs::pose", i * 0.002, { x: i, y: 0 }])
+      statuses.push(["logs::status", i * 0.002 + 0.001, { code: i, text: "" }])
+    }
+    const logs = [makeLog(schema, hashMap, poses), makeLog(schema, hashMap, statuses)]
+
+    const player = new Cbuf.CbufPlayer(logs, { schemaMap: schema, hashMap, maxReady: 4 })
+    const played = []
+    const ended = new Promise((resolve) => {
+      player.subscribe((ref) => {
+        assert(ref.timestamp <= player.time)
+        assert(player.stats().ready < 4)
+        played.push(ref.timestamp)
+      }, resolve)
+    })
+    const start = performance.now()
+    player.play()
+    assert.equal(await ended, undefined)
+    // 40 messages over 39ms of log time, played in real time
+    assert(performance.now() - start >= 38)
+    assert.equal(played.length, 40)
+    assert.deepStrictEqual(played, [...played].sort((a, b) => a - b))
+    assert.equal(player.stats().emitted, 40)
+
+    // Seek back and play the rest at 10x
+    player.seek(0.03)
+    player.setRate(10)
+    const rest = []
+    player.subscribe((ref) => rest.push(ref.message.message.code ?? ref.message.message.x))
+    await new Promise((resolve) => {
+      player.subscribe(() => {}, resolve)
+      player.play()
+    })
+    assert.deepStrictEqual(rest, [15, 15, 16, 16, 17, 17, 18, 18, 19, 19])
+  })
+
+  it("rejects playback rates that cannot advance the playhead", () => {
+    assert.throws(() => new Cbuf.CbufPlayer([], { rate: 0 }), /Invalid playback rate 0/)
+    const player = new Cbuf.CbufPlayer([])
+    for (const rate of [0, -1, Infinity, NaN]) {
+      assert.throws(() => player.setRate(rate), /Invalid playback rate/)
+    }
+    assert.equal(player.rate, 1)
+  })
+})
+
+describe("MessageCache", () => {
+  const schemaText = `
+namespace cache {
+  struct cloud { f32 points[]; string frame; }
+}
+`
+
+  it("reuses decoded messages within a byte budget", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const messages = [0, 1, 2, 3].map((i) => ({
+      typeName: "cache::cloud",
+      hashValue: schema.get("cache::cloud").hashValue,
+      timestamp: i,
+      message: { points: new Float32Array(1000), frame: "map" },
+    }))
+    const data = new Uint8Array(Cbuf.serializeMessages(schema, hashMap, messages))
+    const index = Cbuf.CbufIndex.fromBuffer(data)
+
+    // Room for about two clouds
+    const messageCache = new Cbuf.MessageCache({ maxBytes: 9000 })
+    const options = { messageCache }
+    const first = Cbuf.deserializeMessage(schema, hashMap, data, 0, options)
+    assert.strictEqual(Cbuf.deserializeMessage(schema, hashMap, data, 0, options), first)
+    assert.deepStrictEqual(Cbuf.deserializeMessage(schema, hashMap, data), first)
+    assert.equal(messageCache.stats().hits, 1)
+    assert(messageCache.stats().bytes > 4000)
+    assert.equal(Cbuf.getMemoryStats().js.messageCaches.entries >= 1, true)
+
+    // Pinning the first message keeps it while the others push each other out
+    messageCache.pin(0, 0)
+    for (const offset of index.offsets) {
+      Cbuf.deserializeMessage(schema, hashMap, data, offset, options)
+    }
+    const stats = messageCache.stats()
+    assert.equal(stats.entries, 2)
+    assert.equal(stats.evictions, 2)
+    assert(stats.bytes <= 9000)
+    assert.strictEqual(messageCache.get(data, 0), first)
+    assert.equal(messageCache.get(data, index.offsets[2]), undefined)
+
+    // Merged playback shares the cache under each log's id
+    messageCache.unpin()
+    const mergeOptions = { decode: true, schemaMap: schema, hashMap, messageCache }
+    const merged = [...Cbuf.mergeLogs([{ data, id: "a" }], mergeOptions)]
+    assert.strictEqual(messageCache.get("a", index.offsets[3]), merged[3].message)
+    messageCache.clear("a")
+    assert.equal(messageCache.get("a", index.offsets[3]), undefined)
+  })
+
+  it("evicts down to the budget after an oversized set and a narrower pin", () => {
+    const messageCache = new Cbuf.MessageCache({ maxBytes: 2000 })
+    const message = (timestamp, length) => ({
+      typeName: "cache::blob",
+      size: length,
+      variant: 0,
+      hashValue: 1n,
+      timestamp,
+      message: { data: new Uint8Array(length) },
+    })
+    for (let i = 0; i < 8; i++) {
+      messageCache.set("a", i, message(i, 100))
+    }
+    messageCache.set("a", 8, message(8, 700))
+    assert(messageCache.stats().bytes <= 2000)
+    assert(messageCache.get("a", 8) != undefined)
+
+    // Pinned messages may exceed the budget until the window moves
+    messageCache.pin(0, 100)
+    for (let i = 10; i < 20; i++) {
+      messageCache.set("a", i, message(i, 100))
+    }
+    assert(messageCache.stats().bytes > 2000)
+    messageCache.pin(19, 19)
+    assert(messageCache.stats().bytes <= 2000)
+    assert(messageCache.get("a", 19) != undefined)
+  })
+})
+
+describe("log sources", () => {
+  const fs = require("fs")
+  const os = require("os")
+  const path = require("path")
+  const schemaText = `
+namespace sources {
+  struct sample { u32 seq; f64 values[4]; string label; }
+}
+`
+
+  it("indexes and decodes a log through a block cache", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const messages = []
+    for (let i = 0; i < 50; i++) {
+      messages.push({
+        typeName: "sources::sample",
+        hashValue: schema.get("sources::sample").hashValue,
+        timestamp: i,
+        message: { seq: i, values: [i, i + 1, i + 2, i + 3], label: `sample ${i}` },
+      })
+    }
+    const data = new Uint8Array(Cbuf.serializeMessages(schema, hashMap, messages))
+    const expected = Cbuf.CbufIndex.fromBuffer(data)
+
+    const source = new Cbuf.CbufMemorySource(data)
+    const cache = new Cbuf.BlockCache(source, { blockSize: 64, maxBytes: 1024, readahead: 4 })
+    // Chunks smaller than a message still frame every message
+    const index = await Cbuf.CbufIndex.fromSource(cache, { chunkSize: 50 })
+    assert.equal(index.count, expected.count)
+    assert.equal(index.end, data.length)
+    assert.deepStrictEqual([...index.offsets], [...expected.offsets])
+    assert.deepStrictEqual([...index.timestamps], [...expected.timestamps])
+
+    const stats = cache.stats()
+    assert(stats.reads < stats.misses, "missing blocks are fetched in runs")
+    assert(stats.hits > 0)
+    assert(stats.bytes <= 1024)
+
+    const offset = index.offsets[7]
+    const message = await Cbuf.readMessage(schema, hashMap, cache, offset)
+    assert.deepStrictEqual(message, Cbuf.deserializeMessage(schema, hashMap, data, offset))
+
+    const snapshot = index.snapshotAt(20)
+    const decoded = await Cbuf.readMessagesAt(schema, hashMap, cache, snapshot)
+    const [[hash, snapshotOffset]] = [...snapshot]
+    assert.equal(decoded.get(hash).message.seq, 20)
+    assert.equal(snapshotOffset, index.offsets[20])
+  })
+
+  it("reads a log from a file", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const message = { seq: 1, values: [1, 2, 3, 4], label: "file" }
+    const hashValue = schema.get("sources::sample").hashValue
+    const data = new Uint8Array(
+      Cbuf.serializeMessages(schema, hashMap, [
+        { typeName: "sources::sample", hashValue, timestamp: 5, message },
+      ]),
+    )
+    const filename = path.join(os.tmpdir(), `wasm-cbuf-source-${process.pid}.cb`)
+    fs.writeFileSync(filename, data)
+    const handle = await fs.promises.open(filename)
+    try {
+      const source = new Cbuf.CbufFileSource(handle)
+      assert.equal(await source.size(), data.length)
+      // Reads past the end of the file are short
+      assert.equal((await source.read(data.length - 4, 100)).length, 4)
+      const index = await Cbuf.CbufIndex.fromSource(source)
+      assert.equal(index.count, 1)
+      const decoded = await Cbuf.readMessage(schema, hashMap, source, 0)
+      assert.equal(decoded.timestamp, 5)
+      assert.equal(decoded.message.label, "file")
+    } finally {
+      await handle.close()
+      fs.unlinkSync(filename)
+    }
+  })
+})
+
+describe("change detection", () => {
+  const schemaText = `
+namespace changes {
+  struct vec { f64 x; f64 y; }
+  struct point @naked { f32 x; f32 y; }
+  struct state {
+    u32 seq;
+    vec position;
+    point target;
+    string label;
+    f32 ranges[];
+    u8 flags[4];
+    point path[];
+    string tags[2];
+  }
+}
+`
+
+  it("reports the fields that differ without decoding", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const serialize = (message, timestamp) =>
+      new Uint8Array(
+        Cbuf.serializeMessage(schema, hashMap, {
+          typeName: "changes::state",
+          hashValue: schema.get("changes::state").hashValue,
+          timestamp,
+          message,
+        }),
+      )
+    const base = {
+      seq: 1,
+      position: { x: 1, y: 2 },
+      target: { x: 3, y: 4 },
+      label: "a",
+      ranges: [1, 2],
+      flags: [0, 1, 0, 1],
+      path: [{ x: 0, y: 0 }],
+      tags: ["x", "y"],
+    }
+
+    const detector = new Cbuf.CbufChangeDetector(schema, hashMap)
+    const all = detector.update(serialize(base, 1))
+    assert.deepStrictEqual(
+      [...all],
+      [
+        "seq",
+        "position.x",
+        "position.y",
+        "target.x",
+        "target.y",
+        "label",
+        "ranges",
+        "flags",
+        "path",
+        "tags",
+      ],
+    )
+    // Only the timestamp differs
+    assert.equal(detector.update(serialize(base, 2)).size, 0)
+
+    // A longer string shifts everything after it, which still compares equal
+    const next = { ...base, position: { x: 1, y: 5 }, label: "abc", path: [{ x: 0, y: 1 }] }
+    const data = new Uint8Array(8 + serialize(next, 3).length)
+    data.set(serialize(next, 3), 8)
+    assert.deepStrictEqual([...detector.update(data, 8)], ["position.y", "label", "path"])
+    data.fill(0)
+
+    const last = { ...next, target: { x: 3, y: 6 }, ranges: [1, 2, 3], tags: ["x", "z"] }
+    assert.deepStrictEqual(
+      [...Cbuf.diffMessages(schema, hashMap, serialize(next, 3), serialize(last, 4))],
+      ["target.y", "ranges", "tags"],
+    )
+    assert.deepStrictEqual([...detector.update(serialize(last, 4))], ["target.y", "ranges", "tags"])
+
+    detector.reset()
+    assert.equal(detector.update(serialize(last, 5)).size, all.size)
+  })
+
+  it("compares the metadata messages of a log", async () => {
+    await Cbuf.isLoaded
+    const { schema } = Cbuf.parseCBufSchema(schemaText)
+    const hashMap = Cbuf.schemaMapToHashMap(schema)
+    const metadata = (msg_meta) =>
+      new Uint8Array(
+        Cbuf.serializeMessage(schema, hashMap, {
+          typeName: "cbufmsg::metadata",
+          hashValue: 0xbe6738d544ab72c6n,
+          timestamp: 0,
+          message: { msg_hash: 1n, msg_name: "changes::vec", msg_meta },
+        }),
+      )
+
+    // Neither map holds the bootstrapped metadata definition
+    const detector = new Cbuf.CbufChangeDetector(schema, hashMap)
+    assert.deepStrictEqual(
+      [...detector.update(metadata("a"))],
+      ["msg_hash", "msg_name", "msg_meta"],
+    )
+    assert.deepStrictEqual([...detector.update(metadata("b"))], ["msg_meta"])
+    assert.equal(Cbuf.diffMessages(schema, hashMap, metadata("b"), metadata("b")).size, 0)
+  })
+})